@@ -356,6 +356,7 @@ LOCAL_SRC_FILES := \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/btsnoop.c \
 	bluez/src/shared/mainloop.c \
+	bluez/src/oui.c \
 	bluez/lib/hci.c \
 	bluez/lib/bluetooth.c \
 
@@ -410,6 +411,7 @@ LOCAL_SRC_FILES := \
 	bluez/android/hal-audio.c \
 	bluez/android/hal-audio-sbc.c \
 	bluez/android/hal-audio-aptx.c \
+	bluez/android/hal-pcm.c \
 
 LOCAL_C_INCLUDES = \
 	$(LOCAL_PATH)/bluez \
@@ -435,6 +437,37 @@ endif
 
 include $(BUILD_SHARED_LIBRARY)
 
+#
+# codecbench
+#
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	bluez/android/codecbench.c \
+	bluez/android/hal-audio-sbc.c \
+	bluez/android/hal-audio-aptx.c \
+	bluez/android/hal-pcm.c \
+
+LOCAL_C_INCLUDES = \
+	$(LOCAL_PATH)/bluez \
+	$(call include-path-for, system-core) \
+	$(call include-path-for, libhardware) \
+	$(call include-path-for, sbc) \
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libsbc \
+
+LOCAL_CFLAGS := $(BLUEZ_COMMON_CFLAGS)
+LOCAL_LDFLAGS := -ldl
+
+LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
+LOCAL_MODULE_TAGS := debug
+LOCAL_MODULE := codecbench
+
+include $(BUILD_EXECUTABLE)
+
 #
 # SCO audio
 #
@@ -442,6 +475,7 @@ include $(BUILD_SHARED_LIBRARY)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := bluez/android/hal-sco.c \
+	bluez/android/hal-pcm.c \
 	bluez/android/hal-utils.c
 
 LOCAL_C_INCLUDES = \
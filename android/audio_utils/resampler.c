@@ -32,9 +32,10 @@ struct resampler {
     uint32_t in_sample_rate;                    // input sampling rate in Hz
     uint32_t out_sample_rate;                   // output sampling rate in Hz
     uint32_t channel_count;                     // number of channels (interleaved)
-    int16_t *in_buf;                            // input buffer
+    int16_t *in_buf;                            // buffer for input frames left over by speex
     size_t in_buf_size;                         // input buffer size
-    size_t frames_in;                           // number of frames in input buffer
+    size_t in_buf_pos;                          // index of first frame left in input buffer
+    size_t frames_in;                           // number of frames left in input buffer
     size_t frames_rq;                           // cached number of output frames
     size_t frames_needed;                       // minimum number of input frames to produce
                                                 // frames_rq output frames
@@ -50,10 +51,15 @@ static void resampler_reset(struct resampler_itfe *resampler)
 {
     struct resampler *rsmp = (struct resampler *)resampler;
 
+    if (rsmp == NULL) {
+        return;
+    }
+
+    rsmp->in_buf_pos = 0;
     rsmp->frames_in = 0;
     rsmp->frames_rq = 0;
 
-    if (rsmp != NULL && rsmp->speex_resampler != NULL) {
+    if (rsmp->speex_resampler != NULL) {
         speex_resampler_reset_mem(rsmp->speex_resampler);
     }
 }
@@ -68,8 +74,37 @@ static int32_t resampler_delay_ns(struct resampler_itfe *resampler)
     return delay;
 }
 
+// runs speex on inFrames frames of in and updates inFrames and outFrames with the number of
+// frames consumed and produced.
+static void resampler_process(struct resampler *rsmp,
+                       const int16_t *in,
+                       size_t *inFrames,
+                       int16_t *out,
+                       size_t *outFrames)
+{
+    if (rsmp->channel_count == 1) {
+        speex_resampler_process_int(rsmp->speex_resampler,
+                                    0,
+                                    in,
+                                    (void *) inFrames,
+                                    out,
+                                    (void *) outFrames);
+    } else {
+        speex_resampler_process_interleaved_int(rsmp->speex_resampler,
+                                    in,
+                                    (void *) inFrames,
+                                    out,
+                                    (void *) outFrames);
+    }
+}
+
 // outputs a number of frames less or equal to *outFrameCount and updates *outFrameCount
 // with the actual number of frames produced.
+//
+// Provider buffers are handed to speex directly. Speex consumes all input frames unless the
+// output is full, so frames are only left over at the end of a call and are consumed first by
+// the next one. Only those are copied to in_buf which is then read from in_buf_pos on, so in
+// steady state there is no allocation or memmove.
 static int resampler_resample_from_provider(struct resampler_itfe *resampler,
                        int16_t *out,
                        size_t *outFrameCount)
@@ -77,7 +112,6 @@ static int resampler_resample_from_provider(struct resampler_itfe *resampler,
     struct resampler *rsmp = (struct resampler *)resampler;
     size_t framesRq;
     size_t framesWr;
-    size_t inFrames;
 
     if (rsmp == NULL || out == NULL || outFrameCount == NULL) {
         return -EINVAL;
@@ -96,59 +130,79 @@ static int resampler_resample_from_provider(struct resampler_itfe *resampler,
     }
 
     framesWr = 0;
-    inFrames = 0;
     while (framesWr < framesRq) {
-        size_t outFrames;
-        if (rsmp->frames_in < rsmp->frames_needed) {
-            struct resampler_buffer buf;
-            // make sure that the number of frames present in rsmp->in_buf (rsmp->frames_in) is at
-            // least the number of frames needed to produce the number of frames requested at
-            // the output sampling rate
-            if (rsmp->in_buf_size < rsmp->frames_needed) {
-                rsmp->in_buf_size = rsmp->frames_needed;
-                rsmp->in_buf = (int16_t *)realloc(rsmp->in_buf,
-                                        rsmp->in_buf_size * rsmp->channel_count * sizeof(int16_t));
-            }
-            buf.frame_count = rsmp->frames_needed - rsmp->frames_in;
-            rsmp->provider->get_next_buffer(rsmp->provider, &buf);
-            if (buf.raw == NULL) {
+        struct resampler_buffer buf;
+        size_t inFrames;
+        size_t outFrames = framesRq - framesWr;
+
+        if (rsmp->frames_in) {
+            inFrames = rsmp->frames_in;
+            resampler_process(rsmp,
+                              rsmp->in_buf + rsmp->in_buf_pos * rsmp->channel_count,
+                              &inFrames,
+                              out + framesWr * rsmp->channel_count,
+                              &outFrames);
+            framesWr += outFrames;
+            rsmp->frames_in -= inFrames;
+            rsmp->in_buf_pos = rsmp->frames_in ? rsmp->in_buf_pos + inFrames : 0;
+
+            if (inFrames == 0 && outFrames == 0) {
                 break;
             }
-            memcpy(rsmp->in_buf + rsmp->frames_in * rsmp->channel_count,
-                    buf.raw,
-                    buf.frame_count * rsmp->channel_count * sizeof(int16_t));
-            rsmp->frames_in += buf.frame_count;
-            rsmp->provider->release_buffer(rsmp->provider, &buf);
+            continue;
         }
 
-        outFrames = framesRq - framesWr;
-        inFrames = rsmp->frames_in;
-        if (rsmp->channel_count == 1) {
-            speex_resampler_process_int(rsmp->speex_resampler,
-                                        0,
-                                        rsmp->in_buf,
-                                        (void *) &inFrames,
-                                        out + framesWr,
-                                        (void *) &outFrames);
-        } else {
-            speex_resampler_process_interleaved_int(rsmp->speex_resampler,
-                                        rsmp->in_buf,
-                                        (void *) &inFrames,
-                                        out + framesWr * rsmp->channel_count,
-                                        (void *) &outFrames);
+        // only request what is needed for the remaining output so that few frames are
+        // left over
+        buf.frame_count = (outFrames * rsmp->in_sample_rate) / rsmp->out_sample_rate + 1;
+        rsmp->provider->get_next_buffer(rsmp->provider, &buf);
+        if (buf.raw == NULL) {
+            break;
         }
+
+        inFrames = buf.frame_count;
+        resampler_process(rsmp,
+                          buf.i16,
+                          &inFrames,
+                          out + framesWr * rsmp->channel_count,
+                          &outFrames);
         framesWr += outFrames;
-        rsmp->frames_in -= inFrames;
 
-        if ((framesWr != framesRq) && (rsmp->frames_in != 0))
-            warn("ReSampler::resample() remaining %zd frames in and %zd out",
-                rsmp->frames_in, (framesRq - framesWr));
-    }
-    if (rsmp->frames_in) {
-        memmove(rsmp->in_buf,
-                rsmp->in_buf + inFrames * rsmp->channel_count,
-                rsmp->frames_in * rsmp->channel_count * sizeof(int16_t));
+        if (inFrames < buf.frame_count) {
+            size_t frames = buf.frame_count - inFrames;
+
+            // buffer is sized for frames_needed so it only grows if the requested number of
+            // output frames grows or the provider returns more than requested
+            if (rsmp->in_buf_size < frames || rsmp->in_buf_size < rsmp->frames_needed) {
+                size_t size = frames > rsmp->frames_needed ? frames : rsmp->frames_needed;
+                int16_t *in_buf = (int16_t *)realloc(rsmp->in_buf,
+                                        size * rsmp->channel_count * sizeof(int16_t));
+
+                if (in_buf == NULL) {
+                    rsmp->provider->release_buffer(rsmp->provider, &buf);
+                    *outFrameCount = framesWr;
+                    return -ENOMEM;
+                }
+                rsmp->in_buf = in_buf;
+                rsmp->in_buf_size = size;
+            }
+            memcpy(rsmp->in_buf,
+                    buf.i16 + inFrames * rsmp->channel_count,
+                    frames * rsmp->channel_count * sizeof(int16_t));
+            rsmp->in_buf_pos = 0;
+            rsmp->frames_in = frames;
+        }
+        rsmp->provider->release_buffer(rsmp->provider, &buf);
+
+        if (inFrames == 0 && outFrames == 0) {
+            break;
+        }
     }
+
+    if ((framesWr != framesRq) && (rsmp->frames_in != 0))
+        warn("ReSampler::resample() remaining %zd frames in and %zd out",
+            rsmp->frames_in, (framesRq - framesWr));
+
     *outFrameCount = framesWr;
 
     return 0;
@@ -171,20 +225,7 @@ static int resampler_resample_from_input(struct resampler_itfe *resampler,
         return -ENOSYS;
     }
 
-    if (rsmp->channel_count == 1) {
-        speex_resampler_process_int(rsmp->speex_resampler,
-                                    0,
-                                    in,
-                                    (void *) inFrameCount,
-                                    out,
-                                    (void *) outFrameCount);
-    } else {
-        speex_resampler_process_interleaved_int(rsmp->speex_resampler,
-                                                in,
-                                                (void *) inFrameCount,
-                                                out,
-                                                (void *) outFrameCount);
-    }
+    resampler_process(rsmp, in, inFrameCount, out, outFrameCount);
 
     DBG("resampler_resample_from_input() DONE in %zd out %zd", *inFrameCount, *outFrameCount);
 
@@ -239,6 +280,7 @@ int create_resampler(uint32_t inSampleRate,
     rsmp->channel_count = channelCount;
     rsmp->in_buf = NULL;
     rsmp->in_buf_size = 0;
+    rsmp->in_buf_pos = 0;
 
     resampler_reset(&rsmp->itfe);
 
@@ -0,0 +1,606 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio-msg.h"
+#include "hal-audio.h"
+#include "hal-pcm.h"
+#include "../profiles/audio/a2dp-codecs.h"
+
+#define DEFAULT_MTU		895
+#define DEFAULT_DURATION	10
+
+/* Same as AudioFlinger writes to A2DP output at once */
+#define KERNEL_FRAMES		2560
+
+static const struct {
+	const char *name;
+	audio_codec_get_t get_codec;
+} codecs[] = {
+	{ "sbc", codec_sbc },
+	{ "aptx", codec_aptx },
+};
+
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+static const char *codec_name;
+static uint16_t mtu = DEFAULT_MTU;
+static unsigned int duration = DEFAULT_DURATION;
+static unsigned int qos_steps;
+static const char *input_file;
+static const char *output_prefix;
+static bool kernels;
+
+/* Stereo PCM read from input file, looped as needed */
+static int16_t *input_pcm;
+static size_t input_frames;
+
+struct bench_stats {
+	unsigned long packets;
+	uint64_t frames;
+	uint64_t codec_frames;
+	uint64_t bytes;
+	uint64_t encode_time;
+	uint64_t encode_time_min;
+	uint64_t encode_time_max;
+};
+
+static uint64_t timespec_diff_ns(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000000ull +
+							a->tv_nsec - b->tv_nsec;
+}
+
+static bool load_input(const char *path)
+{
+	FILE *f;
+	long size;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+							strerror(errno));
+		return false;
+	}
+
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 4) {
+		fprintf(stderr, "Invalid input file %s\n", path);
+		fclose(f);
+		return false;
+	}
+
+	rewind(f);
+
+	input_frames = size / 4;
+	input_pcm = malloc(input_frames * 4);
+	if (!input_pcm || fread(input_pcm, 4, input_frames, f) !=
+								input_frames) {
+		fprintf(stderr, "Failed to read %s\n", path);
+		free(input_pcm);
+		input_pcm = NULL;
+		fclose(f);
+		return false;
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+/*
+ * Canned input is a sine sweep from 100Hz to 10kHz on the left channel and
+ * a chord on the right one, both with some noise added. This keeps all
+ * subbands busy so encode time is close to what real music costs.
+ */
+static void generate_pcm(int16_t *pcm, size_t frames, unsigned int rate,
+							unsigned int channels)
+{
+	double phase = 0, t;
+	uint32_t seed = 1;
+	size_t i;
+
+	for (i = 0; i < frames; i++) {
+		double l, r;
+		int noise;
+
+		t = (double) i / rate;
+
+		phase += 2 * M_PI * 100 * pow(100, (double) i / frames) / rate;
+		l = 0.5 * sin(phase);
+
+		r = 0.25 * sin(2 * M_PI * 440 * t) +
+					0.25 * sin(2 * M_PI * 554.37 * t) +
+					0.25 * sin(2 * M_PI * 659.25 * t);
+
+		seed = seed * 1103515245 + 12345;
+		noise = (int) (seed >> 16 & 0x3ff) - 0x200;
+
+		l = l * 32767 + noise;
+		r = r * 32767 + noise;
+
+		if (channels == 1) {
+			pcm[i] = (l + r) / 2;
+		} else {
+			pcm[i * 2] = l;
+			pcm[i * 2 + 1] = r;
+		}
+	}
+}
+
+static void fill_input(int16_t *pcm, size_t frames, unsigned int channels)
+{
+	size_t i;
+
+	for (i = 0; i < frames; i++) {
+		const int16_t *in = &input_pcm[(i % input_frames) * 2];
+
+		/* Same downmix as done by the HAL for mono streams */
+		if (channels == 1) {
+			pcm[i] = (in[0] + in[1]) / 2;
+		} else {
+			pcm[i * 2] = in[0];
+			pcm[i * 2 + 1] = in[1];
+		}
+	}
+}
+
+static FILE *open_output(const char *name, int index)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	if (!output_prefix)
+		return NULL;
+
+	snprintf(path, sizeof(path), "%s-%s-%d.%s", output_prefix, name,
+								index, name);
+
+	f = fopen(path, "wb");
+	if (!f)
+		fprintf(stderr, "Failed to create %s: %s\n", path,
+							strerror(errno));
+
+	return f;
+}
+
+/*
+ * Writes the codec payload only, i.e. without RTP and SBC payload headers,
+ * so resulting file is a plain stream that can be fed to a decoder.
+ */
+static void write_output(FILE *f, const struct audio_codec *codec,
+				const uint8_t *data, size_t len,
+				struct bench_stats *stats)
+{
+	if (codec->type == A2DP_CODEC_SBC && len > 0) {
+		/* Number of frames is in 4 LSBs of the payload header */
+		stats->codec_frames += data[0] & 0x0f;
+		data++;
+		len--;
+	}
+
+	if (f && fwrite(data, len, 1, f) != 1)
+		fprintf(stderr, "Failed to write output\n");
+}
+
+static void print_stats(struct bench_stats *stats,
+				const struct audio_codec *codec,
+				struct audio_input_config *cfg,
+				uint64_t cpu_time)
+{
+	double seconds = (double) stats->frames / cfg->rate;
+
+	printf("  packets: %lu, pcm frames/packet: %.1f", stats->packets,
+				(double) stats->frames / stats->packets);
+
+	if (codec->type == A2DP_CODEC_SBC)
+		printf(", sbc frames/packet: %.1f",
+			(double) stats->codec_frames / stats->packets);
+
+	printf("\n");
+
+	printf("  encode/packet: avg %ju ns, min %ju ns, max %ju ns\n",
+			(uintmax_t) (stats->encode_time / stats->packets),
+			(uintmax_t) stats->encode_time_min,
+			(uintmax_t) stats->encode_time_max);
+
+	printf("  cpu/second of audio: %.3f ms (%.2f%%)\n",
+					cpu_time / seconds / 1000000,
+					cpu_time / seconds / 10000000);
+
+	printf("  bitrate: %.1f kbps\n", stats->bytes * 8 / seconds / 1000);
+}
+
+static void bench_preset(const struct audio_codec *codec, const char *name,
+				int index, struct audio_preset *preset)
+{
+	struct audio_input_config cfg;
+	struct bench_stats stats;
+	struct timespec cpu_start, cpu_end;
+	struct media_packet *mp = NULL;
+	void *codec_data;
+	uint16_t payload_len;
+	unsigned int channels, i;
+	size_t frames, frame_size, len, consumed = 0;
+	int16_t *pcm = NULL;
+	FILE *f = NULL;
+
+	payload_len = mtu;
+	if (codec->use_rtp)
+		payload_len -= sizeof(struct rtp_header);
+
+	if (!codec->init(preset, payload_len, &codec_data)) {
+		fprintf(stderr, "%s preset %d: init failed\n", name, index);
+		return;
+	}
+
+	if (!codec->get_config(codec_data, &cfg)) {
+		fprintf(stderr, "%s preset %d: invalid config\n", name, index);
+		goto done;
+	}
+
+	for (i = 0; i < qos_steps; i++)
+		codec->update_qos(codec_data, QOS_POLICY_DECREASE);
+
+	channels = popcount(cfg.channels);
+	frame_size = channels * sizeof(int16_t);
+	frames = (size_t) duration * cfg.rate;
+	len = frames * frame_size;
+
+	pcm = malloc(len);
+	mp = calloc(mtu, 1);
+	if (!pcm || !mp) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		goto done;
+	}
+
+	if (input_pcm)
+		fill_input(pcm, frames, channels);
+	else
+		generate_pcm(pcm, frames, cfg.rate, channels);
+
+	f = open_output(name, index);
+
+	printf("%s preset %d: %u Hz, %u channel(s), mtu %u\n", name, index,
+						cfg.rate, channels, mtu);
+
+	memset(&stats, 0, sizeof(stats));
+	stats.encode_time_min = UINT64_MAX;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+	while (consumed < len) {
+		struct timespec start, end;
+		size_t written = 0;
+		uint64_t encode_time;
+		ssize_t read;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		read = codec->encode_mediapacket(codec_data,
+					(const uint8_t *) pcm + consumed,
+					len - consumed, mp, payload_len,
+					&written);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		/* Remaining input is less than codec needs for a packet */
+		if (read <= 0)
+			break;
+
+		encode_time = timespec_diff_ns(&end, &start);
+		stats.encode_time += encode_time;
+		if (encode_time < stats.encode_time_min)
+			stats.encode_time_min = encode_time;
+		if (encode_time > stats.encode_time_max)
+			stats.encode_time_max = encode_time;
+
+		stats.packets++;
+		stats.frames += read / frame_size;
+		stats.bytes += written;
+
+		if (codec->use_rtp)
+			write_output(f, codec,
+				((struct media_packet_rtp *) mp)->data,
+				written, &stats);
+		else
+			write_output(f, codec, mp->data, written, &stats);
+
+		consumed += read;
+	}
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+	if (!stats.packets) {
+		fprintf(stderr, "%s preset %d: no packets encoded\n", name,
+									index);
+		goto done;
+	}
+
+	print_stats(&stats, codec, &cfg, timespec_diff_ns(&cpu_end,
+								&cpu_start));
+
+done:
+	if (f)
+		fclose(f);
+
+	free(mp);
+	free(pcm);
+	codec->cleanup(codec_data);
+}
+
+static void bench_codec(const char *name, const struct audio_codec *codec)
+{
+	uint8_t buf[BLUEZ_AUDIO_MTU];
+	struct audio_preset *preset;
+	size_t len = sizeof(buf);
+	uint8_t *ptr = buf;
+	int count, i;
+
+	if (codec->load && !codec->load()) {
+		fprintf(stderr, "%s: codec not available\n", name);
+		return;
+	}
+
+	count = codec->get_presets((struct audio_preset *) buf, &len);
+
+	/*
+	 * First preset describes the codec capabilities, configurations
+	 * which actually get used for streaming follow it.
+	 */
+	for (i = 0; i < count; i++) {
+		preset = (struct audio_preset *) ptr;
+		ptr += sizeof(*preset) + preset->len;
+
+		if (i == 0 && count > 1)
+			continue;
+
+		bench_preset(codec, name, i, preset);
+	}
+
+	if (codec->unload)
+		codec->unload();
+}
+
+static void kernel_downmix(int16_t *out, int16_t *in, int32_t *in32,
+						size_t frames, bool simd)
+{
+	if (simd)
+		pcm_downmix_to_mono(out, in, frames);
+	else
+		pcm_downmix_to_mono_scalar(out, in, frames);
+}
+
+static void kernel_upmix(int16_t *out, int16_t *in, int32_t *in32,
+						size_t frames, bool simd)
+{
+	if (simd)
+		pcm_upmix_to_stereo(out, in, frames);
+	else
+		pcm_upmix_to_stereo_scalar(out, in, frames);
+}
+
+static void kernel_gain(int16_t *out, int16_t *in, int32_t *in32,
+						size_t frames, bool simd)
+{
+	/* Unity gain so repeated runs in place do not change input */
+	if (simd)
+		pcm_apply_gain(in, frames * 2, PCM_GAIN_UNITY);
+	else
+		pcm_apply_gain_scalar(in, frames * 2, PCM_GAIN_UNITY);
+}
+
+static void kernel_saturate(int16_t *out, int16_t *in, int32_t *in32,
+						size_t frames, bool simd)
+{
+	if (simd)
+		pcm_saturate(out, in32, frames * 2);
+	else
+		pcm_saturate_scalar(out, in32, frames * 2);
+}
+
+static const struct {
+	const char *name;
+	void (*run)(int16_t *out, int16_t *in, int32_t *in32, size_t frames,
+								bool simd);
+} pcm_kernels[] = {
+	{ "downmix", kernel_downmix },
+	{ "upmix", kernel_upmix },
+	{ "gain", kernel_gain },
+	{ "saturate", kernel_saturate },
+};
+
+#define NUM_KERNELS (sizeof(pcm_kernels) / sizeof(pcm_kernels[0]))
+
+static uint64_t bench_kernel(unsigned int k, int16_t *out, int16_t *in,
+						int32_t *in32, bool simd)
+{
+	uint64_t frames = (uint64_t) duration * 44100;
+	struct timespec start, end;
+	uint64_t done;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (done = 0; done < frames; done += KERNEL_FRAMES)
+		pcm_kernels[k].run(out, in, in32, KERNEL_FRAMES, simd);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return timespec_diff_ns(&end, &start);
+}
+
+/*
+ * Processes given duration of 44.1kHz stereo audio in chunks AudioFlinger
+ * would write, once with the scalar reference and once with SIMD kernels.
+ */
+static void bench_kernels(void)
+{
+	int16_t *in, *out;
+	int32_t *in32;
+	unsigned int i;
+
+	in = malloc(KERNEL_FRAMES * 2 * sizeof(*in));
+	out = malloc(KERNEL_FRAMES * 2 * sizeof(*out));
+	in32 = malloc(KERNEL_FRAMES * 2 * sizeof(*in32));
+	if (!in || !out || !in32) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		goto done;
+	}
+
+	if (input_pcm)
+		fill_input(in, KERNEL_FRAMES, 2);
+	else
+		generate_pcm(in, KERNEL_FRAMES, 44100, 2);
+
+	for (i = 0; i < KERNEL_FRAMES * 2; i++)
+		in32[i] = in[i] * 3;
+
+	printf("PCM kernels (%s), %u s of 44100 Hz stereo:\n", pcm_simd(),
+								duration);
+
+	for (i = 0; i < NUM_KERNELS; i++) {
+		uint64_t scalar, simd;
+
+		scalar = bench_kernel(i, out, in, in32, false);
+		simd = bench_kernel(i, out, in, in32, true);
+
+		printf("  %-10s scalar %8.3f ms simd %8.3f ms (%.2fx)\n",
+				pcm_kernels[i].name, scalar / 1000000.0,
+				simd / 1000000.0,
+				simd ? (double) scalar / simd : 0);
+	}
+
+done:
+	free(in32);
+	free(out);
+	free(in);
+}
+
+static void usage(void)
+{
+	printf("codecbench - A2DP codec benchmark\n");
+	printf("Usage:\n"
+		"\tcodecbench [options]\n");
+	printf("options:\n"
+		"\t-c <codec>         Benchmark only given codec (sbc, aptx)\n"
+		"\t-m <mtu>           Media transport MTU (default %u)\n"
+		"\t-d <seconds>       Seconds of audio to encode (default %u)\n"
+		"\t-q <steps>         Number of QoS decrease steps\n"
+		"\t-i <file>          Raw 16bit stereo PCM input\n"
+		"\t-o <prefix>        Write encoded streams to files\n"
+		"\t-k                 Benchmark PCM kernels, not codecs\n",
+		DEFAULT_MTU, DEFAULT_DURATION);
+}
+
+static struct option main_options[] = {
+	{ "help",		0, 0, 'h' },
+	{ "codec",		1, 0, 'c' },
+	{ "mtu",		1, 0, 'm' },
+	{ "duration",		1, 0, 'd' },
+	{ "qos",		1, 0, 'q' },
+	{ "input",		1, 0, 'i' },
+	{ "output",		1, 0, 'o' },
+	{ "kernels",		0, 0, 'k' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	bool found = false;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "hc:m:d:q:i:o:k",
+						main_options, NULL)) != EOF) {
+		switch (opt) {
+		case 'c':
+			codec_name = optarg;
+			break;
+		case 'm':
+			mtu = atoi(optarg);
+			if (mtu <= sizeof(struct rtp_header) + 1) {
+				printf("invalid mtu\n");
+				exit(1);
+			}
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			if (!duration) {
+				printf("invalid duration\n");
+				exit(1);
+			}
+			break;
+		case 'q':
+			qos_steps = atoi(optarg);
+			break;
+		case 'i':
+			input_file = optarg;
+			break;
+		case 'o':
+			output_prefix = optarg;
+			break;
+		case 'k':
+			kernels = true;
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (input_file && !load_input(input_file))
+		exit(1);
+
+	if (kernels) {
+		bench_kernels();
+		free(input_pcm);
+		return 0;
+	}
+
+	for (i = 0; i < NUM_CODECS; i++) {
+		if (codec_name && strcmp(codec_name, codecs[i].name))
+			continue;
+
+		bench_codec(codecs[i].name, codecs[i].get_codec());
+		found = true;
+	}
+
+	if (!found)
+		printf("unknown codec %s\n", codec_name);
+
+	free(input_pcm);
+
+	return 0;
+}
@@ -33,6 +33,7 @@
 
 #define BLUETOOTH_MODE_PROPERTY_NAME "persist.sys.bluetooth.mode"
 #define BLUETOOTH_MODE_PROPERTY_HANDSFREE "persist.sys.bluetooth.handsfree"
+#define BLUETOOTH_MODE_PROPERTY_AUDIO "persist.sys.bluetooth.audio"
 
 static inline int property_get(const char *key, char *value,
 						const char *default_value)
@@ -45,6 +46,9 @@ static inline int property_get(const char *key, char *value,
 	if (!strcmp(key, BLUETOOTH_MODE_PROPERTY_HANDSFREE))
 		prop = getenv("BLUETOOTH_HANDSFREE_MODE");
 
+	if (!strcmp(key, BLUETOOTH_MODE_PROPERTY_AUDIO))
+		prop = getenv("BLUETOOTH_AUDIO_MODE");
+
 	if (!prop)
 		prop = default_value;
 
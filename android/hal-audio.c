@@ -18,15 +18,18 @@
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 
+#include <cutils/properties.h>
 #include <hardware/audio.h>
 #include <hardware/hardware.h>
 
@@ -35,6 +38,7 @@
 #include "hal-log.h"
 #include "hal-msg.h"
 #include "hal-audio.h"
+#include "hal-pcm.h"
 #include "hal-utils.h"
 #include "hal.h"
 
@@ -44,6 +48,30 @@
 
 #define MAX_DELAY	100000 /* 100ms */
 
+#define PCM_RING_SIZE	16384 /* needs to be power of 2 */
+
+/* Input for codecs which do not report how much they need per packet */
+#define ENCODER_CHUNK_SIZE	(FIXED_BUFFER_SIZE / 4)
+
+/* Same as AudioFlinger uses for its fast mixer */
+#define ENCODER_PRIORITY	2
+
+/* Only defined by host build properties stub */
+#ifndef BLUETOOTH_MODE_PROPERTY_AUDIO
+#define BLUETOOTH_MODE_PROPERTY_AUDIO "persist.sys.bluetooth.audio"
+#endif
+
+/*
+ * Link congestion is detected when the socket send queue fills up above the
+ * high watermark (in percent) or waiting for the socket to become writable
+ * takes longer than the media packet duration. Bitrate is decreased right
+ * away and increased again step by step once the link stays clear.
+ */
+#define QOS_QUEUE_HIGH		50
+#define QOS_QUEUE_LOW		10
+#define QOS_DECREASE_INTERVAL	500000 /* 500ms */
+#define QOS_INCREASE_INTERVAL	5000000 /* 5s */
+
 static const uint8_t a2dp_src_uuid[] = {
 		0x00, 0x00, 0x11, 0x0a, 0x00, 0x00, 0x10, 0x00,
 		0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb };
@@ -123,6 +151,11 @@ struct audio_endpoint {
 	struct timespec start;
 
 	bool resync;
+
+	int sndbuf;
+	bool link_clear;
+	struct timespec qos_change;
+	struct timespec qos_clear;
 };
 
 static struct audio_endpoint audio_endpoints[MAX_AUDIO_ENDPOINTS];
@@ -134,6 +167,18 @@ enum a2dp_state_t {
 	AUDIO_A2DP_STATE_STARTED
 };
 
+/*
+ * Single producer, single consumer ring of PCM data. The writer only ever
+ * updates head and the reader only ever updates tail so no locking is
+ * needed to move the data itself.
+ */
+struct pcm_ring {
+	uint8_t *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+};
+
 struct a2dp_stream_out {
 	struct audio_stream_out stream;
 
@@ -141,7 +186,35 @@ struct a2dp_stream_out {
 	enum a2dp_state_t audio_state;
 	struct audio_input_config cfg;
 
-	uint8_t *downmix_buf;
+	/* Scratch buffer for downmix and software volume */
+	uint8_t *pcm_buf;
+	int16_t gain;
+
+	/*
+	 * In encoder thread mode out_write only queues data to the ring and
+	 * encoding, pacing and writing to the socket is done on a dedicated
+	 * real-time thread. Mutex and condition are only used to sleep when
+	 * there is no data or no space in the ring.
+	 */
+	bool enc_thread;
+	pthread_t enc_th;
+	pthread_mutex_t enc_mutex;
+	pthread_cond_t enc_cond;
+	struct pcm_ring ring;
+	uint8_t *enc_buf;
+	bool enc_stop;
+	bool enc_busy;
+	bool enc_drop;
+	bool enc_failed;
+	bool enc_starved;
+
+	unsigned long underruns;
+	unsigned long packets;
+	uint64_t encode_time;
+	uint64_t encode_time_max;
+
+	unsigned long qos_decreased;
+	unsigned long qos_increased;
 };
 
 struct a2dp_audio_dev {
@@ -493,6 +566,7 @@ static bool open_endpoint(struct audio_endpoint **epp,
 	int fd;
 	size_t i;
 	uint8_t ep_id = 0;
+	socklen_t optlen = sizeof(ep->sndbuf);
 
 	if (ep)
 		ep_id = ep->id;
@@ -522,6 +596,11 @@ static bool open_endpoint(struct audio_endpoint **epp,
 
 	ep->fd = fd;
 
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &ep->sndbuf, &optlen) < 0) {
+		warn("audio: cannot get send buffer size (%d)", errno);
+		ep->sndbuf = 0;
+	}
+
 	codec = ep->codec;
 	codec->init(preset, payload_len, &ep->codec_data);
 	codec->get_config(ep->codec_data, cfg);
@@ -573,29 +652,14 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 	ep->samples = 0;
 	ep->resync = false;
 
+	ep->link_clear = false;
+	memset(&ep->qos_change, 0, sizeof(ep->qos_change));
+
 	ep->codec->update_qos(ep->codec_data, QOS_POLICY_DEFAULT);
 
 	return true;
 }
 
-static void downmix_to_mono(struct a2dp_stream_out *out, const uint8_t *buffer,
-								size_t bytes)
-{
-	const int16_t *input = (const void *) buffer;
-	int16_t *output = (void *) out->downmix_buf;
-	size_t i, frames;
-
-	/* PCM 16bit stereo */
-	frames = bytes / (2 * sizeof(int16_t));
-
-	for (i = 0; i < frames; i++) {
-		int16_t l = get_le16(&input[i * 2]);
-		int16_t r = get_le16(&input[i * 2 + 1]);
-
-		put_le16((l + r) / 2, &output[i]);
-	}
-}
-
 static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
 {
 	int ret;
@@ -655,6 +719,87 @@ static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
 	return true;
 }
 
+/* Returns fill level of socket send queue in percent */
+static int get_queue_level(struct audio_endpoint *ep)
+{
+	int space;
+
+	if (ep->sndbuf <= 0)
+		return -1;
+
+	/*
+	 * For Bluetooth sockets TIOCOUTQ reports free space in send buffer
+	 * rather than number of bytes queued, both including the kernel
+	 * bookkeeping overhead just like SO_SNDBUF does.
+	 */
+	if (ioctl(ep->fd, TIOCOUTQ, &space) < 0)
+		return -1;
+
+	if (space > ep->sndbuf)
+		space = ep->sndbuf;
+
+	return (ep->sndbuf - space) * 100 / ep->sndbuf;
+}
+
+static void update_link_qos(struct a2dp_stream_out *out,
+				struct timespec *now, uint64_t wait_time)
+{
+	struct audio_endpoint *ep = out->ep;
+	uint64_t duration;
+	bool congested, clear;
+	int level;
+
+	level = get_queue_level(ep);
+	if (level < 0)
+		return;
+
+	duration = ep->codec->get_mediapacket_duration(ep->codec_data);
+
+	congested = level > QOS_QUEUE_HIGH ||
+					(duration && wait_time > duration);
+	clear = level < QOS_QUEUE_LOW &&
+					(!duration || wait_time < duration / 4);
+
+	if (congested) {
+		ep->link_clear = false;
+
+		if (timespec_diff_us(now, &ep->qos_change) <
+							QOS_DECREASE_INTERVAL)
+			return;
+
+		DBG("link congested, queue %d%% wait %juus", level,
+							(uintmax_t) wait_time);
+
+		if (ep->codec->update_qos(ep->codec_data, QOS_POLICY_DECREASE))
+			out->qos_decreased++;
+
+		ep->qos_change = *now;
+		return;
+	}
+
+	/* Keep current bitrate while in between watermarks */
+	if (!clear) {
+		ep->link_clear = false;
+		return;
+	}
+
+	if (!ep->link_clear) {
+		ep->link_clear = true;
+		ep->qos_clear = *now;
+		return;
+	}
+
+	if (timespec_diff_us(now, &ep->qos_clear) < QOS_INCREASE_INTERVAL)
+		return;
+
+	if (ep->codec->update_qos(ep->codec_data, QOS_POLICY_INCREASE))
+		out->qos_increased++;
+
+	/* Each further step needs the link to stay clear for another period */
+	ep->qos_clear = *now;
+	ep->qos_change = *now;
+}
+
 static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 								size_t bytes)
 {
@@ -669,8 +814,8 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		ssize_t read;
 		uint32_t samples;
 		int ret;
-		struct timespec current;
-		uint64_t audio_sent, audio_passed;
+		struct timespec current, encode_start, wait_start;
+		uint64_t audio_sent, audio_passed, encode_time, wait_time;
 		bool do_write = false;
 
 		/*
@@ -681,6 +826,8 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 			mp_rtp->hdr.sequence_number = htons(ep->seq++);
 			mp_rtp->hdr.timestamp = htonl(ep->samples);
 		}
+
+		clock_gettime(CLOCK_MONOTONIC, &encode_start);
 		read = ep->codec->encode_mediapacket(ep->codec_data,
 						buffer + consumed,
 						bytes - consumed, mp,
@@ -695,6 +842,13 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 
 		/* calculate where are we and where we should be */
 		clock_gettime(CLOCK_MONOTONIC, &current);
+
+		encode_time = timespec_diff_us(&current, &encode_start);
+		out->encode_time += encode_time;
+		if (encode_time > out->encode_time_max)
+			out->encode_time_max = encode_time;
+		out->packets++;
+
 		if (!ep->samples)
 			memcpy(&ep->start, &current, sizeof(ep->start));
 		audio_sent = ep->samples * 1000000ll / out->cfg.rate;
@@ -732,8 +886,12 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 			if (diff > MAX_DELAY) {
 				warn("lag is %jums, resyncing", diff / 1000);
 
-				ep->codec->update_qos(ep->codec_data,
-							QOS_POLICY_DECREASE);
+				if (ep->codec->update_qos(ep->codec_data,
+							QOS_POLICY_DECREASE))
+					out->qos_decreased++;
+
+				ep->link_clear = false;
+				ep->qos_change = current;
 				ep->resync = true;
 			}
 		}
@@ -747,9 +905,16 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 			/* wait some time for socket to be ready for write,
 			 * but we'll just skip writing data if timeout occurs
 			 */
+			clock_gettime(CLOCK_MONOTONIC, &wait_start);
+
 			if (!wait_for_endpoint(ep, &do_write))
 				return false;
 
+			clock_gettime(CLOCK_MONOTONIC, &current);
+
+			wait_time = timespec_diff_us(&current, &wait_start);
+			update_link_qos(out, &current, wait_time);
+
 			if (do_write) {
 				if (ep->codec->use_rtp)
 					written += sizeof(struct rtp_header);
@@ -772,12 +937,260 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 	return true;
 }
 
+static size_t ring_used(struct pcm_ring *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+			__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Called by producer only, returns number of bytes queued */
+static size_t ring_write(struct pcm_ring *ring, const uint8_t *data,
+								size_t len)
+{
+	size_t head = ring->head;
+	size_t offset = head & (ring->size - 1);
+	size_t space, part;
+
+	space = ring->size - (head - __atomic_load_n(&ring->tail,
+							__ATOMIC_ACQUIRE));
+	if (len > space)
+		len = space;
+
+	part = ring->size - offset;
+	if (part > len)
+		part = len;
+
+	memcpy(ring->buf + offset, data, part);
+	memcpy(ring->buf, data + part, len - part);
+
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+	return len;
+}
+
+/*
+ * Called by consumer only. Returns data in place unless it wraps around the
+ * end of the ring in which case it is copied to the given buffer.
+ */
+static const uint8_t *ring_peek(struct pcm_ring *ring, size_t len,
+								uint8_t *buf)
+{
+	size_t offset = ring->tail & (ring->size - 1);
+	size_t part = ring->size - offset;
+
+	if (part >= len)
+		return ring->buf + offset;
+
+	memcpy(buf, ring->buf + offset, part);
+	memcpy(buf + part, ring->buf, len - part);
+
+	return buf;
+}
+
+static void ring_consume(struct pcm_ring *ring, size_t len)
+{
+	__atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+}
+
+static size_t encoder_chunk_size(struct a2dp_stream_out *out)
+{
+	struct audio_endpoint *ep = out->ep;
+	size_t len;
+
+	/* Encode whole media packets so no data is left over */
+	len = ep->codec->get_buffer_size(ep->codec_data);
+	if (!len || len > FIXED_BUFFER_SIZE)
+		len = ENCODER_CHUNK_SIZE;
+
+	return len;
+}
+
+static void *encoder_thread(void *data)
+{
+	struct a2dp_stream_out *out = data;
+	struct sched_param param;
+	int err;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = ENCODER_PRIORITY;
+
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err)
+		warn("audio: cannot set encoder thread priority (%d)", err);
+
+	pthread_mutex_lock(&out->enc_mutex);
+
+	while (!out->enc_stop) {
+		const uint8_t *buf;
+		size_t len;
+		bool ret;
+
+		/* Producer asked to discard what is left, see encoder_drain */
+		if (out->enc_drop) {
+			ring_consume(&out->ring, ring_used(&out->ring));
+			out->enc_drop = false;
+			pthread_cond_broadcast(&out->enc_cond);
+			continue;
+		}
+
+		len = encoder_chunk_size(out);
+
+		if (ring_used(&out->ring) < len) {
+			out->enc_starved = true;
+			pthread_cond_wait(&out->enc_cond, &out->enc_mutex);
+			continue;
+		}
+
+		/*
+		 * Ran out of data in the middle of a stream, this does not
+		 * count while resyncing as packets are dropped then.
+		 */
+		if (out->enc_starved) {
+			out->enc_starved = false;
+			if (!out->ep->resync)
+				out->underruns++;
+		}
+
+		out->enc_busy = true;
+		pthread_mutex_unlock(&out->enc_mutex);
+
+		buf = ring_peek(&out->ring, len, out->enc_buf);
+		ret = write_data(out, buf, len);
+		ring_consume(&out->ring, len);
+
+		pthread_mutex_lock(&out->enc_mutex);
+		out->enc_busy = false;
+		if (!ret)
+			out->enc_failed = true;
+		pthread_cond_broadcast(&out->enc_cond);
+	}
+
+	pthread_mutex_unlock(&out->enc_mutex);
+
+	return NULL;
+}
+
+static bool encoder_start(struct a2dp_stream_out *out)
+{
+	int err;
+
+	out->ring.buf = malloc(PCM_RING_SIZE);
+	out->enc_buf = malloc(FIXED_BUFFER_SIZE);
+	if (!out->ring.buf || !out->enc_buf)
+		goto failed;
+
+	out->ring.size = PCM_RING_SIZE;
+	out->ring.head = 0;
+	out->ring.tail = 0;
+
+	pthread_mutex_init(&out->enc_mutex, NULL);
+	pthread_cond_init(&out->enc_cond, NULL);
+
+	/* Starts waiting for data, there was no stream yet to run out of */
+	out->enc_starved = false;
+
+	err = pthread_create(&out->enc_th, NULL, encoder_thread, out);
+	if (err) {
+		error("audio: Failed to start encoder thread: %d (%s)", err,
+								strerror(err));
+		pthread_cond_destroy(&out->enc_cond);
+		pthread_mutex_destroy(&out->enc_mutex);
+		goto failed;
+	}
+
+	return true;
+
+failed:
+	free(out->ring.buf);
+	out->ring.buf = NULL;
+	free(out->enc_buf);
+	out->enc_buf = NULL;
+
+	return false;
+}
+
+static void encoder_stop(struct a2dp_stream_out *out)
+{
+	pthread_mutex_lock(&out->enc_mutex);
+	out->enc_stop = true;
+	pthread_cond_broadcast(&out->enc_cond);
+	pthread_mutex_unlock(&out->enc_mutex);
+
+	pthread_join(out->enc_th, NULL);
+
+	pthread_cond_destroy(&out->enc_cond);
+	pthread_mutex_destroy(&out->enc_mutex);
+
+	free(out->ring.buf);
+	out->ring.buf = NULL;
+	free(out->enc_buf);
+	out->enc_buf = NULL;
+}
+
+/*
+ * Waits until all complete packets queued were sent and drops what is left,
+ * endpoint can be suspended afterwards.
+ */
+static void encoder_drain(struct a2dp_stream_out *out)
+{
+	pthread_mutex_lock(&out->enc_mutex);
+
+	while (out->enc_busy || (!out->enc_failed &&
+			ring_used(&out->ring) >= encoder_chunk_size(out)))
+		pthread_cond_wait(&out->enc_cond, &out->enc_mutex);
+
+	/* Only encoder thread moves the tail so let it drop the rest */
+	out->enc_drop = true;
+	pthread_cond_broadcast(&out->enc_cond);
+
+	while (out->enc_drop)
+		pthread_cond_wait(&out->enc_cond, &out->enc_mutex);
+
+	out->enc_starved = false;
+
+	pthread_mutex_unlock(&out->enc_mutex);
+}
+
+static bool queue_data(struct a2dp_stream_out *out, const void *buffer,
+								size_t bytes)
+{
+	size_t queued = 0;
+	bool ret = true;
+
+	while (queued < bytes) {
+		queued += ring_write(&out->ring, buffer + queued,
+							bytes - queued);
+
+		pthread_mutex_lock(&out->enc_mutex);
+
+		/* Wake up encoder and wait for it if ring is full */
+		pthread_cond_broadcast(&out->enc_cond);
+
+		while (!out->enc_failed && queued < bytes &&
+				ring_used(&out->ring) == out->ring.size)
+			pthread_cond_wait(&out->enc_cond, &out->enc_mutex);
+
+		if (out->enc_failed) {
+			out->enc_failed = false;
+			ret = false;
+		}
+
+		pthread_mutex_unlock(&out->enc_mutex);
+
+		if (!ret)
+			break;
+	}
+
+	return ret;
+}
+
 static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 								size_t bytes)
 {
 	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
 	const void *in_buf = buffer;
 	size_t in_len = bytes;
+	int16_t gain = out->gain;
 
 	/* just return in case we're closing */
 	if (out->audio_state == AUDIO_A2DP_STATE_NONE)
@@ -803,6 +1216,13 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 		return -1;
 	}
 
+	/* PCM processing is done in scratch buffer */
+	if ((out->cfg.channels == AUDIO_CHANNEL_OUT_MONO ||
+			gain != PCM_GAIN_UNITY) && bytes > FIXED_BUFFER_SIZE) {
+		error("audio: too much data to process (%zu bytes)", bytes);
+		return -1;
+	}
+
 	/*
 	 * currently Android audioflinger is not able to provide mono stream on
 	 * A2DP output so down mixing needs to be done in hal-audio plugin.
@@ -812,17 +1232,31 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 	 * frameworks/av/services/audioflinger/Threads.cpp:1631
 	 */
 	if (out->cfg.channels == AUDIO_CHANNEL_OUT_MONO) {
-		if (!out->downmix_buf) {
-			error("audio: downmix buffer not initialized");
-			return -1;
-		}
+		/* PCM 16bit stereo */
+		pcm_downmix_to_mono((int16_t *) out->pcm_buf, buffer,
+					bytes / (2 * sizeof(int16_t)));
 
-		downmix_to_mono(out, buffer, bytes);
-
-		in_buf = out->downmix_buf;
+		in_buf = out->pcm_buf;
 		in_len = bytes / 2;
 	}
 
+	if (gain != PCM_GAIN_UNITY) {
+		if (in_buf != out->pcm_buf)
+			memcpy(out->pcm_buf, in_buf, in_len);
+
+		pcm_apply_gain((int16_t *) out->pcm_buf,
+					in_len / sizeof(int16_t), gain);
+
+		in_buf = out->pcm_buf;
+	}
+
+	if (out->enc_thread) {
+		if (!queue_data(out, in_buf, in_len))
+			return -1;
+
+		return bytes;
+	}
+
 	if (!write_data(out, in_buf, in_len))
 		return -1;
 
@@ -900,6 +1334,9 @@ static int out_standby(struct audio_stream *stream)
 	DBG("");
 
 	if (out->audio_state == AUDIO_A2DP_STATE_STARTED) {
+		if (out->enc_thread)
+			encoder_drain(out);
+
 		if (ipc_suspend_stream_cmd(out->ep->id) != AUDIO_STATUS_SUCCESS)
 			return -1;
 		out->audio_state = AUDIO_A2DP_STATE_STANDBY;
@@ -910,8 +1347,32 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
+	unsigned long packets = out->packets;
+
 	DBG("");
-	return -ENOSYS;
+
+	dprintf(fd, "A2DP output:\n");
+	dprintf(fd, "  encoder: %s\n", out->enc_thread ? "thread" : "caller");
+
+	if (out->enc_thread) {
+		size_t used = ring_used(&out->ring);
+
+		dprintf(fd, "  ring fill: %zu/%zu bytes (%zu%%)\n", used,
+					out->ring.size, used * 100 / out->ring.size);
+		dprintf(fd, "  underruns: %lu\n", out->underruns);
+	}
+
+	dprintf(fd, "  packets: %lu\n", packets);
+	dprintf(fd, "  bitrate changes: %lu down, %lu up\n",
+					out->qos_decreased, out->qos_increased);
+
+	if (packets)
+		dprintf(fd, "  encode time: avg %juus max %juus\n",
+				(uintmax_t) (out->encode_time / packets),
+				(uintmax_t) out->encode_time_max);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -955,6 +1416,9 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 	free(str);
 
 	if (enter_suspend && out->audio_state == AUDIO_A2DP_STATE_STARTED) {
+		if (out->enc_thread)
+			encoder_drain(out);
+
 		if (ipc_suspend_stream_cmd(out->ep->id) != AUDIO_STATUS_SUCCESS)
 			return -1;
 		out->audio_state = AUDIO_A2DP_STATE_SUSPENDED;
@@ -978,20 +1442,43 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
 	struct audio_endpoint *ep = out->ep;
 	size_t pkt_duration;
+	uint32_t latency;
+	int channels;
 
 	DBG("");
 
 	pkt_duration = ep->codec->get_mediapacket_duration(ep->codec_data);
 
-	return FIXED_A2DP_PLAYBACK_LATENCY_MS + pkt_duration / 1000;
+	latency = FIXED_A2DP_PLAYBACK_LATENCY_MS + pkt_duration / 1000;
+
+	/*
+	 * Data queued for encoder thread adds up to whole ring. It is queued
+	 * after downmix so mono endpoints hold single channel in the ring.
+	 */
+	if (out->enc_thread) {
+		channels = out->cfg.channels == AUDIO_CHANNEL_OUT_MONO ? 1 : 2;
+
+		latency += out->ring.size * 1000 /
+				(out->cfg.rate * sizeof(int16_t) * channels);
+	}
+
+	return latency;
 }
 
 static int out_set_volume(struct audio_stream_out *stream, float left,
 								float right)
 {
-	DBG("");
-	/* volume controlled in audioflinger mixer (digital) */
-	return -ENOSYS;
+	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
+
+	DBG("left=%f right=%f", left, right);
+
+	/*
+	 * Normally volume is controlled in audioflinger mixer, this is only
+	 * used for direct outputs. Both channels are encoded with same gain.
+	 */
+	out->gain = pcm_gain_from_float((left + right) / 2);
+
+	return 0;
 }
 
 static int out_get_render_position(const struct audio_stream_out *stream,
@@ -1109,6 +1596,17 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
 	return -ENOSYS;
 }
 
+static bool use_encoder_thread(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+
+	if (property_get(BLUETOOTH_MODE_PROPERTY_AUDIO, value, "") <= 0 &&
+			property_get("ro.bluetooth.audio", value, "") <= 0)
+		return false;
+
+	return !strcmp(value, "thread");
+}
+
 static int audio_open_output_stream_real(struct audio_hw_device *dev,
 					audio_io_handle_t handle,
 					audio_devices_t devices,
@@ -1152,12 +1650,20 @@ static int audio_open_output_stream_real(struct audio_hw_device *dev,
 	DBG("rate=%d channels=%d format=%d", out->cfg.rate,
 					out->cfg.channels, out->cfg.format);
 
-	if (out->cfg.channels == AUDIO_CHANNEL_OUT_MONO) {
-		out->downmix_buf = malloc(FIXED_BUFFER_SIZE / 2);
-		if (!out->downmix_buf)
-			goto fail;
+	out->pcm_buf = malloc(FIXED_BUFFER_SIZE);
+	if (!out->pcm_buf)
+		goto fail;
+
+	out->gain = PCM_GAIN_UNITY;
+
+	if (use_encoder_thread()) {
+		out->enc_thread = encoder_start(out);
+		if (!out->enc_thread)
+			warn("audio: encoding on caller thread");
 	}
 
+	DBG("enc_thread=%u", out->enc_thread);
+
 	*stream_out = &out->stream;
 	a2dp_dev->out = out;
 
@@ -1205,9 +1711,12 @@ static void audio_close_output_stream(struct audio_hw_device *dev,
 
 	DBG("");
 
+	if (out->enc_thread)
+		encoder_stop(out);
+
 	close_endpoint(a2dp_dev->out->ep);
 
-	free(out->downmix_buf);
+	free(out->pcm_buf);
 
 	free(stream);
 	a2dp_dev->out = NULL;
@@ -0,0 +1,277 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_SIMD "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_SIMD "neon"
+#else
+#define PCM_SIMD "none"
+#endif
+
+#include "hal-pcm.h"
+
+const char *pcm_simd(void)
+{
+	return PCM_SIMD;
+}
+
+int16_t pcm_gain_from_float(float gain)
+{
+	if (gain <= 0)
+		return 0;
+
+	if (gain >= (float) PCM_GAIN_MAX / PCM_GAIN_UNITY)
+		return PCM_GAIN_MAX;
+
+	return gain * PCM_GAIN_UNITY + 0.5f;
+}
+
+static inline int16_t saturate(int32_t sample)
+{
+	if (sample > INT16_MAX)
+		return INT16_MAX;
+
+	if (sample < INT16_MIN)
+		return INT16_MIN;
+
+	return sample;
+}
+
+void pcm_downmix_to_mono_scalar(int16_t *out, const int16_t *in,
+								size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i < frames; i++)
+		out[i] = (in[i * 2] + in[i * 2 + 1]) / 2;
+}
+
+void pcm_upmix_to_stereo_scalar(int16_t *out, const int16_t *in,
+								size_t frames)
+{
+	size_t i;
+
+	/* Backwards so conversion can be done in place */
+	for (i = frames; i > 0; i--) {
+		int16_t sample = in[i - 1];
+
+		out[i * 2 - 2] = sample;
+		out[i * 2 - 1] = sample;
+	}
+}
+
+void pcm_apply_gain_scalar(int16_t *buf, size_t samples, int16_t gain)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i++) {
+		int32_t sample = buf[i] * gain + (1 << (PCM_GAIN_SHIFT - 1));
+
+		buf[i] = saturate(sample >> PCM_GAIN_SHIFT);
+	}
+}
+
+void pcm_saturate_scalar(int16_t *out, const int32_t *in, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i++)
+		out[i] = saturate(in[i]);
+}
+
+#if defined(__SSE2__)
+
+void pcm_downmix_to_mono(int16_t *out, const int16_t *in, size_t frames)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &in[i * 2]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &in[i * 2 + 8]);
+
+		/* Sum of each left and right pair */
+		a = _mm_madd_epi16(a, ones);
+		b = _mm_madd_epi16(b, ones);
+
+		/* Division rounds towards zero */
+		a = _mm_srai_epi32(_mm_add_epi32(a, _mm_srli_epi32(a, 31)), 1);
+		b = _mm_srai_epi32(_mm_add_epi32(b, _mm_srli_epi32(b, 31)), 1);
+
+		_mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(a, b));
+	}
+
+	pcm_downmix_to_mono_scalar(out + i, in + i * 2, frames - i);
+}
+
+void pcm_upmix_to_stereo(int16_t *out, const int16_t *in, size_t frames)
+{
+	size_t i = frames & ~7;
+
+	pcm_upmix_to_stereo_scalar(out + i * 2, in + i, frames - i);
+
+	while (i > 0) {
+		__m128i v;
+
+		i -= 8;
+
+		v = _mm_loadu_si128((const __m128i *) &in[i]);
+
+		_mm_storeu_si128((__m128i *) &out[i * 2 + 8],
+						_mm_unpackhi_epi16(v, v));
+		_mm_storeu_si128((__m128i *) &out[i * 2],
+						_mm_unpacklo_epi16(v, v));
+	}
+}
+
+void pcm_apply_gain(int16_t *buf, size_t samples, int16_t gain)
+{
+	const __m128i g = _mm_set1_epi16(gain);
+	const __m128i round = _mm_set1_epi32(1 << (PCM_GAIN_SHIFT - 1));
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &buf[i]);
+		__m128i lo = _mm_mullo_epi16(v, g);
+		__m128i hi = _mm_mulhi_epi16(v, g);
+		__m128i a = _mm_unpacklo_epi16(lo, hi);
+		__m128i b = _mm_unpackhi_epi16(lo, hi);
+
+		a = _mm_srai_epi32(_mm_add_epi32(a, round), PCM_GAIN_SHIFT);
+		b = _mm_srai_epi32(_mm_add_epi32(b, round), PCM_GAIN_SHIFT);
+
+		_mm_storeu_si128((__m128i *) &buf[i], _mm_packs_epi32(a, b));
+	}
+
+	pcm_apply_gain_scalar(buf + i, samples - i, gain);
+}
+
+void pcm_saturate(int16_t *out, const int32_t *in, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &in[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &in[i + 4]);
+
+		_mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(a, b));
+	}
+
+	pcm_saturate_scalar(out + i, in + i, samples - i);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+void pcm_downmix_to_mono(int16_t *out, const int16_t *in, size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= frames; i += 8) {
+		int16x8x2_t v = vld2q_s16(&in[i * 2]);
+		int32x4_t a, b;
+
+		a = vaddl_s16(vget_low_s16(v.val[0]), vget_low_s16(v.val[1]));
+		b = vaddl_s16(vget_high_s16(v.val[0]),
+						vget_high_s16(v.val[1]));
+
+		/* Division rounds towards zero */
+		a = vaddq_s32(a, vreinterpretq_s32_u32(vshrq_n_u32(
+					vreinterpretq_u32_s32(a), 31)));
+		b = vaddq_s32(b, vreinterpretq_s32_u32(vshrq_n_u32(
+					vreinterpretq_u32_s32(b), 31)));
+
+		vst1q_s16(&out[i], vcombine_s16(vmovn_s32(vshrq_n_s32(a, 1)),
+						vmovn_s32(vshrq_n_s32(b, 1))));
+	}
+
+	pcm_downmix_to_mono_scalar(out + i, in + i * 2, frames - i);
+}
+
+void pcm_upmix_to_stereo(int16_t *out, const int16_t *in, size_t frames)
+{
+	size_t i = frames & ~7;
+
+	pcm_upmix_to_stereo_scalar(out + i * 2, in + i, frames - i);
+
+	while (i > 0) {
+		int16x8x2_t v;
+
+		i -= 8;
+
+		v.val[0] = vld1q_s16(&in[i]);
+		v.val[1] = v.val[0];
+
+		vst2q_s16(&out[i * 2], v);
+	}
+}
+
+void pcm_apply_gain(int16_t *buf, size_t samples, int16_t gain)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8) {
+		int16x8_t v = vld1q_s16(&buf[i]);
+		int32x4_t a = vmull_n_s16(vget_low_s16(v), gain);
+		int32x4_t b = vmull_n_s16(vget_high_s16(v), gain);
+
+		/* Rounding shift with saturation */
+		vst1q_s16(&buf[i], vcombine_s16(
+					vqrshrn_n_s32(a, PCM_GAIN_SHIFT),
+					vqrshrn_n_s32(b, PCM_GAIN_SHIFT)));
+	}
+
+	pcm_apply_gain_scalar(buf + i, samples - i, gain);
+}
+
+void pcm_saturate(int16_t *out, const int32_t *in, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= samples; i += 8)
+		vst1q_s16(&out[i], vcombine_s16(vqmovn_s32(vld1q_s32(&in[i])),
+					vqmovn_s32(vld1q_s32(&in[i + 4]))));
+
+	pcm_saturate_scalar(out + i, in + i, samples - i);
+}
+
+#else
+
+void pcm_downmix_to_mono(int16_t *out, const int16_t *in, size_t frames)
+{
+	pcm_downmix_to_mono_scalar(out, in, frames);
+}
+
+void pcm_upmix_to_stereo(int16_t *out, const int16_t *in, size_t frames)
+{
+	pcm_upmix_to_stereo_scalar(out, in, frames);
+}
+
+void pcm_apply_gain(int16_t *buf, size_t samples, int16_t gain)
+{
+	pcm_apply_gain_scalar(buf, samples, gain);
+}
+
+void pcm_saturate(int16_t *out, const int32_t *in, size_t samples)
+{
+	pcm_saturate_scalar(out, in, samples);
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Gain is Q3.12 fixed point, i.e. up to almost 8x */
+#define PCM_GAIN_SHIFT	12
+#define PCM_GAIN_UNITY	(1 << PCM_GAIN_SHIFT)
+#define PCM_GAIN_MAX	INT16_MAX
+
+/*
+ * All functions work on native endian 16bit PCM as provided by AudioFlinger
+ * and use SIMD instructions if available. Results are exactly the same as
+ * of the scalar versions which are exported as reference.
+ */
+
+const char *pcm_simd(void);
+
+int16_t pcm_gain_from_float(float gain);
+
+/* Output may be same as input */
+void pcm_downmix_to_mono(int16_t *out, const int16_t *in, size_t frames);
+void pcm_upmix_to_stereo(int16_t *out, const int16_t *in, size_t frames);
+
+void pcm_apply_gain(int16_t *buf, size_t samples, int16_t gain);
+void pcm_saturate(int16_t *out, const int32_t *in, size_t samples);
+
+void pcm_downmix_to_mono_scalar(int16_t *out, const int16_t *in,
+								size_t frames);
+void pcm_upmix_to_stereo_scalar(int16_t *out, const int16_t *in,
+								size_t frames);
+void pcm_apply_gain_scalar(int16_t *buf, size_t samples, int16_t gain);
+void pcm_saturate_scalar(int16_t *out, const int32_t *in, size_t samples);
@@ -30,6 +30,7 @@
 #include <audio_utils/resampler.h>
 
 #include "hal-utils.h"
+#include "hal-pcm.h"
 #include "sco-msg.h"
 #include "ipc-common.h"
 #include "hal-log.h"
@@ -74,6 +75,8 @@ struct sco_stream_out {
 	uint8_t *cache;
 	size_t cache_len;
 
+	int16_t gain;
+
 	size_t samples;
 	struct timespec start;
 
@@ -101,6 +104,8 @@ struct sco_stream_in {
 
 	struct sco_audio_config cfg;
 
+	int16_t gain;
+
 	struct resampler_itfe *resampler;
 	int16_t *resample_buf;
 	uint32_t resample_frame_num;
@@ -311,21 +316,6 @@ static int ipc_get_sco_fd(bt_bdaddr_t *bd_addr)
 
 /* Audio stream functions */
 
-static void downmix_to_mono(struct sco_stream_out *out, const uint8_t *buffer,
-							size_t frame_num)
-{
-	const int16_t *input = (const void *) buffer;
-	int16_t *output = (void *) out->downmix_buf;
-	size_t i;
-
-	for (i = 0; i < frame_num; i++) {
-		int16_t l = get_le16(&input[i * 2]);
-		int16_t r = get_le16(&input[i * 2 + 1]);
-
-		put_le16((l + r) / 2, &output[i]);
-	}
-}
-
 static uint64_t timespec_diff_us(struct timespec *a, struct timespec *b)
 {
 	struct timespec res;
@@ -465,7 +455,11 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 		return -1;
 	}
 
-	downmix_to_mono(out, buffer, frame_num);
+	pcm_downmix_to_mono((int16_t *) out->downmix_buf, buffer, frame_num);
+
+	if (out->gain != PCM_GAIN_UNITY)
+		pcm_apply_gain((int16_t *) out->downmix_buf, frame_num,
+								out->gain);
 
 	if (out->resampler) {
 		int ret;
@@ -600,9 +594,14 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 static int out_set_volume(struct audio_stream_out *stream, float left,
 								float right)
 {
-	DBG("");
+	struct sco_stream_out *out = (struct sco_stream_out *) stream;
 
-	return -ENOSYS;
+	DBG("left %f right %f", left, right);
+
+	/* SCO is mono so use average of both channels */
+	out->gain = pcm_gain_from_float((left + right) / 2);
+
+	return 0;
 }
 
 static int out_get_render_position(const struct audio_stream_out *stream,
@@ -698,6 +697,7 @@ static int sco_open_output_stream_real(struct audio_hw_device *dev,
 	}
 
 	out->cfg.frame_num = OUT_STREAM_FRAMES;
+	out->gain = PCM_GAIN_UNITY;
 
 	out->downmix_buf = malloc(out_get_buffer_size(&out->stream.common));
 	if (!out->downmix_buf) {
@@ -994,9 +994,13 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
 
 static int in_set_gain(struct audio_stream_in *stream, float gain)
 {
-	DBG("");
+	struct sco_stream_in *in = (struct sco_stream_in *) stream;
 
-	return -ENOSYS;
+	DBG("gain %f", gain);
+
+	in->gain = pcm_gain_from_float(gain);
+
+	return 0;
 }
 
 static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
@@ -1057,7 +1061,7 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 	size_t frame_size, frame_num, input_frame_num;
 	void *read_buf = buffer;
 	size_t total = bytes;
-	int ret;
+	int chan_num, ret;
 
 #if ANDROID_VERSION >= PLATFORM_VER(5, 0, 0)
 	frame_size = audio_stream_in_frame_size(&in->stream);
@@ -1070,6 +1074,7 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 
 	frame_num = bytes / frame_size;
 	input_frame_num = frame_num;
+	chan_num = popcount(in->cfg.channels);
 
 	DBG("Read from fd %d bytes %zu", sco_fd, bytes);
 
@@ -1094,11 +1099,17 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 		read_buf = in->resample_buf;
 
 		total = input_frame_num * sizeof(int16_t) * 1;
+	} else if (chan_num > 1) {
+		/* SCO is mono, the rest of buffer is filled on upmix */
+		total = frame_num * sizeof(int16_t) * 1;
 	}
 
 	if(!read_data(in, read_buf, total))
 		return -1;
 
+	if (in->gain != PCM_GAIN_UNITY)
+		pcm_apply_gain(read_buf, total / sizeof(int16_t), in->gain);
+
 	if (in->resampler) {
 		ret = in->resampler->resample_from_input(in->resampler,
 							in->resample_buf,
@@ -1116,6 +1127,9 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 								frame_num);
 	}
 
+	if (chan_num > 1)
+		pcm_upmix_to_stereo(buffer, buffer, frame_num);
+
 	return bytes;
 }
 
@@ -1193,6 +1207,7 @@ static int sco_open_input_stream_real(struct audio_hw_device *dev,
 	}
 
 	in->cfg.frame_num = IN_STREAM_FRAMES;
+	in->gain = PCM_GAIN_UNITY;
 
 	if (in->cfg.rate == AUDIO_STREAM_SCO_RATE)
 		goto skip_resampler;
@@ -0,0 +1,212 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "android/hal-pcm.h"
+
+/* Covers empty input, scalar tail only, SIMD only and both */
+static const size_t lengths[] = { 0, 1, 7, 8, 9, 15, 16, 17, 31, 100, 1021 };
+
+#define MAX_SAMPLES	(1021 * 2)
+
+static const int16_t edges[] = {
+	INT16_MIN, INT16_MIN, INT16_MAX, INT16_MAX, INT16_MIN, INT16_MAX,
+	-1, 0, -1, -2, 1, 0, -3, 0, 0, -1, INT16_MIN, -1, INT16_MAX, 1,
+	-32767, 0, 32767, -1,
+};
+
+static void fill(int16_t *buf, size_t samples, bool edge)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i++) {
+		if (edge)
+			buf[i] = edges[i % G_N_ELEMENTS(edges)];
+		else
+			buf[i] = g_test_rand_int_range(INT16_MIN,
+							INT16_MAX + 1);
+	}
+}
+
+static void test_downmix(gconstpointer data)
+{
+	bool edge = GPOINTER_TO_INT(data);
+	int16_t in[MAX_SAMPLES], out[MAX_SAMPLES], ref[MAX_SAMPLES];
+	size_t i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(lengths); i++) {
+		size_t frames = lengths[i];
+
+		fill(in, frames * 2, edge);
+
+		pcm_downmix_to_mono_scalar(ref, in, frames);
+
+		for (j = 0; j < frames; j++)
+			g_assert_cmpint(ref[j], ==,
+					(in[j * 2] + in[j * 2 + 1]) / 2);
+
+		pcm_downmix_to_mono(out, in, frames);
+		g_assert(!memcmp(out, ref, frames * sizeof(int16_t)));
+
+		/* In place */
+		pcm_downmix_to_mono(in, in, frames);
+		g_assert(!memcmp(in, ref, frames * sizeof(int16_t)));
+	}
+}
+
+static void test_upmix(gconstpointer data)
+{
+	bool edge = GPOINTER_TO_INT(data);
+	int16_t in[MAX_SAMPLES], out[MAX_SAMPLES], ref[MAX_SAMPLES];
+	size_t i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(lengths); i++) {
+		size_t frames = lengths[i];
+
+		fill(in, frames, edge);
+
+		pcm_upmix_to_stereo_scalar(ref, in, frames);
+
+		for (j = 0; j < frames; j++) {
+			g_assert_cmpint(ref[j * 2], ==, in[j]);
+			g_assert_cmpint(ref[j * 2 + 1], ==, in[j]);
+		}
+
+		pcm_upmix_to_stereo(out, in, frames);
+		g_assert(!memcmp(out, ref, frames * 2 * sizeof(int16_t)));
+
+		/* In place */
+		pcm_upmix_to_stereo(in, in, frames);
+		g_assert(!memcmp(in, ref, frames * 2 * sizeof(int16_t)));
+	}
+}
+
+static void test_gain(gconstpointer data)
+{
+	static const int16_t gains[] = { 0, 1, 2048, PCM_GAIN_UNITY - 1,
+					PCM_GAIN_UNITY, PCM_GAIN_UNITY + 1,
+					3 * PCM_GAIN_UNITY, PCM_GAIN_MAX };
+	bool edge = GPOINTER_TO_INT(data);
+	int16_t in[MAX_SAMPLES], out[MAX_SAMPLES], ref[MAX_SAMPLES];
+	size_t i, j, k;
+
+	for (i = 0; i < G_N_ELEMENTS(lengths); i++) {
+		size_t samples = lengths[i] * 2;
+
+		fill(in, samples, edge);
+
+		for (j = 0; j < G_N_ELEMENTS(gains); j++) {
+			memcpy(ref, in, samples * sizeof(int16_t));
+			pcm_apply_gain_scalar(ref, samples, gains[j]);
+
+			for (k = 0; k < samples; k++) {
+				int32_t s = in[k] * gains[j];
+
+				s = (s + PCM_GAIN_UNITY / 2) >> PCM_GAIN_SHIFT;
+				s = CLAMP(s, INT16_MIN, INT16_MAX);
+
+				g_assert_cmpint(ref[k], ==, s);
+			}
+
+			memcpy(out, in, samples * sizeof(int16_t));
+			pcm_apply_gain(out, samples, gains[j]);
+			g_assert(!memcmp(out, ref, samples * sizeof(int16_t)));
+		}
+	}
+}
+
+static void test_saturate(gconstpointer data)
+{
+	static const int32_t edges32[] = { INT32_MIN, INT32_MAX,
+					INT16_MIN - 1, INT16_MIN, INT16_MAX,
+					INT16_MAX + 1, 0, -1, 1, 100000 };
+	bool edge = GPOINTER_TO_INT(data);
+	int32_t in[MAX_SAMPLES];
+	int16_t out[MAX_SAMPLES], ref[MAX_SAMPLES];
+	size_t i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(lengths); i++) {
+		size_t samples = lengths[i];
+
+		for (j = 0; j < samples; j++) {
+			if (edge)
+				in[j] = edges32[j % G_N_ELEMENTS(edges32)];
+			else
+				in[j] = g_test_rand_int_range(-100000, 100000);
+		}
+
+		pcm_saturate_scalar(ref, in, samples);
+
+		for (j = 0; j < samples; j++)
+			g_assert_cmpint(ref[j], ==,
+					CLAMP(in[j], INT16_MIN, INT16_MAX));
+
+		pcm_saturate(out, in, samples);
+		g_assert(!memcmp(out, ref, samples * sizeof(int16_t)));
+	}
+}
+
+static void test_gain_from_float(void)
+{
+	g_assert_cmpint(pcm_gain_from_float(-1.0f), ==, 0);
+	g_assert_cmpint(pcm_gain_from_float(0.0f), ==, 0);
+	g_assert_cmpint(pcm_gain_from_float(0.5f), ==, PCM_GAIN_UNITY / 2);
+	g_assert_cmpint(pcm_gain_from_float(1.0f), ==, PCM_GAIN_UNITY);
+	g_assert_cmpint(pcm_gain_from_float(100.0f), ==, PCM_GAIN_MAX);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	if (g_test_verbose())
+		g_print("SIMD: %s\n", pcm_simd());
+
+	g_test_add_data_func("/android_hal_pcm/downmix_random",
+					GINT_TO_POINTER(false), test_downmix);
+	g_test_add_data_func("/android_hal_pcm/downmix_edge",
+					GINT_TO_POINTER(true), test_downmix);
+	g_test_add_data_func("/android_hal_pcm/upmix_random",
+					GINT_TO_POINTER(false), test_upmix);
+	g_test_add_data_func("/android_hal_pcm/upmix_edge",
+					GINT_TO_POINTER(true), test_upmix);
+	g_test_add_data_func("/android_hal_pcm/gain_random",
+					GINT_TO_POINTER(false), test_gain);
+	g_test_add_data_func("/android_hal_pcm/gain_edge",
+					GINT_TO_POINTER(true), test_gain);
+	g_test_add_data_func("/android_hal_pcm/saturate_random",
+					GINT_TO_POINTER(false), test_saturate);
+	g_test_add_data_func("/android_hal_pcm/saturate_edge",
+					GINT_TO_POINTER(true), test_saturate);
+	g_test_add_func("/android_hal_pcm/gain_from_float",
+						test_gain_from_float);
+
+	return g_test_run();
+}
@@ -27,7 +27,9 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
@@ -35,6 +37,49 @@
 #include "monitor/bt.h"
 #include "analyze.h"
 
+/*
+ * The trace is split into chunks of packets which are parsed by separate
+ * worker threads. Workers only count packets and turn the interesting
+ * ones into records, everything that needs state spanning across chunks
+ * (pending commands, ATT transactions, LE credits) is evaluated while
+ * merging the records of all chunks in order.
+ */
+#define MIN_CHUNK_PACKETS	4096
+
+#define MAX_HANDLE		0x1000
+
+struct stats {
+	unsigned long count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct credit_chan {
+	uint16_t cid;
+	bool in;
+	uint32_t credits;
+	uint64_t stall_start;
+};
+
+struct hci_conn {
+	uint16_t handle;
+	uint8_t bdaddr[6];
+	unsigned long num_pkts[2];
+	uint64_t num_bytes[2];
+	uint64_t first_data;
+	uint64_t last_data;
+	uint64_t att_req[2];
+	struct stats att_rtt;
+	struct stats stalls;
+	struct queue *chan_list;
+};
+
+struct pending_cmd {
+	uint16_t opcode;
+	uint64_t time;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -45,10 +90,165 @@ struct hci_dev {
 	unsigned long num_evt;
 	unsigned long num_acl;
 	unsigned long num_sco;
+	struct stats cmd_latency;
+	struct queue *cmd_list;
+	struct queue *conn_list;
+	struct queue *closed_list;
 };
 
 static struct queue *dev_list;
 
+enum record_type {
+	RECORD_NEW_INDEX,
+	RECORD_DEL_INDEX,
+	RECORD_DEV_STATS,
+	RECORD_BD_ADDR,
+	RECORD_CMD,
+	RECORD_CMD_DONE,
+	RECORD_CONN,
+	RECORD_DISCONN,
+	RECORD_CONN_STATS,
+	RECORD_ATT_REQ,
+	RECORD_ATT_RSP,
+	RECORD_CREDITS_INIT,
+	RECORD_CREDITS,
+	RECORD_KFRAME,
+};
+
+struct record {
+	uint8_t type;
+	bool in;
+	uint16_t index;
+	uint16_t handle;
+	uint16_t value;
+	uint64_t time;
+	union {
+		struct {
+			uint8_t type;
+			uint8_t bdaddr[6];
+		} dev;
+		struct {
+			unsigned long num_cmd;
+			unsigned long num_evt;
+			unsigned long num_acl;
+			unsigned long num_sco;
+		} dev_stats;
+		struct {
+			unsigned long num_pkts[2];
+			uint64_t num_bytes[2];
+			uint64_t first_data;
+			uint64_t last_data;
+		} conn_stats;
+		uint32_t credits;
+	};
+};
+
+struct chunk_conn {
+	unsigned long num_pkts[2];
+	uint64_t num_bytes[2];
+	uint64_t first_data;
+	uint64_t last_data;
+};
+
+struct chunk_dev {
+	uint16_t index;
+	unsigned long num_cmd;
+	unsigned long num_evt;
+	unsigned long num_acl;
+	unsigned long num_sco;
+	struct chunk_conn **conns;
+};
+
+struct chunk {
+	struct btsnoop *btsnoop;
+	uint32_t start;
+	uint32_t count;
+	pthread_t thread;
+	struct queue *dev_list;
+	struct record *records;
+	size_t num_records;
+	size_t max_records;
+	unsigned long num_packets;
+	bool failed;
+};
+
+static uint64_t tv_to_usec(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static void stats_add(struct stats *stats, uint64_t value)
+{
+	if (!stats->count || value < stats->min)
+		stats->min = value;
+
+	if (value > stats->max)
+		stats->max = value;
+
+	stats->sum += value;
+	stats->count++;
+}
+
+static void stats_print(const char *indent, const char *label,
+						const struct stats *stats)
+{
+	printf("%s%s %.3f/%.3f/%.3f msec (%lu samples)\n", indent, label,
+				stats->min / 1000.0,
+				stats->sum / 1000.0 / stats->count,
+				stats->max / 1000.0, stats->count);
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+
+	queue_destroy(conn->chan_list, free);
+	free(conn);
+}
+
+static void conn_print(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	uint64_t duration = conn->last_data - conn->first_data;
+	static const uint8_t bdaddr_none[6];
+	const char *dir[2] = { "sent", "received" };
+	int i;
+
+	printf("  Connection handle %u", conn->handle);
+	if (memcmp(conn->bdaddr, bdaddr_none, 6))
+		printf(" with %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
+				conn->bdaddr[5], conn->bdaddr[4],
+				conn->bdaddr[3], conn->bdaddr[2],
+				conn->bdaddr[1], conn->bdaddr[0]);
+	printf("\n");
+
+	for (i = 0; i < 2; i++) {
+		printf("    %lu ACL packets %s (%llu bytes",
+					conn->num_pkts[i], dir[i],
+					(unsigned long long) conn->num_bytes[i]);
+		if (duration)
+			printf(", %.1f kbit/s",
+				conn->num_bytes[i] * 8000.0 / duration);
+		printf(")\n");
+	}
+
+	if (conn->att_rtt.count)
+		stats_print("    ", "ATT round trip", &conn->att_rtt);
+
+	if (conn->stalls.count)
+		stats_print("    ", "LE credit stalls", &conn->stalls);
+}
+
+static void dev_free(void *data)
+{
+	struct hci_dev *dev = data;
+
+	queue_destroy(dev->cmd_list, free);
+	queue_destroy(dev->conn_list, conn_destroy);
+	queue_destroy(dev->closed_list, conn_destroy);
+	free(dev);
+}
+
 static void dev_destroy(void *data)
 {
 	struct hci_dev *dev = data;
@@ -74,9 +274,16 @@ static void dev_destroy(void *data)
 	printf("  %lu events\n", dev->num_evt);
 	printf("  %lu ACL packets\n", dev->num_acl);
 	printf("  %lu SCO packets\n", dev->num_sco);
+
+	if (dev->cmd_latency.count)
+		stats_print("  ", "Command latency", &dev->cmd_latency);
+
+	queue_foreach(dev->closed_list, conn_print, NULL);
+	queue_foreach(dev->conn_list, conn_print, NULL);
+
 	printf("\n");
 
-	free(dev);
+	dev_free(dev);
 }
 
 static struct hci_dev *dev_alloc(uint16_t index)
@@ -90,6 +297,9 @@ static struct hci_dev *dev_alloc(uint16_t index)
 	}
 
 	dev->index = index;
+	dev->cmd_list = queue_new();
+	dev->conn_list = queue_new();
+	dev->closed_list = queue_new();
 
 	return dev;
 }
@@ -120,28 +330,78 @@ static struct hci_dev *dev_lookup(uint16_t index)
 	return dev;
 }
 
-static void new_index(struct timeval *tv, uint16_t index,
-					const void *data, uint16_t size)
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct hci_conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return conn->handle == handle;
+}
+
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle,
+								bool create)
+{
+	struct hci_conn *conn;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+	if (conn || !create)
+		return conn;
+
+	conn = new0(struct hci_conn, 1);
+	if (!conn)
+		return NULL;
+
+	conn->handle = handle;
+	conn->chan_list = queue_new();
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
+static void conn_close(struct hci_dev *dev, struct hci_conn *conn)
+{
+	queue_remove(dev->conn_list, conn);
+	queue_push_tail(dev->closed_list, conn);
+}
+
+static bool cmd_match_opcode(const void *a, const void *b)
+{
+	const struct pending_cmd *cmd = a;
+	uint16_t opcode = PTR_TO_UINT(b);
+
+	return cmd->opcode == opcode;
+}
+
+static bool chan_match(const void *a, const void *b)
+{
+	const struct credit_chan *chan = a;
+	const struct record *rec = b;
+
+	return chan->cid == rec->value && chan->in == rec->in;
+}
+
+static void new_index(const struct record *rec)
 {
-	const struct btsnoop_opcode_new_index *ni = data;
 	struct hci_dev *dev;
 
-	dev = dev_alloc(index);
+	dev = dev_alloc(rec->index);
 	if (!dev)
 		return;
 
-	dev->type = ni->type;
-	memcpy(dev->bdaddr, ni->bdaddr, 6);
+	dev->type = rec->dev.type;
+	memcpy(dev->bdaddr, rec->dev.bdaddr, 6);
 
 	queue_push_tail(dev_list, dev);
 }
 
-static void del_index(struct timeval *tv, uint16_t index,
-					const void *data, uint16_t size)
+static void del_index(const struct record *rec)
 {
 	struct hci_dev *dev;
 
-	dev = queue_remove_if(dev_list, dev_match_index, UINT_TO_PTR(index));
+	dev = queue_remove_if(dev_list, dev_match_index,
+						UINT_TO_PTR(rec->index));
 	if (!dev) {
 		fprintf(stderr, "Remove for an unexisting device\n");
 		return;
@@ -150,171 +410,907 @@ static void del_index(struct timeval *tv, uint16_t index,
 	dev_destroy(dev);
 }
 
-static void command_pkt(struct timeval *tv, uint16_t index,
-					const void *data, uint16_t size)
+static void dev_stats(struct hci_dev *dev, const struct record *rec)
+{
+	dev->num_cmd += rec->dev_stats.num_cmd;
+	dev->num_evt += rec->dev_stats.num_evt;
+	dev->num_acl += rec->dev_stats.num_acl;
+	dev->num_sco += rec->dev_stats.num_sco;
+}
+
+static void rsp_read_bd_addr(struct hci_dev *dev, const struct record *rec)
+{
+	printf("Read BD Addr event with status 0x%2.2x\n", rec->value);
+
+	if (rec->value)
+		return;
+
+	memcpy(dev->bdaddr, rec->dev.bdaddr, 6);
+}
+
+static void cmd_sent(struct hci_dev *dev, const struct record *rec)
+{
+	struct pending_cmd *cmd;
+
+	cmd = queue_find(dev->cmd_list, cmd_match_opcode,
+						UINT_TO_PTR(rec->value));
+	if (!cmd) {
+		cmd = new0(struct pending_cmd, 1);
+		if (!cmd)
+			return;
+
+		cmd->opcode = rec->value;
+		queue_push_tail(dev->cmd_list, cmd);
+	}
+
+	cmd->time = rec->time;
+}
+
+static void cmd_done(struct hci_dev *dev, const struct record *rec)
+{
+	struct pending_cmd *cmd;
+
+	/* Command Status and Complete both end the wait for a command */
+	cmd = queue_remove_if(dev->cmd_list, cmd_match_opcode,
+						UINT_TO_PTR(rec->value));
+	if (!cmd)
+		return;
+
+	if (rec->time >= cmd->time)
+		stats_add(&dev->cmd_latency, rec->time - cmd->time);
+
+	free(cmd);
+}
+
+static void conn_complete(struct hci_dev *dev, const struct record *rec)
+{
+	struct hci_conn *conn;
+
+	/* Handle reused without a disconnect in the trace */
+	conn = conn_lookup(dev, rec->handle, false);
+	if (conn)
+		conn_close(dev, conn);
+
+	conn = conn_lookup(dev, rec->handle, true);
+	if (!conn)
+		return;
+
+	memcpy(conn->bdaddr, rec->dev.bdaddr, 6);
+}
+
+static void disconn_complete(struct hci_dev *dev, const struct record *rec)
+{
+	struct hci_conn *conn;
+
+	conn = conn_lookup(dev, rec->handle, false);
+	if (conn)
+		conn_close(dev, conn);
+}
+
+static void conn_stats(struct hci_conn *conn, const struct record *rec)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		conn->num_pkts[i] += rec->conn_stats.num_pkts[i];
+		conn->num_bytes[i] += rec->conn_stats.num_bytes[i];
+	}
+
+	if (!conn->first_data || rec->conn_stats.first_data < conn->first_data)
+		conn->first_data = rec->conn_stats.first_data;
+
+	if (rec->conn_stats.last_data > conn->last_data)
+		conn->last_data = rec->conn_stats.last_data;
+}
+
+static void att_rsp(struct hci_conn *conn, const struct record *rec)
+{
+	uint64_t req = conn->att_req[!rec->in];
+
+	if (!req || rec->time < req)
+		return;
+
+	stats_add(&conn->att_rtt, rec->time - req);
+	conn->att_req[!rec->in] = 0;
+}
+
+static void credits_init(struct hci_conn *conn, const struct record *rec)
+{
+	struct credit_chan *chan;
+
+	chan = queue_find(conn->chan_list, chan_match, rec);
+	if (!chan) {
+		chan = new0(struct credit_chan, 1);
+		if (!chan)
+			return;
+
+		chan->cid = rec->value;
+		chan->in = rec->in;
+		queue_push_tail(conn->chan_list, chan);
+	}
+
+	chan->credits = rec->credits;
+	chan->stall_start = 0;
+}
+
+static void credits_add(struct hci_conn *conn, const struct record *rec)
+{
+	struct credit_chan *chan;
+
+	chan = queue_find(conn->chan_list, chan_match, rec);
+	if (!chan)
+		return;
+
+	if (!chan->credits && chan->stall_start) {
+		if (rec->time >= chan->stall_start)
+			stats_add(&conn->stalls,
+					rec->time - chan->stall_start);
+		chan->stall_start = 0;
+	}
+
+	chan->credits += rec->credits;
+}
+
+static void kframe(struct hci_conn *conn, const struct record *rec)
+{
+	struct credit_chan *chan;
+
+	chan = queue_find(conn->chan_list, chan_match, rec);
+	if (!chan || !chan->credits)
+		return;
+
+	if (!--chan->credits)
+		chan->stall_start = rec->time;
+}
+
+static void merge_record(const struct record *rec)
 {
-	const struct bt_hci_cmd_hdr *hdr = data;
 	struct hci_dev *dev;
+	struct hci_conn *conn;
 
-	data += sizeof(*hdr);
-	size -= sizeof(*hdr);
+	switch (rec->type) {
+	case RECORD_NEW_INDEX:
+		new_index(rec);
+		return;
+	case RECORD_DEL_INDEX:
+		del_index(rec);
+		return;
+	}
 
-	dev = dev_lookup(index);
+	dev = dev_lookup(rec->index);
+	if (!dev)
+		return;
+
+	switch (rec->type) {
+	case RECORD_DEV_STATS:
+		dev_stats(dev, rec);
+		return;
+	case RECORD_BD_ADDR:
+		rsp_read_bd_addr(dev, rec);
+		return;
+	case RECORD_CMD:
+		cmd_sent(dev, rec);
+		return;
+	case RECORD_CMD_DONE:
+		cmd_done(dev, rec);
+		return;
+	case RECORD_CONN:
+		conn_complete(dev, rec);
+		return;
+	case RECORD_DISCONN:
+		disconn_complete(dev, rec);
+		return;
+	}
+
+	conn = conn_lookup(dev, rec->handle, true);
+	if (!conn)
+		return;
+
+	switch (rec->type) {
+	case RECORD_CONN_STATS:
+		conn_stats(conn, rec);
+		break;
+	case RECORD_ATT_REQ:
+		conn->att_req[rec->in] = rec->time;
+		break;
+	case RECORD_ATT_RSP:
+		att_rsp(conn, rec);
+		break;
+	case RECORD_CREDITS_INIT:
+		credits_init(conn, rec);
+		break;
+	case RECORD_CREDITS:
+		credits_add(conn, rec);
+		break;
+	case RECORD_KFRAME:
+		kframe(conn, rec);
+		break;
+	}
+}
+
+static struct record *chunk_record(struct chunk *chunk, uint8_t type,
+					struct timeval *tv, uint16_t index)
+{
+	struct record *rec;
+
+	if (chunk->num_records == chunk->max_records) {
+		size_t max = chunk->max_records ? chunk->max_records * 2 : 1024;
+
+		rec = realloc(chunk->records, max * sizeof(*rec));
+		if (!rec) {
+			fprintf(stderr, "Failed to allocate analyze records\n");
+			chunk->failed = true;
+			return NULL;
+		}
+
+		chunk->records = rec;
+		chunk->max_records = max;
+	}
+
+	rec = &chunk->records[chunk->num_records++];
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	rec->index = index;
+	rec->time = tv ? tv_to_usec(tv) : 0;
+
+	return rec;
+}
+
+static bool chunk_dev_match(const void *a, const void *b)
+{
+	const struct chunk_dev *dev = a;
+	uint16_t index = PTR_TO_UINT(b);
+
+	return dev->index == index;
+}
+
+static struct chunk_dev *chunk_dev_lookup(struct chunk *chunk, uint16_t index)
+{
+	struct chunk_dev *dev;
+
+	dev = queue_find(chunk->dev_list, chunk_dev_match, UINT_TO_PTR(index));
+	if (dev)
+		return dev;
+
+	dev = new0(struct chunk_dev, 1);
+	if (!dev) {
+		chunk->failed = true;
+		return NULL;
+	}
+
+	dev->index = index;
+	queue_push_tail(chunk->dev_list, dev);
+
+	return dev;
+}
+
+static void flush_conn(struct chunk *chunk, struct chunk_dev *dev,
+							uint16_t handle)
+{
+	struct chunk_conn *conn;
+	struct record *rec;
+
+	if (!dev->conns || !dev->conns[handle])
+		return;
+
+	conn = dev->conns[handle];
+	dev->conns[handle] = NULL;
+
+	rec = chunk_record(chunk, RECORD_CONN_STATS, NULL, dev->index);
+	if (rec) {
+		rec->handle = handle;
+		memcpy(rec->conn_stats.num_pkts, conn->num_pkts,
+						sizeof(conn->num_pkts));
+		memcpy(rec->conn_stats.num_bytes, conn->num_bytes,
+						sizeof(conn->num_bytes));
+		rec->conn_stats.first_data = conn->first_data;
+		rec->conn_stats.last_data = conn->last_data;
+	}
+
+	free(conn);
+}
+
+static void flush_dev(void *data, void *user_data)
+{
+	struct chunk_dev *dev = data;
+	struct chunk *chunk = user_data;
+	struct record *rec;
+	unsigned int i;
+
+	if (dev->num_cmd || dev->num_evt || dev->num_acl || dev->num_sco) {
+		rec = chunk_record(chunk, RECORD_DEV_STATS, NULL, dev->index);
+		if (rec) {
+			rec->dev_stats.num_cmd = dev->num_cmd;
+			rec->dev_stats.num_evt = dev->num_evt;
+			rec->dev_stats.num_acl = dev->num_acl;
+			rec->dev_stats.num_sco = dev->num_sco;
+		}
+	}
+
+	dev->num_cmd = 0;
+	dev->num_evt = 0;
+	dev->num_acl = 0;
+	dev->num_sco = 0;
+
+	if (!dev->conns)
+		return;
+
+	for (i = 0; i < MAX_HANDLE; i++)
+		flush_conn(chunk, dev, i);
+}
+
+static void chunk_dev_free(void *data)
+{
+	struct chunk_dev *dev = data;
+
+	free(dev->conns);
+	free(dev);
+}
+
+/*
+ * Counters are kept per chunk and emitted as records whenever a record
+ * they need to be ordered against is added, that keeps the merged
+ * result identical to a sequential pass over the trace.
+ */
+static void chunk_new_index(struct chunk *chunk, struct timeval *tv,
+			uint16_t index, const void *data, uint16_t size)
+{
+	const struct btsnoop_opcode_new_index *ni = data;
+	struct record *rec;
+
+	queue_foreach(chunk->dev_list, flush_dev, chunk);
+
+	rec = chunk_record(chunk, RECORD_NEW_INDEX, tv, index);
+	if (!rec)
+		return;
+
+	rec->dev.type = ni->type;
+	memcpy(rec->dev.bdaddr, ni->bdaddr, 6);
+}
+
+static void chunk_del_index(struct chunk *chunk, struct timeval *tv,
+			uint16_t index, const void *data, uint16_t size)
+{
+	queue_foreach(chunk->dev_list, flush_dev, chunk);
+
+	chunk_record(chunk, RECORD_DEL_INDEX, tv, index);
+}
+
+static void command_pkt(struct chunk *chunk, struct timeval *tv,
+			uint16_t index, const void *data, uint16_t size)
+{
+	const struct bt_hci_cmd_hdr *hdr = data;
+	struct chunk_dev *dev;
+	struct record *rec;
+
+	dev = chunk_dev_lookup(chunk, index);
 	if (!dev)
 		return;
 
 	dev->num_cmd++;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	rec = chunk_record(chunk, RECORD_CMD, tv, index);
+	if (rec)
+		rec->value = le16_to_cpu(hdr->opcode);
 }
 
-static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
-					const void *data, uint16_t size)
+static void evt_cmd_done(struct chunk *chunk, struct timeval *tv,
+				uint16_t index, uint16_t opcode,
+				const void *data, uint16_t size)
 {
 	const struct bt_hci_rsp_read_bd_addr *rsp = data;
+	struct record *rec;
 
-	printf("Read BD Addr event with status 0x%2.2x\n", rsp->status);
+	rec = chunk_record(chunk, RECORD_CMD_DONE, tv, index);
+	if (!rec)
+		return;
+
+	rec->value = opcode;
+
+	if (opcode != BT_HCI_CMD_READ_BD_ADDR || size < 1)
+		return;
 
-	if (rsp->status)
+	rec = chunk_record(chunk, RECORD_BD_ADDR, tv, index);
+	if (!rec)
 		return;
 
-	memcpy(dev->bdaddr, rsp->bdaddr, 6);
+	rec->value = rsp->status;
+
+	if (size >= sizeof(*rsp))
+		memcpy(rec->dev.bdaddr, rsp->bdaddr, 6);
 }
 
-static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
-					const void *data, uint16_t size)
+static void evt_conn(struct chunk *chunk, struct chunk_dev *dev,
+				struct timeval *tv, uint8_t type,
+				uint16_t handle, const uint8_t *bdaddr)
 {
-	const struct bt_hci_evt_cmd_complete *evt = data;
-	uint16_t opcode;
+	struct record *rec;
 
-	data += sizeof(*evt);
-	size -= sizeof(*evt);
+	handle &= MAX_HANDLE - 1;
 
-	opcode = le16_to_cpu(evt->opcode);
+	flush_conn(chunk, dev, handle);
 
-	switch (opcode) {
-	case BT_HCI_CMD_READ_BD_ADDR:
-		rsp_read_bd_addr(dev, tv, data, size);
+	rec = chunk_record(chunk, type, tv, dev->index);
+	if (!rec)
+		return;
+
+	rec->handle = handle;
+
+	if (bdaddr)
+		memcpy(rec->dev.bdaddr, bdaddr, 6);
+}
+
+static void evt_le_meta(struct chunk *chunk, struct chunk_dev *dev,
+			struct timeval *tv, const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_complete *evt = data + 1;
+
+	if (size < 1 + sizeof(*evt))
+		return;
+
+	switch (*((const uint8_t *) data)) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		/* Both start with status, handle, role and peer address */
+		if (evt->status)
+			break;
+
+		evt_conn(chunk, dev, tv, RECORD_CONN,
+				le16_to_cpu(evt->handle), evt->peer_addr);
 		break;
 	}
 }
 
-static void event_pkt(struct timeval *tv, uint16_t index,
-					const void *data, uint16_t size)
+static void event_pkt(struct chunk *chunk, struct timeval *tv,
+			uint16_t index, const void *data, uint16_t size)
 {
 	const struct bt_hci_evt_hdr *hdr = data;
-	struct hci_dev *dev;
-
-	data += sizeof(*hdr);
-	size -= sizeof(*hdr);
+	struct chunk_dev *dev;
 
-	dev = dev_lookup(index);
+	dev = chunk_dev_lookup(chunk, index);
 	if (!dev)
 		return;
 
 	dev->num_evt++;
 
+	if (size < sizeof(*hdr))
+		return;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
 	switch (hdr->evt) {
 	case BT_HCI_EVT_CMD_COMPLETE:
-		evt_cmd_complete(dev, tv, data, size);
+		if (size < sizeof(struct bt_hci_evt_cmd_complete))
+			break;
+
+		evt_cmd_done(chunk, tv, index,
+			get_le16(data + 1),
+			data + sizeof(struct bt_hci_evt_cmd_complete),
+			size - sizeof(struct bt_hci_evt_cmd_complete));
+		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		if (size < sizeof(struct bt_hci_evt_cmd_status))
+			break;
+
+		evt_cmd_done(chunk, tv, index, get_le16(data + 2), NULL, 0);
+		break;
+	case BT_HCI_EVT_CONN_COMPLETE:
+		if (size < sizeof(struct bt_hci_evt_conn_complete) ||
+						*((const uint8_t *) data))
+			break;
+
+		evt_conn(chunk, dev, tv, RECORD_CONN,
+					get_le16(data + 1), data + 3);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		if (size < sizeof(struct bt_hci_evt_disconnect_complete) ||
+						*((const uint8_t *) data))
+			break;
+
+		evt_conn(chunk, dev, tv, RECORD_DISCONN,
+					get_le16(data + 1), NULL);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta(chunk, dev, tv, data, size);
 		break;
 	}
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
-					const void *data, uint16_t size)
+static bool att_is_request(uint8_t opcode)
 {
-	const struct bt_hci_acl_hdr *hdr = data;
-	struct hci_dev *dev;
+	switch (opcode) {
+	case 0x02:	/* Exchange MTU */
+	case 0x04:	/* Find Information */
+	case 0x06:	/* Find By Type Value */
+	case 0x08:	/* Read By Type */
+	case 0x0a:	/* Read */
+	case 0x0c:	/* Read Blob */
+	case 0x0e:	/* Read Multiple */
+	case 0x10:	/* Read By Group Type */
+	case 0x12:	/* Write */
+	case 0x16:	/* Prepare Write */
+	case 0x18:	/* Execute Write */
+		return true;
+	}
 
-	data += sizeof(*hdr);
-	size -= sizeof(*hdr);
+	return false;
+}
 
-	dev = dev_lookup(index);
-	if (!dev)
-		return;
+static bool att_is_response(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x01:	/* Error */
+	case 0x03:
+	case 0x05:
+	case 0x07:
+	case 0x09:
+	case 0x0b:
+	case 0x0d:
+	case 0x0f:
+	case 0x11:
+	case 0x13:
+	case 0x17:
+	case 0x19:
+		return true;
+	}
 
-	dev->num_acl++;
+	return false;
 }
 
-static void sco_pkt(struct timeval *tv, uint16_t index,
-					const void *data, uint16_t size)
+static void le_sig_pkt(struct chunk *chunk, struct timeval *tv,
+				uint16_t index, bool in, uint16_t handle,
+				const void *data, uint16_t size)
 {
-	const struct bt_hci_sco_hdr *hdr = data;
-	struct hci_dev *dev;
+	const struct bt_l2cap_hdr_sig *hdr = data;
+	uint16_t cid, credits;
+	uint8_t type;
+	struct record *rec;
+
+	if (size < sizeof(*hdr))
+		return;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
-	dev = dev_lookup(index);
-	if (!dev)
+	/*
+	 * Credits are granted for the CID of the sender of the signaling
+	 * packet and used by data flowing in the opposite direction.
+	 */
+	switch (hdr->code) {
+	case BT_L2CAP_PDU_LE_CONN_REQ:
+		if (size < sizeof(struct bt_l2cap_pdu_le_conn_req))
+			return;
+
+		type = RECORD_CREDITS_INIT;
+		cid = get_le16(data + 2);
+		credits = get_le16(data + 8);
+		break;
+	case BT_L2CAP_PDU_LE_CONN_RSP:
+		if (size < sizeof(struct bt_l2cap_pdu_le_conn_rsp) ||
+							get_le16(data + 8))
+			return;
+
+		type = RECORD_CREDITS_INIT;
+		cid = get_le16(data);
+		credits = get_le16(data + 6);
+		break;
+	case BT_L2CAP_PDU_LE_FLOWCTL_CREDS:
+		if (size < sizeof(struct bt_l2cap_pdu_le_flowctl_creds))
+			return;
+
+		type = RECORD_CREDITS;
+		cid = get_le16(data);
+		credits = get_le16(data + 2);
+		break;
+	default:
 		return;
+	}
 
-	dev->num_sco++;
+	rec = chunk_record(chunk, type, tv, index);
+	if (!rec)
+		return;
+
+	rec->in = !in;
+	rec->handle = handle;
+	rec->value = cid;
+	rec->credits = credits;
 }
 
-void analyze_trace(const char *path)
+static void acl_pkt(struct chunk *chunk, struct timeval *tv,
+				uint16_t index, bool in,
+				const void *data, uint16_t size)
 {
-	struct btsnoop *btsnoop_file;
-	unsigned long num_packets = 0;
-	uint32_t type;
+	const struct bt_hci_acl_hdr *hdr = data;
+	const struct bt_l2cap_hdr *l2cap;
+	struct chunk_dev *dev;
+	struct chunk_conn *conn;
+	struct record *rec;
+	uint16_t handle, flags, cid;
+	uint8_t type;
 
-	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
-	if (!btsnoop_file)
+	dev = chunk_dev_lookup(chunk, index);
+	if (!dev)
 		return;
 
-	type = btsnoop_get_type(btsnoop_file);
+	dev->num_acl++;
 
-	switch (type) {
-	case BTSNOOP_TYPE_HCI:
-	case BTSNOOP_TYPE_UART:
-	case BTSNOOP_TYPE_MONITOR:
+	if (size < sizeof(*hdr))
+		return;
+
+	handle = le16_to_cpu(hdr->handle) & (MAX_HANDLE - 1);
+	flags = le16_to_cpu(hdr->handle) >> 12;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	if (!dev->conns) {
+		dev->conns = calloc(MAX_HANDLE, sizeof(*dev->conns));
+		if (!dev->conns) {
+			chunk->failed = true;
+			return;
+		}
+	}
+
+	conn = dev->conns[handle];
+	if (!conn) {
+		conn = new0(struct chunk_conn, 1);
+		if (!conn) {
+			chunk->failed = true;
+			return;
+		}
+
+		conn->first_data = tv_to_usec(tv);
+		dev->conns[handle] = conn;
+	}
+
+	conn->num_pkts[in]++;
+	conn->num_bytes[in] += size;
+	conn->last_data = tv_to_usec(tv);
+
+	/* Only start fragments carry the L2CAP header */
+	if ((flags & 0x03) == 0x01 || size < sizeof(*l2cap))
+		return;
+
+	l2cap = data;
+	cid = le16_to_cpu(l2cap->cid);
+
+	data += sizeof(*l2cap);
+	size -= sizeof(*l2cap);
+
+	switch (cid) {
+	case 0x0004:
+		if (!size)
+			return;
+
+		if (att_is_request(*((const uint8_t *) data)))
+			type = RECORD_ATT_REQ;
+		else if (att_is_response(*((const uint8_t *) data)))
+			type = RECORD_ATT_RSP;
+		else
+			return;
 		break;
+	case 0x0005:
+		le_sig_pkt(chunk, tv, index, in, handle, data, size);
+		return;
 	default:
-		fprintf(stderr, "Unsupported packet format\n");
-		goto done;
-	}
+		if (cid < 0x0040 || cid > 0x007f)
+			return;
 
-	dev_list = queue_new();
-	if (!dev_list) {
-		fprintf(stderr, "Failed to allocate device list\n");
-		goto done;
+		type = RECORD_KFRAME;
+		break;
 	}
 
-	while (1) {
+	rec = chunk_record(chunk, type, tv, index);
+	if (!rec)
+		return;
+
+	rec->in = in;
+	rec->handle = handle;
+	rec->value = cid;
+}
+
+static void sco_pkt(struct chunk *chunk, struct timeval *tv,
+			uint16_t index, const void *data, uint16_t size)
+{
+	struct chunk_dev *dev;
+
+	dev = chunk_dev_lookup(chunk, index);
+	if (!dev)
+		return;
+
+	dev->num_sco++;
+}
+
+static void *chunk_thread(void *user_data)
+{
+	struct chunk *chunk = user_data;
+
+	while (!chunk->failed && (!chunk->count ||
+				chunk->num_packets < chunk->count)) {
 		unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 		struct timeval tv;
 		uint16_t index, opcode, pktlen;
 
-		if (!btsnoop_read_hci(btsnoop_file, &tv, &index, &opcode,
+		if (!btsnoop_read_hci(chunk->btsnoop, &tv, &index, &opcode,
 								buf, &pktlen))
 			break;
 
 		switch (opcode) {
 		case BTSNOOP_OPCODE_NEW_INDEX:
-			new_index(&tv, index, buf, pktlen);
+			chunk_new_index(chunk, &tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_DEL_INDEX:
-			del_index(&tv, index, buf, pktlen);
+			chunk_del_index(chunk, &tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_COMMAND_PKT:
-			command_pkt(&tv, index, buf, pktlen);
+			command_pkt(chunk, &tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_EVENT_PKT:
-			event_pkt(&tv, index, buf, pktlen);
+			event_pkt(chunk, &tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_ACL_TX_PKT:
+			acl_pkt(chunk, &tv, index, false, buf, pktlen);
+			break;
 		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
+			acl_pkt(chunk, &tv, index, true, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_SCO_TX_PKT:
 		case BTSNOOP_OPCODE_SCO_RX_PKT:
-			sco_pkt(&tv, index, buf, pktlen);
+			sco_pkt(chunk, &tv, index, buf, pktlen);
 			break;
 		default:
 			fprintf(stderr, "Wrong opcode %u\n", opcode);
-			goto done;
+			chunk->failed = true;
+			break;
 		}
 
-		num_packets++;
+		if (!chunk->failed)
+			chunk->num_packets++;
+	}
+
+	queue_foreach(chunk->dev_list, flush_dev, chunk);
+
+	queue_pool_drain();
+
+	return NULL;
+}
+
+static void chunk_cleanup(struct chunk *chunk)
+{
+	btsnoop_unref(chunk->btsnoop);
+	queue_destroy(chunk->dev_list, chunk_dev_free);
+	free(chunk->records);
+}
+
+static unsigned int setup_chunks(struct btsnoop *btsnoop,
+				struct chunk *chunks, unsigned int num_jobs)
+{
+	uint32_t num_packets = 0, start = 0;
+	unsigned int i;
+
+	if (num_jobs > 1)
+		num_packets = btsnoop_get_packet_count(btsnoop);
+
+	if (num_jobs > num_packets / MIN_CHUNK_PACKETS)
+		num_jobs = num_packets / MIN_CHUNK_PACKETS;
+
+	/* Traces that can't be indexed are analyzed in a single pass */
+	if (num_jobs < 2) {
+		chunks[0].btsnoop = btsnoop_ref(btsnoop);
+		chunks[0].dev_list = queue_new();
+		return 1;
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		struct chunk *chunk = &chunks[i];
+
+		chunk->start = start;
+		chunk->count = num_packets / num_jobs;
+		if (i < num_packets % num_jobs)
+			chunk->count++;
+
+		start += chunk->count;
+
+		chunk->btsnoop = btsnoop_dup(btsnoop);
+		if (!chunk->btsnoop ||
+				!btsnoop_seek(chunk->btsnoop, chunk->start))
+			break;
+
+		chunk->dev_list = queue_new();
+	}
+
+	if (i == num_jobs)
+		return num_jobs;
+
+	do {
+		chunk_cleanup(&chunks[i]);
+	} while (i-- > 0);
+
+	memset(chunks, 0, num_jobs * sizeof(*chunks));
+
+	chunks[0].btsnoop = btsnoop_ref(btsnoop);
+	chunks[0].dev_list = queue_new();
+
+	return 1;
+}
+
+void analyze_trace(const char *path, unsigned int num_jobs)
+{
+	struct btsnoop *btsnoop_file;
+	struct chunk *chunks = NULL;
+	bool *started = NULL;
+	unsigned long num_packets = 0;
+	unsigned int num_chunks, i;
+	bool failed = false;
+	uint32_t type;
+
+	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop_file)
+		return;
+
+	type = btsnoop_get_type(btsnoop_file);
+
+	switch (type) {
+	case BTSNOOP_TYPE_HCI:
+	case BTSNOOP_TYPE_UART:
+	case BTSNOOP_TYPE_MONITOR:
+		break;
+	default:
+		fprintf(stderr, "Unsupported packet format\n");
+		goto done;
+	}
+
+	dev_list = queue_new();
+	if (!dev_list) {
+		fprintf(stderr, "Failed to allocate device list\n");
+		goto done;
+	}
+
+	if (num_jobs < 1)
+		num_jobs = 1;
+
+	chunks = new0(struct chunk, num_jobs);
+	started = new0(bool, num_jobs);
+	if (!chunks || !started) {
+		fprintf(stderr, "Failed to allocate analyze chunks\n");
+		goto done;
+	}
+
+	num_chunks = setup_chunks(btsnoop_file, chunks, num_jobs);
+
+	/* The first chunk is handled by the calling thread */
+	for (i = 1; i < num_chunks; i++)
+		started[i] = !pthread_create(&chunks[i].thread, NULL,
+						chunk_thread, &chunks[i]);
+
+	for (i = 0; i < num_chunks; i++) {
+		if (started[i])
+			pthread_join(chunks[i].thread, NULL);
+		else
+			chunk_thread(&chunks[i]);
+	}
+
+	for (i = 0; i < num_chunks && !failed; i++) {
+		struct chunk *chunk = &chunks[i];
+		size_t n;
+
+		for (n = 0; n < chunk->num_records; n++)
+			merge_record(&chunk->records[n]);
+
+		num_packets += chunk->num_packets;
+		failed = chunk->failed;
+	}
+
+	for (i = 0; i < num_chunks; i++)
+		chunk_cleanup(&chunks[i]);
+
+	if (failed) {
+		queue_destroy(dev_list, dev_free);
+		goto done;
 	}
 
 	printf("Trace contains %lu packets\n\n", num_packets);
@@ -322,5 +1318,7 @@ void analyze_trace(const char *path)
 	queue_destroy(dev_list, dev_destroy);
 
 done:
+	free(started);
+	free(chunks);
 	btsnoop_unref(btsnoop_file);
 }
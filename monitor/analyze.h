@@ -22,4 +22,4 @@
  *
  */
 
-void analyze_trace(const char *path);
+void analyze_trace(const char *path, unsigned int num_jobs);
@@ -32,6 +32,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -41,6 +43,7 @@
 #include "lib/mgmt.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "src/shared/btsnoop.h"
 #include "src/shared/mainloop.h"
 
@@ -53,6 +56,46 @@
 static struct btsnoop *btsnoop_file = NULL;
 static bool hcidump_fallback = false;
 
+#define WRITER_BUFFER_SIZE	(256 * 1024)
+#define WRITER_FLUSH_INTERVAL	1000	/* ms */
+#define WRITER_SLOTS		512
+
+/*
+ * When a writer thread is used, packets are copied into a ring of slots and
+ * written to the btsnoop file from that thread, so that slow storage never
+ * delays reading from the monitor socket. Packets are dropped when the ring
+ * is full.
+ */
+struct writer_slot {
+	struct timeval tv;
+	uint16_t index;
+	uint16_t opcode;
+	uint16_t size;
+	uint8_t data[BTSNOOP_MAX_PACKET_SIZE];
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct writer_slot *slots;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int drops;
+	bool running;
+	bool stop;
+} writer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int flush_timeout = -1;
+
+static uint32_t reader_start;
+static uint64_t reader_offset;
+static uint32_t reader_count;
+static unsigned long reader_flags = BTSNOOP_FLAG_PKLG_SUPPORT;
+
 struct control_data {
 	uint16_t channel;
 	int fd;
@@ -899,6 +942,130 @@ void control_message(uint16_t opcode, const void *data, uint16_t size)
 	}
 }
 
+static void writer_queue(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	struct writer_slot *slot;
+
+	if (!tv || size > BTSNOOP_MAX_PACKET_SIZE)
+		return;
+
+	pthread_mutex_lock(&writer.lock);
+
+	if (writer.head - writer.tail == WRITER_SLOTS) {
+		writer.drops++;
+		pthread_mutex_unlock(&writer.lock);
+		return;
+	}
+
+	slot = &writer.slots[writer.head % WRITER_SLOTS];
+	slot->tv = *tv;
+	slot->index = index;
+	slot->opcode = opcode;
+	slot->size = size;
+	memcpy(slot->data, data, size);
+
+	if (writer.head++ == writer.tail)
+		pthread_cond_signal(&writer.cond);
+
+	pthread_mutex_unlock(&writer.lock);
+}
+
+static void *writer_thread(void *user_data)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&writer.lock);
+
+	while (1) {
+		struct writer_slot *slot;
+
+		if (writer.head == writer.tail) {
+			if (writer.stop)
+				break;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += WRITER_FLUSH_INTERVAL / 1000;
+
+			/* Flush buffered packets once the capture is idle */
+			if (pthread_cond_timedwait(&writer.cond, &writer.lock,
+							&ts) == ETIMEDOUT) {
+				pthread_mutex_unlock(&writer.lock);
+				btsnoop_flush(btsnoop_file);
+				pthread_mutex_lock(&writer.lock);
+			}
+
+			continue;
+		}
+
+		/* The producer does not touch a slot until tail moves past */
+		slot = &writer.slots[writer.tail % WRITER_SLOTS];
+
+		pthread_mutex_unlock(&writer.lock);
+
+		btsnoop_write_hci(btsnoop_file, &slot->tv, slot->index,
+					slot->opcode, slot->data, slot->size);
+
+		pthread_mutex_lock(&writer.lock);
+
+		writer.tail++;
+	}
+
+	pthread_mutex_unlock(&writer.lock);
+
+	btsnoop_flush(btsnoop_file);
+
+	queue_pool_drain();
+
+	return NULL;
+}
+
+static bool writer_start(void)
+{
+	writer.slots = calloc(WRITER_SLOTS, sizeof(*writer.slots));
+	if (!writer.slots)
+		return false;
+
+	if (pthread_create(&writer.thread, NULL, writer_thread, NULL)) {
+		free(writer.slots);
+		writer.slots = NULL;
+		return false;
+	}
+
+	writer.running = true;
+
+	return true;
+}
+
+static void writer_stop(void)
+{
+	if (!writer.running)
+		return;
+
+	pthread_mutex_lock(&writer.lock);
+	writer.stop = true;
+	pthread_cond_signal(&writer.cond);
+	pthread_mutex_unlock(&writer.lock);
+
+	pthread_join(writer.thread, NULL);
+
+	writer.running = false;
+
+	if (writer.drops)
+		fprintf(stderr, "Dropped %u packets while writing traces\n",
+								writer.drops);
+
+	free(writer.slots);
+	writer.slots = NULL;
+}
+
+static void flush_callback(int id, void *user_data)
+{
+	btsnoop_flush(btsnoop_file);
+
+	mainloop_modify_timeout(id, WRITER_FLUSH_INTERVAL);
+}
+
 static void data_callback(int fd, uint32_t events, void *user_data)
 {
 	struct control_data *data = user_data;
@@ -957,8 +1124,12 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 			packet_control(tv, index, opcode, data->buf, pktlen);
 			break;
 		case HCI_CHANNEL_MONITOR:
-			btsnoop_write_hci(btsnoop_file, tv, index, opcode,
-							data->buf, pktlen);
+			if (writer.running)
+				writer_queue(tv, index, opcode, data->buf,
+								pktlen);
+			else
+				btsnoop_write_hci(btsnoop_file, tv, index,
+						opcode, data->buf, pktlen);
 			ellisys_inject_hci(tv, index, opcode,
 							data->buf, pktlen);
 			packet_monitor(tv, index, opcode, data->buf, pktlen);
@@ -1142,11 +1313,98 @@ void control_server(const char *path)
 	server_fd = fd;
 }
 
-bool control_writer(const char *path)
+bool control_writer(const char *path, bool thread)
 {
 	btsnoop_file = btsnoop_create(path, BTSNOOP_TYPE_MONITOR);
+	if (!btsnoop_file)
+		return false;
+
+	/*
+	 * Packets are buffered and written out when the buffer is full, when
+	 * the capture has been idle for the flush interval and on exit.
+	 */
+	if (!btsnoop_set_buffer(btsnoop_file, WRITER_BUFFER_SIZE,
+						WRITER_FLUSH_INTERVAL))
+		return true;
 
-	return !!btsnoop_file;
+	if (thread) {
+		if (writer_start())
+			return true;
+
+		fprintf(stderr, "Failed to start writer thread\n");
+	}
+
+	flush_timeout = mainloop_add_timeout(WRITER_FLUSH_INTERVAL,
+						flush_callback, NULL, NULL);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	writer_stop();
+
+	if (flush_timeout >= 0) {
+		mainloop_remove_timeout(flush_timeout);
+		flush_timeout = -1;
+	}
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+void control_set_window(uint32_t start, uint64_t offset, uint32_t count,
+							bool keep_index)
+{
+	reader_start = start;
+	reader_offset = offset;
+	reader_count = count;
+
+	if (keep_index)
+		reader_flags |= BTSNOOP_FLAG_PERSIST_INDEX;
+}
+
+static bool reader_seek(void)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	uint16_t index, opcode, pktlen;
+	struct timeval tv;
+
+	if (reader_start && !btsnoop_seek(btsnoop_file, reader_start)) {
+		fprintf(stderr, "Failed to seek to packet %u\n", reader_start);
+		return false;
+	}
+
+	if (!reader_offset)
+		return true;
+
+	/* The time offset is relative to the start packet */
+	if (!btsnoop_read_hci(btsnoop_file, &tv, &index, &opcode,
+							buf, &pktlen))
+		return false;
+
+	tv.tv_sec += reader_offset / 1000000;
+	tv.tv_usec += reader_offset % 1000000;
+
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
+
+	if (!btsnoop_seek_time(btsnoop_file, &tv)) {
+		fprintf(stderr, "Failed to seek to time offset\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool reader_done(void)
+{
+	if (!reader_count)
+		return false;
+
+	return btsnoop_tell(btsnoop_file) - reader_start >= reader_count;
 }
 
 void control_reader(const char *path)
@@ -1156,10 +1414,17 @@ void control_reader(const char *path)
 	uint32_t type;
 	struct timeval tv;
 
-	btsnoop_file = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	btsnoop_file = btsnoop_open(path, reader_flags);
 	if (!btsnoop_file)
 		return;
 
+	if (!reader_seek()) {
+		btsnoop_unref(btsnoop_file);
+		return;
+	}
+
+	reader_start = btsnoop_tell(btsnoop_file);
+
 	type = btsnoop_get_type(btsnoop_file);
 
 	switch (type) {
@@ -1180,7 +1445,7 @@ void control_reader(const char *path)
 	case BTSNOOP_TYPE_HCI:
 	case BTSNOOP_TYPE_UART:
 	case BTSNOOP_TYPE_MONITOR:
-		while (1) {
+		while (!reader_done()) {
 			uint16_t index, opcode;
 
 			if (!btsnoop_read_hci(btsnoop_file, &tv, &index,
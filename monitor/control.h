@@ -24,9 +24,12 @@
 
 #include <stdint.h>
 
-bool control_writer(const char *path);
+bool control_writer(const char *path, bool thread);
+void control_set_window(uint32_t start, uint64_t offset, uint32_t count,
+							bool keep_index);
 void control_reader(const char *path);
 void control_server(const char *path);
 int control_tracing(void);
+void control_cleanup(void);
 
 void control_message(uint16_t opcode, const void *data, uint16_t size);
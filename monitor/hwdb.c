@@ -27,8 +27,12 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "lib/bluetooth.h"
+
+#include "src/oui.h"
 #include "hwdb.h"
 
 #ifdef HAVE_UDEV_HWDB_NEW
@@ -77,61 +81,33 @@ done:
 
 	return result;
 }
+#else
+bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
+{
+	return false;
+}
+#endif
 
 bool hwdb_get_company(const uint8_t *bdaddr, char **company)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
-	struct udev_list_entry *head, *entry;
-	char modalias[11];
-	bool result;
+	const char *comp;
 
 	if (!bdaddr[2] && !bdaddr[1] && !bdaddr[0])
 		return false;
 
-	sprintf(modalias, "OUI:%2.2X%2.2X%2.2X",
-				bdaddr[5], bdaddr[4], bdaddr[3]);
+	comp = oui_get_company(bdaddr[5] << 16 | bdaddr[4] << 8 | bdaddr[3]);
 
-	udev = udev_new();
-	if (!udev)
-		return false;
+	*company = comp ? strdup(comp) : NULL;
 
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb) {
-		result = false;
-		goto done;
-	}
-
-	*company = NULL;
-
-	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
-
-	udev_list_entry_foreach(entry, head) {
-		const char *name = udev_list_entry_get_name(entry);
-
-		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE")) {
-			*company = strdup(udev_list_entry_get_value(entry));
-			break;
-		}
-	}
-
-	hwdb = udev_hwdb_unref(hwdb);
-
-	result = true;
-
-done:
-	udev = udev_unref(udev);
-
-	return result;
+	return true;
 }
-#else
-bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
+
+int hwdb_load_company_table(const char *path)
 {
-	return false;
+	return oui_preload(path);
 }
 
-bool hwdb_get_company(const uint8_t *bdaddr, char **company)
+void hwdb_cleanup(void)
 {
-	return false;
+	oui_cleanup();
 }
-#endif
@@ -27,3 +27,5 @@
 
 bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model);
 bool hwdb_get_company(const uint8_t *bdaddr, char **company);
+int hwdb_load_company_table(const char *path);
+void hwdb_cleanup(void);
@@ -34,6 +34,7 @@
 #include "lib/bluetooth.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "bt.h"
 #include "packet.h"
 #include "display.h"
@@ -87,9 +88,8 @@
 #define L2CAP_SAR_END		0x02
 #define L2CAP_SAR_CONTINUE	0x03
 
-#define MAX_CHAN 64
-
 struct chan_data {
+	uint16_t id;
 	uint16_t index;
 	uint16_t handle;
 	uint8_t ident;
@@ -101,115 +101,277 @@ struct chan_data {
 	uint8_t  ext_ctrl;
 };
 
-static struct chan_data chan_list[MAX_CHAN];
+struct frag_data {
+	void *buf;
+	uint16_t pos;
+	uint16_t len;
+	uint16_t cid;
+};
+
+struct conn_data {
+	struct queue *chans;
+	struct frag_data frag[2];
+};
+
+/*
+ * Channels and fragment reassembly state are kept per connection. Each
+ * controller has a table of connections indexed directly by the 12-bit
+ * handle, so lookups only have to walk the few channels of one link.
+ */
+#define MAX_HANDLE 0x1000
+
+struct index_data {
+	struct conn_data **conns;
+};
+
+static struct index_data *index_list;
+static unsigned int index_list_len;
+
+/* Channels moved to an AMP controller are also looked up by its index */
+static struct queue *amp_chans;
+
+static uint16_t next_chan_id;
+
+static struct conn_data *get_conn(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct index_data *data;
+	struct conn_data *conn;
+
+	handle &= MAX_HANDLE - 1;
+
+	if (index >= index_list_len) {
+		struct index_data *list;
+		unsigned int len;
+
+		if (!create)
+			return NULL;
+
+		len = index_list_len ? index_list_len : 16;
+		while (len <= index)
+			len *= 2;
+
+		if (len > UINT16_MAX + 1)
+			len = UINT16_MAX + 1;
+
+		list = realloc(index_list, len * sizeof(*list));
+		if (!list)
+			return NULL;
+
+		memset(list + index_list_len, 0,
+				(len - index_list_len) * sizeof(*list));
+
+		index_list = list;
+		index_list_len = len;
+	}
+
+	data = &index_list[index];
+
+	if (!data->conns) {
+		if (!create)
+			return NULL;
+
+		data->conns = calloc(MAX_HANDLE, sizeof(*data->conns));
+		if (!data->conns)
+			return NULL;
+	}
+
+	conn = data->conns[handle];
+	if (conn || !create)
+		return conn;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	conn->chans = queue_new();
+	data->conns[handle] = conn;
+
+	return conn;
+}
+
+static void chan_free(void *data)
+{
+	struct chan_data *chan = data;
+
+	if (chan->ctrlid)
+		queue_remove(amp_chans, chan);
+
+	free(chan);
+}
+
+static void clear_fragment_buffer(struct conn_data *conn, bool in)
+{
+	free(conn->frag[in].buf);
+	conn->frag[in].buf = NULL;
+	conn->frag[in].pos = 0;
+	conn->frag[in].len = 0;
+}
+
+void l2cap_release(uint16_t index, uint16_t handle)
+{
+	struct conn_data *conn;
+
+	conn = get_conn(index, handle, false);
+	if (!conn)
+		return;
+
+	index_list[index].conns[handle & (MAX_HANDLE - 1)] = NULL;
+
+	clear_fragment_buffer(conn, false);
+	clear_fragment_buffer(conn, true);
+	queue_destroy(conn->chans, chan_free);
+	free(conn);
+}
 
 static void assign_scid(const struct l2cap_frame *frame,
 				uint16_t scid, uint16_t psm, uint8_t ctrlid)
 {
-	int i, n = -1;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000)
-			n = i;
+	const struct queue_entry *entry;
+	struct chan_data *chan = NULL;
+	struct conn_data *conn;
 
-		if (chan_list[i].index != frame->index)
-			continue;
+	conn = get_conn(frame->index, frame->handle, true);
+	if (!conn)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (entry = queue_get_entries(conn->chans); entry;
+							entry = entry->next) {
+		struct chan_data *data = entry->data;
 
 		if (frame->in) {
-			if (chan_list[i].dcid == scid) {
-				n = i;
+			if (data->dcid == scid) {
+				chan = data;
 				break;
 			}
 		} else {
-			if (chan_list[i].scid == scid) {
-				n = i;
+			if (data->scid == scid) {
+				chan = data;
 				break;
 			}
 		}
 	}
 
-	if (n < 0)
-		return;
+	if (chan) {
+		if (chan->ctrlid)
+			queue_remove(amp_chans, chan);
+	} else {
+		chan = malloc(sizeof(*chan));
+		if (!chan)
+			return;
 
-	memset(&chan_list[n], 0, sizeof(chan_list[n]));
-	chan_list[n].index = frame->index;
-	chan_list[n].handle = frame->handle;
-	chan_list[n].ident = frame->ident;
+		if (!queue_push_tail(conn->chans, chan)) {
+			free(chan);
+			return;
+		}
+	}
+
+	memset(chan, 0, sizeof(*chan));
+	chan->id = next_chan_id++;
+	chan->index = frame->index;
+	chan->handle = frame->handle;
+	chan->ident = frame->ident;
 
 	if (frame->in)
-		chan_list[n].dcid = scid;
+		chan->dcid = scid;
 	else
-		chan_list[n].scid = scid;
+		chan->scid = scid;
+
+	chan->psm = psm;
+	chan->ctrlid = ctrlid;
+	chan->mode = 0;
 
-	chan_list[n].psm = psm;
-	chan_list[n].ctrlid = ctrlid;
-	chan_list[n].mode = 0;
+	if (ctrlid) {
+		if (!amp_chans)
+			amp_chans = queue_new();
+
+		queue_push_tail(amp_chans, chan);
+	}
 }
 
-static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
+static bool match_local_cid(const void *data, const void *user_data)
 {
-	int i;
+	const struct chan_data *chan = data;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	return chan->scid == PTR_TO_UINT(user_data);
+}
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+static bool match_remote_cid(const void *data, const void *user_data)
+{
+	const struct chan_data *chan = data;
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		}
-	}
+	return chan->dcid == PTR_TO_UINT(user_data);
+}
+
+/*
+ * Returns the channel of the connection the frame belongs to whose local
+ * (for received frames) or remote (for sent frames) CID matches.
+ */
+static struct chan_data *find_chan(const struct l2cap_frame *frame,
+								uint16_t cid)
+{
+	struct conn_data *conn;
+
+	conn = get_conn(frame->index, frame->handle, false);
+	if (!conn)
+		return NULL;
+
+	return queue_find(conn->chans, frame->in ? match_local_cid :
+					match_remote_cid, UINT_TO_PTR(cid));
+}
+
+static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
+{
+	struct chan_data *chan;
+	struct conn_data *conn;
+
+	chan = find_chan(frame, scid);
+	if (!chan)
+		return;
+
+	conn = get_conn(frame->index, frame->handle, false);
+	queue_remove(conn->chans, chan);
+	chan_free(chan);
 }
 
 static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 								uint16_t scid)
 {
-	int i;
+	const struct queue_entry *entry;
+	struct conn_data *conn;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	conn = get_conn(frame->index, frame->handle, false);
+	if (!conn)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (entry = queue_get_entries(conn->chans); entry;
+							entry = entry->next) {
+		struct chan_data *chan = entry->data;
 
-		if (frame->ident != 0 && chan_list[i].ident != frame->ident)
+		if (frame->ident != 0 && chan->ident != frame->ident)
 			continue;
 
 		if (frame->in) {
 			if (scid) {
-				if (chan_list[i].scid == scid) {
-					chan_list[i].dcid = dcid;
+				if (chan->scid == scid) {
+					chan->dcid = dcid;
 					break;
 				}
 			} else {
-				if (chan_list[i].scid && !chan_list[i].dcid) {
-					chan_list[i].dcid = dcid;
+				if (chan->scid && !chan->dcid) {
+					chan->dcid = dcid;
 					break;
 				}
 			}
 		} else {
 			if (scid) {
-				if (chan_list[i].dcid == scid) {
-					chan_list[i].scid = dcid;
+				if (chan->dcid == scid) {
+					chan->scid = dcid;
 					break;
 				}
 			} else {
-				if (chan_list[i].dcid && !chan_list[i].scid) {
-					chan_list[i].scid = dcid;
+				if (chan->dcid && !chan->scid) {
+					chan->scid = dcid;
 					break;
 				}
 			}
@@ -220,121 +382,93 @@ static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 static void assign_mode(const struct l2cap_frame *frame,
 					uint8_t mode, uint16_t dcid)
 {
-	int i;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
-
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	struct chan_data *chan;
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		}
-	}
+	chan = find_chan(frame, dcid);
+	if (chan)
+		chan->mode = mode;
 }
 
-static int get_chan_data_index(const struct l2cap_frame *frame)
+static bool match_frame_chan(const void *data, const void *user_data)
 {
-	int i;
+	const struct chan_data *chan = data;
+	const struct l2cap_frame *frame = user_data;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	if (chan->ctrlid != 0 && chan->ctrlid != frame->index)
+		return false;
 
-		if (chan_list[i].ctrlid != 0 &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+	if (chan->handle != frame->handle)
+		return false;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	if (frame->in)
+		return chan->scid == frame->cid;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return i;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return i;
-		}
-	}
+	return chan->dcid == frame->cid;
+}
+
+static struct chan_data *get_chan_data(const struct l2cap_frame *frame)
+{
+	struct chan_data *chan = NULL;
+	struct conn_data *conn;
+
+	conn = get_conn(frame->index, frame->handle, false);
+	if (conn)
+		chan = queue_find(conn->chans, match_frame_chan, frame);
+
+	if (!chan)
+		chan = queue_find(amp_chans, match_frame_chan, frame);
 
-	return -1;
+	return chan;
 }
 
 static uint16_t get_psm(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].psm;
+	return chan->psm;
 }
 
 static uint8_t get_mode(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].mode;
+	return chan->mode;
 }
 
 static uint16_t get_chan(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return i;
+	return chan->id;
 }
 
 static void assign_ext_ctrl(const struct l2cap_frame *frame,
 					uint8_t ext_ctrl, uint16_t dcid)
 {
-	int i;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
-
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	struct chan_data *chan;
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		}
-	}
+	chan = find_chan(frame, dcid);
+	if (chan)
+		chan->ext_ctrl = ext_ctrl;
 }
 
 static uint8_t get_ext_ctrl(const struct l2cap_frame *frame)
 {
-	int i = get_chan_data_index(frame);
+	struct chan_data *chan = get_chan_data(frame);
 
-	if (i < 0)
+	if (!chan)
 		return 0;
 
-	return chan_list[i].ext_ctrl;
+	return chan->ext_ctrl;
 }
 
 static char *sar2str(uint8_t sar)
@@ -440,25 +574,6 @@ static void l2cap_ctrl_parse(struct l2cap_frame *frame, uint32_t ctrl)
 		printf(" F-bit");
 }
 
-#define MAX_INDEX 16
-
-struct index_data {
-	void *frag_buf;
-	uint16_t frag_pos;
-	uint16_t frag_len;
-	uint16_t frag_cid;
-};
-
-static struct index_data index_list[MAX_INDEX][2];
-
-static void clear_fragment_buffer(uint16_t index, bool in)
-{
-	free(index_list[index][in].frag_buf);
-	index_list[index][in].frag_buf = NULL;
-	index_list[index][in].frag_pos = 0;
-	index_list[index][in].frag_len = 0;
-}
-
 static void print_psm(uint16_t psm)
 {
 	print_field("PSM: %d (0x%4.4x)", le16_to_cpu(psm), le16_to_cpu(psm));
@@ -3015,21 +3130,26 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 					const void *data, uint16_t size)
 {
 	const struct bt_l2cap_hdr *hdr = data;
+	struct conn_data *conn;
+	struct frag_data *frag;
 	uint16_t len, cid;
 
-	if (index > MAX_INDEX - 1) {
-		print_text(COLOR_ERROR, "controller index too large");
+	conn = get_conn(index, handle, true);
+	if (!conn) {
+		print_text(COLOR_ERROR, "failed connection allocation");
 		packet_hexdump(data, size);
 		return;
 	}
 
+	frag = &conn->frag[in];
+
 	switch (flags) {
 	case 0x00:	/* start of a non-automatically-flushable PDU */
 	case 0x02:	/* start of an automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected start frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(conn, in);
 			return;
 		}
 
@@ -3057,54 +3177,51 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 			return;
 		}
 
-		index_list[index][in].frag_buf = malloc(len);
-		if (!index_list[index][in].frag_buf) {
+		frag->buf = malloc(len);
+		if (!frag->buf) {
 			print_text(COLOR_ERROR, "failed buffer allocation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf, data, size);
-		index_list[index][in].frag_pos = size;
-		index_list[index][in].frag_len = len - size;
-		index_list[index][in].frag_cid = cid;
+		memcpy(frag->buf, data, size);
+		frag->pos = size;
+		frag->len = len - size;
+		frag->cid = cid;
 		break;
 
 	case 0x01:	/* continuing fragment */
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			print_text(COLOR_ERROR, "unexpected continuation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		if (size > index_list[index][in].frag_len) {
+		if (size > frag->len) {
 			print_text(COLOR_ERROR, "fragment too long");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(conn, in);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf +
-				index_list[index][in].frag_pos, data, size);
-		index_list[index][in].frag_pos += size;
-		index_list[index][in].frag_len -= size;
+		memcpy(frag->buf + frag->pos, data, size);
+		frag->pos += size;
+		frag->len -= size;
 
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			/* complete frame */
-			l2cap_frame(index, in, handle,
-					index_list[index][in].frag_cid,
-					index_list[index][in].frag_buf,
-					index_list[index][in].frag_pos);
-			clear_fragment_buffer(index, in);
+			l2cap_frame(index, in, handle, frag->cid,
+						frag->buf, frag->pos);
+			clear_fragment_buffer(conn, in);
 			return;
 		}
 		break;
 
 	case 0x03:	/* complete automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected complete frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(conn, in);
 			return;
 		}
 
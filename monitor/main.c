@@ -38,6 +38,7 @@
 #include "lmp.h"
 #include "keys.h"
 #include "analyze.h"
+#include "hwdb.h"
 #include "ellisys.h"
 #include "control.h"
 
@@ -58,8 +59,15 @@ static void usage(void)
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t-n, --number <num>     Start reading at packet number\n"
+		"\t-o, --offset <sec>     Start reading at time offset\n"
+		"\t-c, --count <num>      Read only given number of packets\n"
+		"\t-I, --keep-index       Keep packet index in <file>.idx\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-W, --write-thread     Save traces from a separate thread\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
+		"\t-j, --jobs <num>       Number of analyze threads\n"
+		"\t-O, --oui <file>       Preload company names from hwdb file\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-i, --index <num>      Show only specified controller\n"
 		"\t-t, --time             Show time instead of time offset\n"
@@ -71,8 +79,15 @@ static void usage(void)
 
 static const struct option main_options[] = {
 	{ "read",    required_argument, NULL, 'r' },
+	{ "number",  required_argument, NULL, 'n' },
+	{ "offset",  required_argument, NULL, 'o' },
+	{ "count",   required_argument, NULL, 'c' },
+	{ "keep-index", no_argument,    NULL, 'I' },
 	{ "write",   required_argument, NULL, 'w' },
+	{ "write-thread", no_argument,  NULL, 'W' },
 	{ "analyze", required_argument, NULL, 'a' },
+	{ "jobs",    required_argument, NULL, 'j' },
+	{ "oui",     required_argument, NULL, 'O' },
 	{ "server",  required_argument, NULL, 's' },
 	{ "index",   required_argument, NULL, 'i' },
 	{ "time",    no_argument,       NULL, 't' },
@@ -90,7 +105,13 @@ int main(int argc, char *argv[])
 	unsigned long filter_mask = 0;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	bool writer_thread = false;
+	uint32_t reader_start = 0, reader_count = 0;
+	uint64_t reader_offset = 0;
+	bool reader_index = false;
 	const char *analyze_path = NULL;
+	unsigned int analyze_jobs = 1;
+	const char *oui_path = NULL;
 	const char *ellisys_server = NULL;
 	unsigned short ellisys_port = 0;
 	const char *str;
@@ -104,7 +125,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "r:w:a:s:i:tTSE:vh",
+		opt = getopt_long(argc, argv, "r:n:o:c:Iw:Wa:j:O:s:i:tTSE:vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -113,12 +134,33 @@ int main(int argc, char *argv[])
 		case 'r':
 			reader_path = optarg;
 			break;
+		case 'n':
+			reader_start = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			reader_offset = strtod(optarg, NULL) * 1000000;
+			break;
+		case 'c':
+			reader_count = strtoul(optarg, NULL, 0);
+			break;
+		case 'I':
+			reader_index = true;
+			break;
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'W':
+			writer_thread = true;
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
+		case 'j':
+			analyze_jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 'O':
+			oui_path = optarg;
+			break;
 		case 's':
 			control_server(optarg);
 			break;
@@ -184,10 +226,15 @@ int main(int argc, char *argv[])
 
 	keys_setup();
 
+	if (oui_path && hwdb_load_company_table(oui_path) < 0) {
+		fprintf(stderr, "Failed to load '%s'\n", oui_path);
+		return EXIT_FAILURE;
+	}
+
 	packet_set_filter(filter_mask);
 
 	if (analyze_path) {
-		analyze_trace(analyze_path);
+		analyze_trace(analyze_path, analyze_jobs);
 		return EXIT_SUCCESS;
 	}
 
@@ -195,11 +242,13 @@ int main(int argc, char *argv[])
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
 
+		control_set_window(reader_start, reader_offset, reader_count,
+								reader_index);
 		control_reader(reader_path);
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, writer_thread)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -212,7 +261,11 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run();
 
+	control_cleanup();
+
 	keys_cleanup();
 
+	hwdb_cleanup();
+
 	return exit_status;
 }
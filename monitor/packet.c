@@ -85,51 +85,94 @@ static bool index_filter = false;
 static uint16_t index_number = 0;
 static uint16_t index_current = 0;
 
-#define MAX_CONN 16
+/*
+ * Controllers are tracked in a table that grows with the highest index seen.
+ * The type of each connection is kept in a per controller table indexed
+ * directly by the 12-bit connection handle, allocated on first use.
+ */
+#define MAX_HANDLE 0x1000
 
-struct conn_data {
-	uint16_t handle;
-	uint8_t  type;
+struct index_data {
+	uint8_t type;
+	uint8_t bdaddr[6];
+	uint8_t *conn_type;
 };
 
-static struct conn_data conn_list[MAX_CONN];
+static struct index_data *index_list;
+static unsigned int index_list_len;
+
+static struct index_data *get_index(uint16_t index, bool create)
+{
+	struct index_data *list;
+	unsigned int len;
+
+	if (index < index_list_len)
+		return &index_list[index];
+
+	if (!create)
+		return NULL;
+
+	len = index_list_len ? index_list_len : 16;
+	while (len <= index)
+		len *= 2;
+
+	if (len > UINT16_MAX + 1)
+		len = UINT16_MAX + 1;
+
+	list = realloc(index_list, len * sizeof(*list));
+	if (!list)
+		return NULL;
+
+	memset(list + index_list_len, 0,
+			(len - index_list_len) * sizeof(*list));
+
+	index_list = list;
+	index_list_len = len;
+
+	return &index_list[index];
+}
 
 static void assign_handle(uint16_t handle, uint8_t type)
 {
-	int i;
+	struct index_data *data;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == 0x0000) {
-			conn_list[i].handle = handle;
-			conn_list[i].type = type;
-			break;
-		}
+	data = get_index(index_current, true);
+	if (!data)
+		return;
+
+	if (!data->conn_type) {
+		data->conn_type = malloc(MAX_HANDLE);
+		if (!data->conn_type)
+			return;
+
+		memset(data->conn_type, 0xff, MAX_HANDLE);
 	}
+
+	data->conn_type[handle & (MAX_HANDLE - 1)] = type;
 }
 
 static void release_handle(uint16_t handle)
 {
-	int i;
+	struct index_data *data;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle) {
-			conn_list[i].handle = 0x0000;
-			conn_list[i].type = 0x00;
-			break;
-		}
-	}
+	l2cap_release(index_current, handle);
+
+	data = get_index(index_current, false);
+	if (!data || !data->conn_type)
+		return;
+
+	data->conn_type[handle & (MAX_HANDLE - 1)] = 0xff;
 }
 
 static uint8_t get_type(uint16_t handle)
 {
-	int i;
+	struct index_data *data;
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle)
-			return conn_list[i].type;
-	}
+	data = get_index(index_current, false);
+	if (!data || !data->conn_type)
+		return 0xff;
 
-	return 0xff;
+	return data->conn_type[handle & (MAX_HANDLE - 1)];
 }
 
 void packet_set_filter(unsigned long filter)
@@ -3661,19 +3704,11 @@ static int addr2str(const uint8_t *addr, char *str)
 			addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
 }
 
-#define MAX_INDEX 16
-
-struct index_data {
-	uint8_t type;
-	uint8_t bdaddr[6];
-};
-
-static struct index_data index_list[MAX_INDEX];
-
 void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
 {
 	const struct btsnoop_opcode_new_index *ni;
+	struct index_data *index_data;
 	char str[18], extra_str[24];
 
 	if (index_filter && index_number != index)
@@ -3688,17 +3723,19 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 	case BTSNOOP_OPCODE_NEW_INDEX:
 		ni = data;
 
-		if (index < MAX_INDEX) {
-			index_list[index].type = ni->type;
-			memcpy(index_list[index].bdaddr, ni->bdaddr, 6);
+		index_data = get_index(index, true);
+		if (index_data) {
+			index_data->type = ni->type;
+			memcpy(index_data->bdaddr, ni->bdaddr, 6);
 		}
 
 		addr2str(ni->bdaddr, str);
 		packet_new_index(tv, index, str, ni->type, ni->bus, ni->name);
 		break;
 	case BTSNOOP_OPCODE_DEL_INDEX:
-		if (index < MAX_INDEX)
-			addr2str(index_list[index].bdaddr, str);
+		index_data = get_index(index, false);
+		if (index_data)
+			addr2str(index_data->bdaddr, str);
 		else
 			sprintf(str, "00:00:00:00:00:00");
 
@@ -5453,11 +5490,17 @@ static void write_ext_inquiry_length_cmd(const void *data, uint8_t size)
 static void read_local_version_rsp(const void *data, uint8_t size)
 {
 	const struct bt_hci_rsp_read_local_version *rsp = data;
+	struct index_data *index_data;
+	uint8_t type = HCI_BREDR;
 
 	print_status(rsp->status);
 	print_hci_version(rsp->hci_ver, rsp->hci_rev);
 
-	switch (index_list[index_current].type) {
+	index_data = get_index(index_current, false);
+	if (index_data)
+		type = index_data->type;
+
+	switch (type) {
 	case HCI_BREDR:
 		print_lmp_version(rsp->lmp_ver, rsp->lmp_subver);
 		break;
@@ -7186,16 +7229,69 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
-static const char *get_supported_command(int bit)
+/*
+ * The decoder tables are scanned once to build direct lookup tables, so
+ * finding the decoder of a packet does not depend on the table size.
+ * Opcodes are indexed by OGF page and OCF, pages are only allocated for
+ * OGFs that actually appear in the table.
+ */
+#define OPCODE_OCF_MAX	0x0400
+#define OPCODE_BIT_MAX	(64 * 8)
+
+static const struct opcode_data **opcode_pages[64];
+static const struct opcode_data *opcode_bits[OPCODE_BIT_MAX];
+static bool opcode_index_done;
+
+static void opcode_index_setup(void)
 {
 	int i;
 
+	opcode_index_done = true;
+
 	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].bit == bit)
-			return opcode_table[i].str;
+		const struct opcode_data *data = &opcode_table[i];
+		uint16_t ogf = cmd_opcode_ogf(data->opcode);
+		uint16_t ocf = cmd_opcode_ocf(data->opcode);
+
+		if (!opcode_pages[ogf]) {
+			opcode_pages[ogf] = calloc(OPCODE_OCF_MAX,
+						sizeof(*opcode_pages[ogf]));
+			if (!opcode_pages[ogf])
+				continue;
+		}
+
+		if (!opcode_pages[ogf][ocf])
+			opcode_pages[ogf][ocf] = data;
+
+		if (data->bit >= 0 && data->bit < OPCODE_BIT_MAX &&
+						!opcode_bits[data->bit])
+			opcode_bits[data->bit] = data;
 	}
+}
 
-	return NULL;
+static const struct opcode_data *find_opcode_data(uint16_t opcode)
+{
+	const struct opcode_data **page;
+
+	if (!opcode_index_done)
+		opcode_index_setup();
+
+	page = opcode_pages[cmd_opcode_ogf(opcode)];
+	if (!page)
+		return NULL;
+
+	return page[cmd_opcode_ocf(opcode)];
+}
+
+static const char *get_supported_command(int bit)
+{
+	if (!opcode_index_done)
+		opcode_index_setup();
+
+	if (bit < 0 || bit >= OPCODE_BIT_MAX || !opcode_bits[bit])
+		return NULL;
+
+	return opcode_bits[bit]->str;
 }
 
 static void inquiry_complete_evt(const void *data, uint8_t size)
@@ -7346,16 +7442,10 @@ static void cmd_complete_evt(const void *data, uint8_t size)
 	uint16_t opcode = le16_to_cpu(evt->opcode);
 	uint16_t ogf = cmd_opcode_ogf(opcode);
 	uint16_t ocf = cmd_opcode_ocf(opcode);
-	const struct opcode_data *opcode_data = NULL;
+	const struct opcode_data *opcode_data;
 	const char *opcode_color, *opcode_str;
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode_data(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -7416,16 +7506,10 @@ static void cmd_status_evt(const void *data, uint8_t size)
 	uint16_t opcode = le16_to_cpu(evt->opcode);
 	uint16_t ogf = cmd_opcode_ogf(opcode);
 	uint16_t ocf = cmd_opcode_ocf(opcode);
-	const struct opcode_data *opcode_data = NULL;
+	const struct opcode_data *opcode_data;
 	const char *opcode_color, *opcode_str;
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode_data(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -8211,20 +8295,35 @@ static const struct subevent_data subevent_table[] = {
 	{ }
 };
 
-static void le_meta_event_evt(const void *data, uint8_t size)
+static const struct subevent_data *subevent_index[256];
+static bool subevent_index_done;
+
+static const struct subevent_data *find_subevent_data(uint8_t subevent)
 {
-	uint8_t subevent = *((const uint8_t *) data);
-	const struct subevent_data *subevent_data = NULL;
-	const char *subevent_color, *subevent_str;
 	int i;
 
-	for (i = 0; subevent_table[i].str; i++) {
-		if (subevent_table[i].subevent == subevent) {
-			subevent_data = &subevent_table[i];
-			break;
+	if (!subevent_index_done) {
+		for (i = 0; subevent_table[i].str; i++) {
+			uint8_t id = subevent_table[i].subevent;
+
+			if (!subevent_index[id])
+				subevent_index[id] = &subevent_table[i];
 		}
+
+		subevent_index_done = true;
 	}
 
+	return subevent_index[subevent];
+}
+
+static void le_meta_event_evt(const void *data, uint8_t size)
+{
+	uint8_t subevent = *((const uint8_t *) data);
+	const struct subevent_data *subevent_data;
+	const char *subevent_color, *subevent_str;
+
+	subevent_data = find_subevent_data(subevent);
+
 	if (subevent_data) {
 		if (subevent_data->func)
 			subevent_color = COLOR_HCI_EVENT;
@@ -8429,6 +8528,27 @@ static const struct event_data event_table[] = {
 	{ }
 };
 
+static const struct event_data *event_index[256];
+static bool event_index_done;
+
+static const struct event_data *find_event_data(uint8_t event)
+{
+	int i;
+
+	if (!event_index_done) {
+		for (i = 0; event_table[i].str; i++) {
+			uint8_t id = event_table[i].event;
+
+			if (!event_index[id])
+				event_index[id] = &event_table[i];
+		}
+
+		event_index_done = true;
+	}
+
+	return event_index[event];
+}
+
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
@@ -8454,10 +8574,9 @@ void packet_hci_command(struct timeval *tv, uint16_t index,
 	uint16_t opcode = le16_to_cpu(hdr->opcode);
 	uint16_t ogf = cmd_opcode_ogf(opcode);
 	uint16_t ocf = cmd_opcode_ocf(opcode);
-	const struct opcode_data *opcode_data = NULL;
+	const struct opcode_data *opcode_data;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25];
-	int i;
 
 	if (size < HCI_COMMAND_HDR_SIZE) {
 		sprintf(extra_str, "(len %d)", size);
@@ -8470,12 +8589,7 @@ void packet_hci_command(struct timeval *tv, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode_data(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -8531,10 +8645,9 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
 	const hci_event_hdr *hdr = data;
-	const struct event_data *event_data = NULL;
+	const struct event_data *event_data;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	if (size < HCI_EVENT_HDR_SIZE) {
 		sprintf(extra_str, "(len %d)", size);
@@ -8547,12 +8660,7 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event_data(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
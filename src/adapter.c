@@ -88,6 +88,7 @@
 #define IDLE_DISCOV_TIMEOUT (5)
 #define TEMP_DEV_TIMEOUT (3 * 60)
 #define BONDING_TIMEOUT (2 * 60)
+#define MGMT_MAX_PENDING 16
 
 #define SCAN_TYPE_BREDR (1 << BDADDR_BREDR)
 #define SCAN_TYPE_LE ((1 << BDADDR_LE_PUBLIC) | (1 << BDADDR_LE_RANDOM))
@@ -221,6 +222,8 @@ struct btd_adapter {
 	struct mgmt_cp_start_service_discovery *current_discovery_filter;
 
 	GSList *discovery_found;	/* list of found devices */
+	GHashTable *found_set;		/* discovery_found lookup */
+	GHashTable *adv_cache;		/* last report of found devices */
 	guint discovery_idle_timeout;	/* timeout between discovery runs */
 	guint passive_scan_timeout;	/* timeout between passive scans */
 	guint temp_devices_timeout;	/* timeout for temporary devices */
@@ -230,7 +233,9 @@ struct btd_adapter {
 	GQueue *auths;			/* Ongoing and pending auths */
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
+	GHashTable *connected_set;	/* connections lookup */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *device_index;	/* devices by bdaddr */
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
@@ -766,6 +771,81 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+	guint top = bdaddr->b[3] ^ bdaddr->b[4] ^ bdaddr->b[5];
+
+	return bdaddr->b[0] | bdaddr->b[1] << 8 | bdaddr->b[2] << 16 |
+								top << 24;
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+/*
+ * The device index maps an address to the list of devices using it, in
+ * the order they were added. Usually that is a single device, but for
+ * instance a BR/EDR and an LE random address might be identical.
+ */
+static void device_index_add(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	GSList *list;
+
+	list = g_hash_table_lookup(adapter->device_index, bdaddr);
+	if (list) {
+		list = g_slist_append(list, device);
+		return;
+	}
+
+	list = g_slist_append(NULL, device);
+	g_hash_table_insert(adapter->device_index,
+				g_memdup(bdaddr, sizeof(*bdaddr)), list);
+}
+
+static void device_index_remove(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	GSList *list, *head;
+
+	head = g_hash_table_lookup(adapter->device_index, bdaddr);
+	if (!head)
+		return;
+
+	list = g_slist_remove(head, device);
+	if (!list)
+		g_hash_table_remove(adapter->device_index, bdaddr);
+	else if (list != head)
+		g_hash_table_insert(adapter->device_index,
+				g_memdup(bdaddr, sizeof(*bdaddr)), list);
+}
+
+static gboolean device_index_free(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	g_slist_free(value);
+
+	return TRUE;
+}
+
+static void device_index_clear(struct btd_adapter *adapter)
+{
+	g_hash_table_foreach_remove(adapter->device_index,
+						device_index_free, NULL);
+}
+
+static void adapter_add_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	adapter->devices = g_slist_append(adapter->devices, device);
+	device_index_add(adapter, device);
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
@@ -780,8 +860,8 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
+	list = g_hash_table_lookup(adapter->device_index, dst);
+	list = g_slist_find_custom(list, &addr, device_addr_type_cmp);
 	if (!list)
 		return NULL;
 
@@ -1101,7 +1181,7 @@ static struct btd_device *adapter_create_device(struct btd_adapter *adapter,
 	if (!device)
 		return NULL;
 
-	adapter->devices = g_slist_append(adapter->devices, device);
+	adapter_add_device(adapter, device);
 
 	return device;
 }
@@ -1137,11 +1217,15 @@ void btd_adapter_remove_device(struct btd_adapter *adapter,
 	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
 
 	adapter->devices = g_slist_remove(adapter->devices, dev);
+	device_index_remove(adapter, dev);
 
 	adapter->discovery_found = g_slist_remove(adapter->discovery_found,
 									dev);
+	g_hash_table_remove(adapter->found_set, dev);
+	g_hash_table_remove(adapter->adv_cache, dev);
 
 	adapter->connections = g_slist_remove(adapter->connections, dev);
+	g_hash_table_remove(adapter->connected_set, dev);
 
 	if (adapter->connect_le == dev)
 		adapter->connect_le = NULL;
@@ -1688,11 +1772,38 @@ static void invalidate_rssi_and_tx_power(gpointer a)
 	device_set_tx_power(dev, 127);
 }
 
+/*
+ * Last advertising or inquiry report seen for a device. Identical
+ * reports, which is what most devices keep sending, are not parsed and
+ * applied again. Only the RSSI and the found state are updated then.
+ */
+struct adv_cache {
+	uint8_t bdaddr_type;
+	uint32_t hash;
+	uint8_t *data;
+	uint8_t len;
+	int8_t tx_power;
+	GSList *services;
+	bool applied;
+	gint64 rssi_time;
+};
+
+static void adv_cache_free(gpointer data)
+{
+	struct adv_cache *cache = data;
+
+	g_slist_free_full(cache->services, free);
+	g_free(cache->data);
+	g_free(cache);
+}
+
 static void discovery_cleanup(struct btd_adapter *adapter)
 {
 	g_slist_free_full(adapter->discovery_found,
 						invalidate_rssi_and_tx_power);
 	adapter->discovery_found = NULL;
+	g_hash_table_remove_all(adapter->found_set);
+	g_hash_table_remove_all(adapter->adv_cache);
 }
 
 static gboolean remove_temp_devices(gpointer user_data)
@@ -3186,7 +3297,7 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 		key->pin_len = info->pin_len;
 	}
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
+	id = mgmt_send_unordered(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
 				adapter->dev_id, cp_size, cp,
 				load_link_keys_complete, adapter, NULL);
 
@@ -3280,7 +3391,7 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 		key->enc_size = info->enc_size;
 	}
 
-	adapter->load_ltks_id = mgmt_send(adapter->mgmt,
+	adapter->load_ltks_id = mgmt_send_unordered(adapter->mgmt,
 					MGMT_OP_LOAD_LONG_TERM_KEYS,
 					adapter->dev_id, cp_size, cp,
 					load_ltks_complete, adapter, NULL);
@@ -3363,8 +3474,9 @@ static void load_irks(struct btd_adapter *adapter, GSList *irks)
 		memcpy(irk->val, info->val, sizeof(irk->val));
 	}
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_IRKS, adapter->dev_id,
-			cp_size, cp, load_irks_complete, adapter, NULL);
+	id = mgmt_send_unordered(adapter->mgmt, MGMT_OP_LOAD_IRKS,
+				adapter->dev_id, cp_size, cp,
+				load_irks_complete, adapter, NULL);
 
 	g_free(cp);
 
@@ -3427,8 +3539,9 @@ static void load_conn_params(struct btd_adapter *adapter, GSList *params)
 		param->timeout = htobs(info->timeout);
 	}
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_CONN_PARAM, adapter->dev_id,
-			cp_size, cp, load_conn_params_complete, adapter, NULL);
+	id = mgmt_send_unordered(adapter->mgmt, MGMT_OP_LOAD_CONN_PARAM,
+				adapter->dev_id, cp_size, cp,
+				load_conn_params_complete, adapter, NULL);
 
 	g_free(cp);
 
@@ -3478,6 +3591,9 @@ static void load_devices(struct btd_adapter *adapter)
 		return;
 	}
 
+	if (main_opts.storage_index)
+		storage_index_open(srcaddr);
+
 	while ((entry = readdir(dir)) != NULL) {
 		struct btd_device *device;
 		char filename[PATH_MAX];
@@ -3487,6 +3603,7 @@ static void load_devices(struct btd_adapter *adapter)
 		struct irk_info *irk_info;
 		struct conn_param *param;
 		uint8_t bdaddr_type;
+		bdaddr_t bdaddr;
 
 		if (entry->d_type == DT_UNKNOWN)
 			entry->d_type = util_get_dt(dirname, entry->d_name);
@@ -3498,7 +3615,7 @@ static void load_devices(struct btd_adapter *adapter)
 				entry->d_name);
 
 		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		storage_load_key_file(key_file, filename);
 
 		key_info = get_key_info(key_file, entry->d_name);
 		if (key_info)
@@ -3517,8 +3634,9 @@ static void load_devices(struct btd_adapter *adapter)
 		if (param)
 			params = g_slist_append(params, param);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
+		str2ba(entry->d_name, &bdaddr);
+
+		list = g_hash_table_lookup(adapter->device_index, &bdaddr);
 		if (list) {
 			device = list->data;
 			goto device_exist;
@@ -3530,7 +3648,7 @@ static void load_devices(struct btd_adapter *adapter)
 			goto free;
 
 		btd_device_set_temporary(device, false);
-		adapter->devices = g_slist_append(adapter->devices, device);
+		adapter_add_device(adapter, device);
 
 		/* TODO: register services from pre-loaded list of primaries */
 
@@ -3555,6 +3673,9 @@ free:
 
 	closedir(dir);
 
+	/* Later lookups go to the keyfiles, only keep appending updates */
+	storage_index_release(srcaddr);
+
 	load_link_keys(adapter, keys, main_opts.debug_keys);
 	g_slist_free_full(keys, g_free);
 
@@ -3689,12 +3810,13 @@ static void adapter_add_connection(struct btd_adapter *adapter,
 {
 	device_add_connection(device, bdaddr_type);
 
-	if (g_slist_find(adapter->connections, device)) {
+	if (g_hash_table_contains(adapter->connected_set, device)) {
 		error("Device is already marked as connected");
 		return;
 	}
 
 	adapter->connections = g_slist_append(adapter->connections, device);
+	g_hash_table_add(adapter->connected_set, device);
 }
 
 static void get_connections_complete(uint8_t status, uint16_t length,
@@ -4200,6 +4322,11 @@ static void adapter_free(gpointer user_data)
 	sdp_list_free(adapter->services, NULL);
 
 	g_slist_free(adapter->connections);
+	g_hash_table_destroy(adapter->connected_set);
+	g_hash_table_destroy(adapter->found_set);
+	g_hash_table_destroy(adapter->adv_cache);
+	device_index_clear(adapter);
+	g_hash_table_destroy(adapter->device_index);
 
 	g_free(adapter->path);
 	g_free(adapter->name);
@@ -5148,6 +5275,13 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 
+	adapter->device_index = g_hash_table_new_full(bdaddr_hash,
+						bdaddr_equal, g_free, NULL);
+	adapter->found_set = g_hash_table_new(NULL, NULL);
+	adapter->adv_cache = g_hash_table_new_full(NULL, NULL, NULL,
+							adv_cache_free);
+	adapter->connected_set = g_hash_table_new(NULL, NULL);
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -5155,6 +5289,7 @@ static void adapter_remove(struct btd_adapter *adapter)
 {
 	GSList *l;
 	struct gatt_db *db;
+	char addr[18];
 
 	DBG("Removing adapter %s", adapter->path);
 
@@ -5178,6 +5313,10 @@ static void adapter_remove(struct btd_adapter *adapter)
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
+	device_index_clear(adapter);
+
+	ba2str(&adapter->bdaddr, addr);
+	storage_index_close(addr);
 
 	unload_drivers(adapter);
 
@@ -5371,6 +5510,80 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 	return got_match;
 }
 
+static uint32_t adv_hash(const uint8_t *data, uint8_t len)
+{
+	uint32_t hash = 2166136261u;
+	uint8_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static struct adv_cache *adv_cache_lookup(struct btd_adapter *adapter,
+					struct btd_device *dev,
+					uint8_t bdaddr_type, uint32_t hash,
+					const uint8_t *data, uint8_t len)
+{
+	struct adv_cache *cache;
+
+	cache = g_hash_table_lookup(adapter->adv_cache, dev);
+	if (!cache)
+		return NULL;
+
+	if (cache->bdaddr_type != bdaddr_type || cache->hash != hash ||
+				cache->len != len || memcmp(cache->data, data, len))
+		return NULL;
+
+	return cache;
+}
+
+/* Takes over the services parsed into eir_data */
+static struct adv_cache *adv_cache_store(struct btd_adapter *adapter,
+					struct btd_device *dev,
+					uint8_t bdaddr_type, uint32_t hash,
+					const uint8_t *data, uint8_t len,
+					struct eir_data *eir_data)
+{
+	struct adv_cache *cache;
+
+	cache = g_new0(struct adv_cache, 1);
+	cache->bdaddr_type = bdaddr_type;
+	cache->hash = hash;
+	cache->data = g_memdup(data, len);
+	cache->len = len;
+	cache->tx_power = eir_data->tx_power;
+	cache->services = eir_data->services;
+	eir_data->services = NULL;
+
+	g_hash_table_replace(adapter->adv_cache, dev, cache);
+
+	return cache;
+}
+
+static void update_found_rssi(struct btd_adapter *adapter,
+						struct btd_device *dev,
+						struct adv_cache *cache,
+						int8_t rssi, bool throttle)
+{
+	gint64 now = g_get_monotonic_time();
+
+	/* Limit how often identical reports may update the RSSI */
+	if (throttle && main_opts.rssi_interval &&
+			now - cache->rssi_time < main_opts.rssi_interval * 1000)
+		return;
+
+	cache->rssi_time = now;
+
+	if (adapter->filtered_discovery)
+		device_set_rssi_with_delta(dev, rssi, 0);
+	else
+		device_set_rssi(dev, rssi);
+}
+
 static void update_found_devices(struct btd_adapter *adapter,
 					const bdaddr_t *bdaddr,
 					uint8_t bdaddr_type, int8_t rssi,
@@ -5380,11 +5593,53 @@ static void update_found_devices(struct btd_adapter *adapter,
 {
 	struct btd_device *dev;
 	struct eir_data eir_data;
+	struct adv_cache *cache = NULL;
 	bool name_known, discoverable;
+	uint32_t hash;
 	char addr[18];
 
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+
+	/*
+	 * If no client has requested discovery, then do not create new
+	 * device objects and there is nothing else to do.
+	 */
+	if (!dev && !adapter->discovery_list)
+		return;
+
+	hash = adv_hash(data, data_len);
+
+	/* Manufacturer data watchers need to see every report */
+	if (dev && !adapter->msd_callbacks)
+		cache = adv_cache_lookup(adapter, dev, bdaddr_type, hash,
+							data, data_len);
+
+	if (cache) {
+		device_update_last_seen(dev, bdaddr_type);
+
+		if (device_is_temporary(dev) && !adapter->discovery_list)
+			return;
+
+		memset(&eir_data, 0, sizeof(eir_data));
+		eir_data.services = cache->services;
+		eir_data.tx_power = cache->tx_power;
+
+		if (adapter->filtered_discovery &&
+				!is_filter_match(adapter->discovery_list,
+							&eir_data, rssi))
+			return;
+
+		if (cache->applied) {
+			device_set_legacy(dev, legacy);
+			update_found_rssi(adapter, dev, cache, rssi, true);
+			name_known = device_name_known(dev);
+			goto found;
+		}
+	}
+
+	/* Cheap parse first, most reports get dropped based on it */
 	memset(&eir_data, 0, sizeof(eir_data));
-	eir_parse(&eir_data, data, data_len);
+	eir_parse_basic(&eir_data, data, data_len);
 
 	if (bdaddr_type == BDADDR_BREDR)
 		discoverable = true;
@@ -5393,14 +5648,12 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	ba2str(bdaddr, addr);
 
-	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
 	if (!dev) {
 		/*
-		 * If no client has requested discovery or the device is
-		 * not marked as discoverable, then do not create new
-		 * device objects.
+		 * If the device is not marked as discoverable, then do not
+		 * create new device objects.
 		 */
-		if (!adapter->discovery_list || !discoverable) {
+		if (!discoverable) {
 			eir_data_free(&eir_data);
 			return;
 		}
@@ -5426,9 +5679,6 @@ static void update_found_devices(struct btd_adapter *adapter,
 					!(eir_data.flags & EIR_BREDR_UNSUP))
 		device_set_bredr_support(dev);
 
-	if (eir_data.name != NULL && eir_data.name_complete)
-		device_store_cached_name(dev, eir_data.name);
-
 	/*
 	 * If no client has requested discovery, then only update
 	 * already paired devices (skip temporary ones).
@@ -5440,16 +5690,25 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	if (adapter->filtered_discovery &&
 	    !is_filter_match(adapter->discovery_list, &eir_data, rssi)) {
+		adv_cache_store(adapter, dev, bdaddr_type, hash, data,
+							data_len, &eir_data);
 		eir_data_free(&eir_data);
 		return;
 	}
 
+	cache = adv_cache_store(adapter, dev, bdaddr_type, hash, data,
+							data_len, &eir_data);
+	eir_data_free(&eir_data);
+
+	memset(&eir_data, 0, sizeof(eir_data));
+	eir_parse(&eir_data, data, data_len);
+
+	if (eir_data.name != NULL && eir_data.name_complete)
+		device_store_cached_name(dev, eir_data.name);
+
 	device_set_legacy(dev, legacy);
 
-	if (adapter->filtered_discovery)
-		device_set_rssi_with_delta(dev, rssi, 0);
-	else
-		device_set_rssi(dev, rssi);
+	update_found_rssi(adapter, dev, cache, rssi, false);
 
 	if (eir_data.tx_power != 127)
 		device_set_tx_power(dev, eir_data.tx_power);
@@ -5486,6 +5745,9 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	eir_data_free(&eir_data);
 
+	cache->applied = true;
+
+found:
 	/*
 	 * Only if at least one client has requested discovery, maintain
 	 * list of found devices and name confirming for legacy devices.
@@ -5495,7 +5757,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (!adapter->discovery_list)
 		goto connect_le;
 
-	if (g_slist_find(adapter->discovery_found, dev))
+	if (g_hash_table_contains(adapter->found_set, dev))
 		return;
 
 	if (confirm)
@@ -5503,6 +5765,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	adapter->discovery_found = g_slist_prepend(adapter->discovery_found,
 									dev);
+	g_hash_table_add(adapter->found_set, dev);
 
 	return;
 
@@ -5593,7 +5856,7 @@ static void adapter_remove_connection(struct btd_adapter *adapter,
 {
 	DBG("");
 
-	if (!g_slist_find(adapter->connections, device)) {
+	if (!g_hash_table_contains(adapter->connected_set, device)) {
 		error("No matching connection for device");
 		return;
 	}
@@ -5608,6 +5871,7 @@ static void adapter_remove_connection(struct btd_adapter *adapter,
 		return;
 
 	adapter->connections = g_slist_remove(adapter->connections, device);
+	g_hash_table_remove(adapter->connected_set, device);
 
 	if (device_is_temporary(device) && !device_is_retrying(device)) {
 		const char *path = device_get_path(device);
@@ -5831,7 +6095,7 @@ static int adapter_authorize(struct btd_adapter *adapter, const bdaddr_t *dst,
 	}
 
 	/* Device connected? */
-	if (!g_slist_find(adapter->connections, device))
+	if (!g_hash_table_contains(adapter->connected_set, device))
 		error("Authorization request for non-connected device!?");
 
 	auth = g_try_new0(struct service_auth, 1);
@@ -6666,7 +6930,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -6679,7 +6943,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -6756,7 +7020,7 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -6776,7 +7040,7 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -6888,7 +7152,7 @@ static void store_csrk(const bdaddr_t *local, const bdaddr_t *peer,
 						adapter_addr, device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -6900,7 +7164,7 @@ static void store_csrk(const bdaddr_t *local, const bdaddr_t *peer,
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -6960,7 +7224,7 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
@@ -6970,7 +7234,7 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
+	storage_set_contents(filename, store_data, length);
 	g_free(store_data);
 
 	g_key_file_free(key_file);
@@ -7015,7 +7279,9 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 		return;
 	}
 
+	device_index_remove(adapter, device);
 	device_update_addr(device, &addr->bdaddr, addr->type);
+	device_index_add(adapter, device);
 
 	if (duplicate)
 		device_merge_duplicate(device, duplicate);
@@ -7049,7 +7315,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"MinInterval", min_interval);
@@ -7063,7 +7329,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
+	storage_set_contents(filename, store_data, length);
 	g_free(store_data);
 
 	g_key_file_free(key_file);
@@ -7622,7 +7888,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	if (type == BDADDR_BREDR) {
 		g_key_file_remove_group(key_file, "LinkKey", NULL);
@@ -7634,7 +7900,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	}
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8163,6 +8429,12 @@ int adapter_init(void)
 	if (getenv("MGMT_DEBUG"))
 		mgmt_set_debug(mgmt_master, mgmt_debug, "mgmt: ", NULL);
 
+	/*
+	 * Commands for different controllers and the order independent
+	 * key loading commands do not need to wait for each other.
+	 */
+	mgmt_set_pipeline(mgmt_master, MGMT_MAX_PENDING);
+
 	DBG("sending read version command");
 
 	if (mgmt_send(mgmt_master, MGMT_OP_READ_VERSION,
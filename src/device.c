@@ -385,7 +385,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 			device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -452,7 +452,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	storage_set_contents(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -509,11 +509,11 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	create_file(filename, S_IRUSR | S_IWUSR);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 	g_key_file_set_string(key_file, "General", "Name", name);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	storage_set_contents(filename, data, length);
 	g_free(data);
 
 	g_key_file_free(key_file);
@@ -1954,7 +1954,7 @@ static void store_services(struct btd_device *device)
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
+		storage_set_contents(filename, data, length);
 	}
 
 	free(prim_uuid);
@@ -1962,6 +1962,58 @@ static void store_services(struct btd_device *device)
 	g_key_file_free(key_file);
 }
 
+static void store_attribute(const char *key, const char *value,
+							void *user_data)
+{
+	GKeyFile *key_file = user_data;
+
+	g_key_file_set_string(key_file, "Attributes", key, value);
+}
+
+/*
+ * Stores the complete attribute cache of bonded devices so that discovery can
+ * be skipped on the following connections.
+ */
+static void store_gatt_db(struct btd_device *device)
+{
+	struct btd_adapter *adapter = device->adapter;
+	char filename[PATH_MAX];
+	char src_addr[18], dst_addr[18];
+	GKeyFile *key_file;
+	char *data;
+	gsize length = 0;
+
+	if (!device_is_bonded(device, device->bdaddr_type))
+		return;
+
+	if (device_address_is_private(device)) {
+		warn("Can't store GATT db for private addressed device %s",
+								device->path);
+		return;
+	}
+
+	ba2str(btd_adapter_get_address(adapter), src_addr);
+	ba2str(&device->bdaddr, dst_addr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", src_addr,
+								dst_addr);
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	key_file = g_key_file_new();
+	storage_load_key_file(key_file, filename);
+
+	/* Remove current attributes since they might have changed */
+	g_key_file_remove_group(key_file, "Attributes", NULL);
+
+	gatt_db_store(device->db, store_attribute, key_file);
+
+	data = g_key_file_to_data(key_file, &length, NULL);
+	storage_set_contents(filename, data, length);
+
+	g_free(data);
+	g_key_file_free(key_file);
+}
+
 static void browse_request_complete(struct browse_req *req, uint8_t bdaddr_type,
 									int err)
 {
@@ -2493,7 +2545,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	key_file = g_key_file_new();
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
+	if (!storage_load_key_file(key_file, filename))
 		goto failed;
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
@@ -2697,7 +2749,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 			peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 	groups = g_key_file_get_groups(key_file, NULL);
 
 	for (handle = groups; *handle; handle++) {
@@ -2766,6 +2818,47 @@ static void load_att_info(struct btd_device *device, const char *local,
 	free(prim_uuid);
 }
 
+static void load_gatt_db(struct btd_device *device, const char *local,
+							const char *peer)
+{
+	char **keys, **values, filename[PATH_MAX];
+	GKeyFile *key_file;
+	gsize i, len;
+
+	if (!device_is_bonded(device, device->bdaddr_type))
+		return;
+
+	DBG("Restoring %s gatt database from file", peer);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
+
+	key_file = g_key_file_new();
+	storage_load_key_file(key_file, filename);
+	keys = g_key_file_get_keys(key_file, "Attributes", &len, NULL);
+
+	if (!keys) {
+		warn("No cache for %s", peer);
+		g_key_file_free(key_file);
+		return;
+	}
+
+	values = g_new0(char *, len + 1);
+
+	for (i = 0; i < len; i++)
+		values[i] = g_key_file_get_string(key_file, "Attributes",
+								keys[i], NULL);
+
+	if (!gatt_db_load(device->db, keys, values))
+		warn("Unable to load gatt db from file for %s", peer);
+
+	for (i = 0; i < len; i++)
+		g_free(values[i]);
+
+	g_free(values);
+	g_strfreev(keys);
+	g_key_file_free(key_file);
+}
+
 static void device_register_primaries(struct btd_device *device,
 						GSList *prim_list, int psm)
 {
@@ -3196,6 +3289,7 @@ struct btd_device *device_create_from_storage(struct btd_adapter *adapter,
 
 	load_info(device, srcaddr, address, key_file);
 	load_att_info(device, srcaddr, address);
+	load_gatt_db(device, srcaddr, address);
 
 	return device;
 }
@@ -3479,18 +3573,20 @@ static void device_remove_stored(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", adapter_addr,
 			device_addr);
 	delete_folder_tree(filename);
+	storage_remove(filename);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", adapter_addr,
 			device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
+	g_key_file_remove_group(key_file, "Attributes", NULL);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
+		storage_set_contents(filename, data, length);
 	}
 
 	g_free(data);
@@ -3848,13 +3944,13 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 								dstaddr);
 
 	sdp_key_file = g_key_file_new();
-	g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+	storage_load_key_file(sdp_key_file, sdp_file);
 
 	snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes", srcaddr,
 								dstaddr);
 
 	att_key_file = g_key_file_new();
-	g_key_file_load_from_file(att_key_file, att_file, 0, NULL);
+	storage_load_key_file(att_key_file, att_file);
 
 	for (seq = recs; seq; seq = seq->next) {
 		sdp_record_t *rec = (sdp_record_t *) seq->data;
@@ -3919,7 +4015,7 @@ next:
 		data = g_key_file_to_data(sdp_key_file, &length, NULL);
 		if (length > 0) {
 			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
+			storage_set_contents(sdp_file, data, length);
 		}
 
 		g_free(data);
@@ -3930,7 +4026,7 @@ next:
 		data = g_key_file_to_data(att_key_file, &length, NULL);
 		if (length > 0) {
 			create_file(att_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(att_file, data, length, NULL);
+			storage_set_contents(att_file, data, length);
 		}
 
 		g_free(data);
@@ -4196,6 +4292,9 @@ static void gatt_client_ready_cb(bool success, uint8_t att_ecode,
 
 	device_accept_gatt_profiles(device);
 
+	if (!device->gatt_cache_used)
+		store_gatt_db(device);
+
 	btd_gatt_client_ready(device->client_dbus);
 
 	/*
@@ -4216,7 +4315,11 @@ static void gatt_client_service_changed(uint16_t start_handle,
 							uint16_t end_handle,
 							void *user_data)
 {
+	struct btd_device *device = user_data;
+
 	DBG("start 0x%04x, end: 0x%04x", start_handle, end_handle);
+
+	store_gatt_db(device);
 }
 
 static void gatt_debug(const char *str, void *user_data)
@@ -4228,7 +4331,16 @@ static void gatt_client_init(struct btd_device *device)
 {
 	gatt_client_cleanup(device);
 
-	device->client = bt_gatt_client_new(device->db, device->att,
+	/*
+	 * Bonded devices are required to indicate Service Changed so their
+	 * attribute cache can be used without discovering it again.
+	 */
+	if (device_is_bonded(device, device->bdaddr_type))
+		device->client = bt_gatt_client_new_from_cache(device->db,
+							device->att,
+							device->att_mtu);
+	else
+		device->client = bt_gatt_client_new(device->db, device->att,
 							device->att_mtu);
 	if (!device->client) {
 		DBG("Failed to initialize");
@@ -4761,6 +4873,10 @@ void device_set_bonded(struct btd_device *device, uint8_t bdaddr_type)
 		device->le_state.bonded = true;
 
 	btd_device_set_temporary(device, false);
+
+	/* Services may have been discovered before bonding completed */
+	if (bt_gatt_client_is_ready(device->client))
+		store_gatt_db(device);
 }
 
 void device_set_legacy(struct btd_device *device, bool legacy)
@@ -5519,7 +5635,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	storage_load_key_file(key_file, filename);
 	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
 
 	for (handle = keys; handle && *handle; handle++) {
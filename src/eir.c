@@ -226,7 +226,25 @@ static void eir_parse_uuid128_data(struct eir_data *eir, const uint8_t *data,
 	eir_parse_sd(eir, &service, data + 16, len - 16);
 }
 
-void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+static bool is_basic_field(uint8_t type)
+{
+	switch (type) {
+	case EIR_FLAGS:
+	case EIR_TX_POWER:
+	case EIR_UUID16_SOME:
+	case EIR_UUID16_ALL:
+	case EIR_UUID32_SOME:
+	case EIR_UUID32_ALL:
+	case EIR_UUID128_SOME:
+	case EIR_UUID128_ALL:
+		return true;
+	}
+
+	return false;
+}
+
+static void parse_fields(struct eir_data *eir, const uint8_t *eir_data,
+						uint8_t eir_len, bool full)
 {
 	uint16_t len = 0;
 
@@ -255,6 +273,11 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 		data = &eir_data[2];
 		data_len = field_len - 1;
 
+		if (!full && !is_basic_field(eir_data[1])) {
+			eir_data += field_len + 1;
+			continue;
+		}
+
 		switch (eir_data[1]) {
 		case EIR_UUID16_SOME:
 		case EIR_UUID16_ALL:
@@ -352,6 +375,21 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 	}
 }
 
+void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+{
+	parse_fields(eir, eir_data, eir_len, true);
+}
+
+/*
+ * Only parses the flags, TX power and service UUIDs, which is all that is
+ * needed to decide if a report is of any interest at all.
+ */
+void eir_parse_basic(struct eir_data *eir, const uint8_t *eir_data,
+							uint8_t eir_len)
+{
+	parse_fields(eir, eir_data, eir_len, false);
+}
+
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len)
 {
 
@@ -23,6 +23,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include <dbus/dbus.h>
 
@@ -37,6 +40,7 @@
 #include "adapter.h"
 #include "device.h"
 #include "src/shared/queue.h"
+#include "src/shared/io.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
@@ -92,6 +96,8 @@ struct characteristic {
 
 	struct queue *descs;
 
+	struct sock_io *write_io;
+
 	bool notifying;
 	struct queue *notify_clients;
 };
@@ -960,12 +966,196 @@ fail:
 	return btd_error_not_supported(msg);
 }
 
+/*
+ * Creates a SOCK_SEQPACKET pair for AcquireWrite/AcquireNotify. The local end
+ * is returned wrapped in an io and the remote end, which is handed over to
+ * the application, is stored in fd.
+ */
+static struct io *sock_io_new(int *fd)
+{
+	struct io *io;
+	int fds[2];
+
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+							0, fds) < 0) {
+		error("socketpair: %s (%d)", strerror(errno), errno);
+		return NULL;
+	}
+
+	io = io_new(fds[0]);
+	if (!io) {
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+
+	io_set_close_on_destroy(io, true);
+
+	*fd = fds[1];
+
+	return io;
+}
+
+static DBusMessage *create_sock_reply(DBusMessage *msg, int fd, uint16_t mtu)
+{
+	DBusMessage *reply;
+
+	reply = g_dbus_create_reply(msg, DBUS_TYPE_UNIX_FD, &fd,
+						DBUS_TYPE_UINT16, &mtu,
+						DBUS_TYPE_INVALID);
+
+	/* The message holds its own duplicate of the fd */
+	close(fd);
+
+	return reply;
+}
+
+struct sock_io {
+	struct characteristic *chrc;
+	char *owner;
+	guint watch;
+	struct io *io;
+};
+
+static void sock_io_free(struct sock_io *sock)
+{
+	DBG("owner %s", sock->owner);
+
+	g_dbus_remove_watch(btd_get_dbus_connection(), sock->watch);
+	io_destroy(sock->io);
+	free(sock->owner);
+	free(sock);
+}
+
+static void release_write_io(struct characteristic *chrc)
+{
+	if (!chrc->write_io)
+		return;
+
+	sock_io_free(chrc->write_io);
+	chrc->write_io = NULL;
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(), chrc->path,
+						GATT_CHARACTERISTIC_IFACE,
+						"WriteAcquired");
+}
+
+static void write_io_owner_disconnect(DBusConnection *conn, void *user_data)
+{
+	struct sock_io *sock = user_data;
+
+	release_write_io(sock->chrc);
+}
+
+static bool write_io_disconnected(struct io *io, void *user_data)
+{
+	struct sock_io *sock = user_data;
+
+	release_write_io(sock->chrc);
+
+	return false;
+}
+
+static bool write_io_read(struct io *io, void *user_data)
+{
+	struct sock_io *sock = user_data;
+	struct characteristic *chrc = sock->chrc;
+	struct bt_gatt_client *gatt = chrc->service->client->gatt;
+	uint8_t buf[BT_ATT_MAX_LE_MTU];
+	ssize_t len;
+
+	len = recv(io_get_fd(io), buf, sizeof(buf), MSG_DONTWAIT);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
+		release_write_io(chrc);
+		return false;
+	}
+
+	/* Peer closed its end */
+	if (len == 0) {
+		release_write_io(chrc);
+		return false;
+	}
+
+	/* Each datagram is sent as a single Write Command */
+	if (!gatt || !bt_gatt_client_write_without_response(gatt,
+					chrc->value_handle,
+					chrc->props & BT_GATT_CHRC_PROP_AUTH,
+					buf, len))
+		error("Failed to write %zd bytes to %s", len, chrc->path);
+
+	return true;
+}
+
+static DBusMessage *characteristic_acquire_write(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct characteristic *chrc = user_data;
+	struct bt_gatt_client *gatt = chrc->service->client->gatt;
+	const char *sender = dbus_message_get_sender(msg);
+	struct sock_io *sock;
+	DBusMessage *reply;
+	uint16_t mtu;
+	int fd;
+
+	if (!gatt)
+		return btd_error_failed(msg, "Not connected");
+
+	if (!(chrc->props & BT_GATT_CHRC_PROP_WRITE_WITHOUT_RESP))
+		return btd_error_not_supported(msg);
+
+	if (chrc->write_io)
+		return btd_error_not_permitted(msg, "Write acquired");
+
+	mtu = bt_gatt_client_get_mtu(gatt);
+	if (!mtu)
+		return btd_error_failed(msg, "No ATT transport");
+
+	sock = new0(struct sock_io, 1);
+	if (!sock)
+		return btd_error_failed(msg, "Failed to allocate write session");
+
+	sock->chrc = chrc;
+	sock->owner = strdup(sender);
+	sock->io = sock_io_new(&fd);
+	if (!sock->owner || !sock->io) {
+		io_destroy(sock->io);
+		free(sock->owner);
+		free(sock);
+		return btd_error_failed(msg, "Failed to create socket");
+	}
+
+	sock->watch = g_dbus_add_disconnect_watch(btd_get_dbus_connection(),
+					sender, write_io_owner_disconnect,
+					sock, NULL);
+
+	io_set_read_handler(sock->io, write_io_read, sock, NULL);
+	io_set_disconnect_handler(sock->io, write_io_disconnected, sock, NULL);
+
+	chrc->write_io = sock;
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(), chrc->path,
+						GATT_CHARACTERISTIC_IFACE,
+						"WriteAcquired");
+
+	/* The payload of a Write Command is limited to ATT_MTU - 3 */
+	reply = create_sock_reply(msg, fd, mtu - 3);
+	if (!reply)
+		release_write_io(chrc);
+
+	return reply;
+}
+
 struct notify_client {
 	struct characteristic *chrc;
 	int ref_count;
 	char *owner;
 	guint watch;
 	unsigned int notify_id;
+	struct io *io;		/* Set for AcquireNotify sessions */
+	int sock_fd;		/* Remote end until handed to the owner */
 };
 
 static void notify_client_free(struct notify_client *client)
@@ -975,6 +1165,11 @@ static void notify_client_free(struct notify_client *client)
 	g_dbus_remove_watch(btd_get_dbus_connection(), client->watch);
 	bt_gatt_client_unregister_notify(client->chrc->service->client->gatt,
 							client->notify_id);
+	io_destroy(client->io);
+
+	if (client->sock_fd >= 0)
+		close(client->sock_fd);
+
 	free(client->owner);
 	free(client);
 }
@@ -1047,6 +1242,7 @@ static struct notify_client *notify_client_create(struct characteristic *chrc,
 		return NULL;
 
 	client->chrc = chrc;
+	client->sock_fd = -1;
 	client->owner = strdup(owner);
 	if (!client->owner) {
 		free(client);
@@ -1080,6 +1276,20 @@ static void notify_cb(uint16_t value_handle, const uint8_t *value,
 	struct notify_client *client = op->data;
 	struct characteristic *chrc = client->chrc;
 
+	/* Acquired sessions get each value as a datagram, bypassing D-Bus */
+	if (client->io) {
+		struct iovec iov;
+
+		iov.iov_base = (void *) value;
+		iov.iov_len = length;
+
+		if (io_send(client->io, &iov, 1) < 0)
+			DBG("Failed to forward notification to %s",
+							client->owner);
+
+		return;
+	}
+
 	/*
 	 * Even if the value didn't change, we want to send a PropertiesChanged
 	 * signal so that we propagate the notification/indication to
@@ -1136,6 +1346,15 @@ static void register_notify_cb(uint16_t att_ecode, void *user_data)
 					"Notifying");
 	}
 
+	if (client->sock_fd >= 0 && op->msg) {
+		uint16_t mtu = bt_gatt_client_get_mtu(chrc->service->client->gatt);
+
+		/* Notification values are limited to ATT_MTU - 3 */
+		reply = create_sock_reply(op->msg, client->sock_fd, mtu - 3);
+		client->sock_fd = -1;
+		goto done;
+	}
+
 	reply = create_notify_reply(op, true, 0);
 
 done:
@@ -1216,6 +1435,81 @@ fail:
 	return btd_error_failed(msg, "Failed to register notify session");
 }
 
+static bool notify_io_disconnected(struct io *io, void *user_data)
+{
+	struct notify_client *client = user_data;
+
+	DBG("owner %s closed notification socket", client->owner);
+
+	notify_client_disconnect(btd_get_dbus_connection(), client);
+
+	return false;
+}
+
+static DBusMessage *characteristic_acquire_notify(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct characteristic *chrc = user_data;
+	struct bt_gatt_client *gatt = chrc->service->client->gatt;
+	const char *sender = dbus_message_get_sender(msg);
+	struct async_dbus_op *op;
+	struct notify_client *client;
+
+	if (!gatt)
+		return btd_error_failed(msg, "Not connected");
+
+	if (!(chrc->props & BT_GATT_CHRC_PROP_NOTIFY))
+		return btd_error_not_supported(msg);
+
+	/* Each client can only have one active notify session. */
+	client = queue_find(chrc->notify_clients, match_notify_sender, sender);
+	if (client)
+		return client->notify_id ?
+				btd_error_failed(msg, "Already notifying") :
+				btd_error_in_progress(msg);
+
+	client = notify_client_create(chrc, sender);
+	if (!client)
+		return btd_error_failed(msg, "Failed allocate notify session");
+
+	client->io = sock_io_new(&client->sock_fd);
+	if (!client->io) {
+		notify_client_free(client);
+		return btd_error_failed(msg, "Failed to create socket");
+	}
+
+	io_set_disconnect_handler(client->io, notify_io_disconnected, client,
+									NULL);
+
+	queue_push_tail(chrc->notify_clients, client);
+	queue_push_tail(chrc->service->client->all_notify_clients, client);
+
+	op = new0(struct async_dbus_op, 1);
+	if (!op)
+		goto fail;
+
+	op->data = client;
+	op->msg = dbus_message_ref(msg);
+
+	/* The socket is returned once notifications have been enabled */
+	client->notify_id = bt_gatt_client_register_notify(gatt,
+						chrc->value_handle,
+						register_notify_cb, notify_cb,
+						op, async_dbus_op_free);
+	if (client->notify_id)
+		return NULL;
+
+	async_dbus_op_free(op);
+
+fail:
+	queue_remove(chrc->notify_clients, client);
+	queue_remove(chrc->service->client->all_notify_clients, client);
+
+	notify_client_free(client);
+
+	return btd_error_failed(msg, "Failed to register notify session");
+}
+
 static DBusMessage *characteristic_stop_notify(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
@@ -1266,6 +1560,18 @@ static gboolean characteristic_get_descriptors(
 	return TRUE;
 }
 
+static gboolean characteristic_get_write_acquired(
+					const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct characteristic *chrc = data;
+	dbus_bool_t locked = chrc->write_io ? TRUE : FALSE;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_BOOLEAN, &locked);
+
+	return TRUE;
+}
+
 static const GDBusPropertyTable characteristic_properties[] = {
 	{ "UUID", "s", characteristic_get_uuid, NULL, NULL,
 					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
@@ -1280,6 +1586,8 @@ static const GDBusPropertyTable characteristic_properties[] = {
 					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
 	{ "Descriptors", "ao", characteristic_get_descriptors, NULL, NULL,
 					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
+	{ "WriteAcquired", "b", characteristic_get_write_acquired, NULL, NULL,
+					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
 	{ }
 };
 
@@ -1295,6 +1603,12 @@ static const GDBusMethodTable characteristic_methods[] = {
 						characteristic_start_notify) },
 	{ GDBUS_EXPERIMENTAL_METHOD("StopNotify", NULL, NULL,
 						characteristic_stop_notify) },
+	{ GDBUS_EXPERIMENTAL_METHOD("AcquireWrite", NULL,
+					GDBUS_ARGS({ "fd", "h" }, { "mtu", "q" }),
+					characteristic_acquire_write) },
+	{ GDBUS_EXPERIMENTAL_ASYNC_METHOD("AcquireNotify", NULL,
+					GDBUS_ARGS({ "fd", "h" }, { "mtu", "q" }),
+					characteristic_acquire_notify) },
 	{ }
 };
 
@@ -1393,6 +1707,8 @@ static void unregister_characteristic(void *data)
 	if (chrc->write_id)
 		bt_gatt_client_cancel(gatt, chrc->write_id);
 
+	release_write_io(chrc);
+
 	queue_remove_all(chrc->notify_clients, NULL, NULL, remove_client);
 	queue_remove_all(chrc->descs, NULL, NULL, unregister_descriptor);
 
@@ -1926,6 +2242,9 @@ static void cancel_chrc_ops(void *data, void *user_data)
 		chrc->write_id = 0;
 	}
 
+	/* Acquired sockets do not survive a disconnection */
+	release_write_io(chrc);
+
 	queue_foreach(chrc->descs, cancel_desc_ops, user_data);
 }
 
@@ -1936,6 +2255,28 @@ static void cancel_ops(void *data, void *user_data)
 	queue_foreach(service->chrcs, cancel_chrc_ops, user_data);
 }
 
+static bool match_acquired(const void *a, const void *b)
+{
+	const struct notify_client *client = a;
+
+	return client->io != NULL;
+}
+
+static void release_acquired(void *data)
+{
+	struct notify_client *client = data;
+	struct characteristic *chrc = client->chrc;
+
+	queue_remove(chrc->notify_clients, client);
+
+	/* Notifications are gone with the link, nothing to unregister */
+	client->notify_id = 0;
+
+	update_notifying(chrc);
+
+	notify_client_unref(client);
+}
+
 void btd_gatt_client_disconnected(struct btd_gatt_client *client)
 {
 	if (!client || !client->gatt)
@@ -1943,6 +2284,13 @@ void btd_gatt_client_disconnected(struct btd_gatt_client *client)
 
 	DBG("Device disconnected. Cleaning up.");
 
+	/*
+	 * Acquired sessions go away with their socket, release them while
+	 * the remaining sessions still count as notifying.
+	 */
+	queue_remove_all(client->all_notify_clients, match_acquired, NULL,
+							release_acquired);
+
 	/*
 	 * TODO: Once GATT over BR/EDR is properly supported, we should pass the
 	 * correct bdaddr_type based on the transport over which GATT is being
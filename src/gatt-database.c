@@ -893,6 +893,8 @@ struct notify {
 	const uint8_t *value;
 	uint16_t len;
 	bool indicate;
+	struct bt_gatt_server **servers;
+	unsigned int num_servers;
 };
 
 static void conf_cb(void *user_data)
@@ -925,11 +927,9 @@ static void send_notification_to_device(void *data, void *user_data)
 	 * notification/indication when it becomes connected.
 	 */
 	if (!notify->indicate) {
-		DBG("GATT server sending notification");
-		bt_gatt_server_send_notification(
-					btd_device_get_gatt_server(device),
-					notify->handle, notify->value,
-					notify->len);
+		/* Notifications are sent to all devices at once afterwards */
+		notify->servers[notify->num_servers++] =
+					btd_device_get_gatt_server(device);
 		return;
 	}
 
@@ -957,8 +957,28 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.len = len;
 	notify.indicate = indicate;
 
+	if (!indicate) {
+		notify.servers = new0(struct bt_gatt_server *,
+				queue_length(database->device_states) + 1);
+		if (!notify.servers)
+			return;
+	}
+
 	queue_foreach(database->device_states, send_notification_to_device,
 								&notify);
+
+	if (indicate)
+		return;
+
+	if (notify.num_servers) {
+		DBG("GATT server sending notification to %u devices",
+							notify.num_servers);
+		bt_gatt_server_broadcast_notification(notify.servers,
+						notify.num_servers, handle,
+						value, len);
+	}
+
+	free(notify.servers);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
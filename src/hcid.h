@@ -39,6 +39,9 @@ struct main_opts {
 	gboolean	name_resolv;
 	gboolean	debug_keys;
 	gboolean	fast_conn;
+	gboolean	storage_index;
+	uint16_t	storage_delay;
+	uint16_t	rssi_interval;
 
 	uint16_t	did_source;
 	uint16_t	did_vendor;
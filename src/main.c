@@ -58,6 +58,7 @@
 #include "agent.h"
 #include "profile.h"
 #include "systemd.h"
+#include "storage.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -88,6 +89,9 @@ static const char * const supported_options[] = {
 	"DebugKeys",
 	"ControllerMode",
 	"MultiProfile",
+	"StorageIndex",
+	"StorageDelay",
+	"RSSIUpdateInterval",
 };
 
 GKeyFile *btd_get_main_conf(void)
@@ -335,6 +339,30 @@ static void parse_config(GKeyFile *config)
 		g_clear_error(&err);
 	else
 		main_opts.fast_conn = boolean;
+
+	boolean = g_key_file_get_boolean(config, "General",
+						"StorageIndex", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		main_opts.storage_index = boolean;
+
+	val = g_key_file_get_integer(config, "General", "StorageDelay", &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		DBG("storage_delay=%d", val);
+		main_opts.storage_delay = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"RSSIUpdateInterval", &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		DBG("rssi_interval=%d", val);
+		main_opts.rssi_interval = val;
+	}
 }
 
 static void init_defaults(void)
@@ -675,6 +703,8 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	storage_cleanup();
+
 	rfkill_exit();
 
 	stop_sdp_server();
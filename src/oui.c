@@ -25,50 +25,373 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
 #include "lib/bluetooth.h"
 #include "oui.h"
 
 #ifdef HAVE_UDEV_HWDB_NEW
 #include <libudev.h>
+#endif
 
-char *batocomp(const bdaddr_t *ba)
+/*
+ * Company names are looked up by the 24-bit OUI of public addresses. The
+ * hardware database is opened only once and the most recently used
+ * results, including OUIs without an entry, are kept in a small cache
+ * with LRU replacement. Alternatively the complete table can be loaded
+ * from the hwdb source file, in which case it is used exclusively.
+ */
+#define OUI_CACHE_SIZE	512
+#define OUI_HASH_SIZE	1024
+
+struct oui_entry {
+	uint32_t oui;
+	char *company;
+	uint16_t hash_next;
+	uint16_t lru_prev;
+	uint16_t lru_next;
+};
+
+/* Entries are referenced by their position plus one, zero means none */
+static struct oui_entry cache[OUI_CACHE_SIZE];
+static uint16_t cache_hash[OUI_HASH_SIZE];
+static uint16_t cache_len;
+static uint16_t lru_head;
+static uint16_t lru_tail;
+
+struct oui_name {
+	uint32_t oui;
+	char *company;
+};
+
+static struct oui_name *oui_table;
+static size_t oui_table_len;
+
+#ifdef HAVE_UDEV_HWDB_NEW
+static struct udev *udev;
+static struct udev_hwdb *hwdb;
+static bool hwdb_failed;
+
+static char *hwdb_lookup(uint32_t oui)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
 	struct udev_list_entry *head, *entry;
-	char modalias[11], *comp = NULL;
+	char modalias[11];
 
-	sprintf(modalias, "OUI:%2.2X%2.2X%2.2X", ba->b[5], ba->b[4], ba->b[3]);
+	if (!hwdb) {
+		if (hwdb_failed)
+			return NULL;
 
-	udev = udev_new();
-	if (!udev)
-		return NULL;
+		udev = udev_new();
+		if (udev)
+			hwdb = udev_hwdb_new(udev);
 
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb)
-		goto done;
+		if (!hwdb) {
+			udev = udev_unref(udev);
+			hwdb_failed = true;
+			return NULL;
+		}
+	}
+
+	sprintf(modalias, "OUI:%6.6X", oui);
 
 	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
 
 	udev_list_entry_foreach(entry, head) {
 		const char *name = udev_list_entry_get_name(entry);
 
-		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE")) {
-			comp = strdup(udev_list_entry_get_value(entry));
-			break;
-		}
+		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE"))
+			return strdup(udev_list_entry_get_value(entry));
 	}
 
-	hwdb = udev_hwdb_unref(hwdb);
+	return NULL;
+}
+#else
+static char *hwdb_lookup(uint32_t oui)
+{
+	return NULL;
+}
+#endif
 
-done:
-	udev = udev_unref(udev);
+static inline unsigned int oui_hash(uint32_t oui)
+{
+	return (oui ^ (oui >> 10) ^ (oui >> 20)) & (OUI_HASH_SIZE - 1);
+}
+
+static void lru_unlink(uint16_t id)
+{
+	struct oui_entry *entry = &cache[id - 1];
 
-	return comp;
+	if (entry->lru_prev)
+		cache[entry->lru_prev - 1].lru_next = entry->lru_next;
+	else
+		lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		cache[entry->lru_next - 1].lru_prev = entry->lru_prev;
+	else
+		lru_tail = entry->lru_prev;
 }
-#else
-char *batocomp(const bdaddr_t *ba)
+
+static void lru_push_head(uint16_t id)
 {
+	struct oui_entry *entry = &cache[id - 1];
+
+	entry->lru_prev = 0;
+	entry->lru_next = lru_head;
+
+	if (lru_head)
+		cache[lru_head - 1].lru_prev = id;
+	else
+		lru_tail = id;
+
+	lru_head = id;
+}
+
+static void hash_unlink(uint16_t id)
+{
+	uint16_t *ptr = &cache_hash[oui_hash(cache[id - 1].oui)];
+
+	while (*ptr) {
+		if (*ptr == id) {
+			*ptr = cache[id - 1].hash_next;
+			return;
+		}
+
+		ptr = &cache[*ptr - 1].hash_next;
+	}
+}
+
+static struct oui_entry *cache_lookup(uint32_t oui)
+{
+	uint16_t id = cache_hash[oui_hash(oui)];
+
+	while (id) {
+		struct oui_entry *entry = &cache[id - 1];
+
+		if (entry->oui == oui) {
+			if (lru_head != id) {
+				lru_unlink(id);
+				lru_push_head(id);
+			}
+
+			return entry;
+		}
+
+		id = entry->hash_next;
+	}
+
 	return NULL;
 }
+
+static struct oui_entry *cache_add(uint32_t oui, char *company)
+{
+	struct oui_entry *entry;
+	unsigned int hash;
+	uint16_t id;
+
+	if (cache_len < OUI_CACHE_SIZE) {
+		id = ++cache_len;
+	} else {
+		/* Recycle the least recently used entry */
+		id = lru_tail;
+		lru_unlink(id);
+		hash_unlink(id);
+		free(cache[id - 1].company);
+	}
+
+	entry = &cache[id - 1];
+	entry->oui = oui;
+	entry->company = company;
+
+	hash = oui_hash(oui);
+	entry->hash_next = cache_hash[hash];
+	cache_hash[hash] = id;
+
+	lru_push_head(id);
+
+	return entry;
+}
+
+static int oui_name_cmp(const void *a, const void *b)
+{
+	const struct oui_name *name1 = a;
+	const struct oui_name *name2 = b;
+
+	if (name1->oui < name2->oui)
+		return -1;
+
+	return name1->oui > name2->oui;
+}
+
+const char *oui_get_company(uint32_t oui)
+{
+	struct oui_entry *entry;
+
+	if (oui_table) {
+		struct oui_name key = { .oui = oui }, *name;
+
+		name = bsearch(&key, oui_table, oui_table_len,
+					sizeof(*oui_table), oui_name_cmp);
+
+		return name ? name->company : NULL;
+	}
+
+	entry = cache_lookup(oui);
+	if (!entry)
+		entry = cache_add(oui, hwdb_lookup(oui));
+
+	return entry->company;
+}
+
+static bool parse_match(const char *line, uint32_t *oui)
+{
+	uint32_t val = 0;
+	int i;
+
+	if (strncmp(line, "OUI:", 4))
+		return false;
+
+	line += 4;
+
+	/* Only plain 24-bit assignments, not the longer MA-M/MA-S ones */
+	for (i = 0; i < 6; i++) {
+		if (!isxdigit(line[i]))
+			return false;
+
+		val = val << 4 | (isdigit(line[i]) ? line[i] - '0' :
+						toupper(line[i]) - 'A' + 10);
+	}
+
+	if (line[6] != '*')
+		return false;
+
+	*oui = val;
+
+	return true;
+}
+
+int oui_preload(const char *path)
+{
+	struct oui_name *table = NULL;
+	size_t len = 0, size = 0;
+	uint32_t oui = 0;
+	bool match = false;
+	char line[256];
+	FILE *fp;
+	int err;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return -errno;
+
+	while (fgets(line, sizeof(line), fp)) {
+		const char *value;
+		size_t n;
+
+		if (line[0] != ' ') {
+			match = parse_match(line, &oui);
+			continue;
+		}
+
+		if (!match)
+			continue;
+
+		value = line + strspn(line, " ");
+		if (strncmp(value, "ID_OUI_FROM_DATABASE=", 21))
+			continue;
+
+		value += 21;
+		n = strcspn(value, "\r\n");
+
+		if (len == size) {
+			struct oui_name *tmp;
+
+			size = size ? size * 2 : 4096;
+			tmp = realloc(table, size * sizeof(*table));
+			if (!tmp) {
+				err = -ENOMEM;
+				goto failed;
+			}
+
+			table = tmp;
+		}
+
+		table[len].oui = oui;
+		table[len].company = strndup(value, n);
+		if (!table[len].company) {
+			err = -ENOMEM;
+			goto failed;
+		}
+
+		len++;
+		match = false;
+	}
+
+	fclose(fp);
+
+	if (!len) {
+		free(table);
+		return -ENOENT;
+	}
+
+	qsort(table, len, sizeof(*table), oui_name_cmp);
+
+	oui_cleanup();
+
+	oui_table = table;
+	oui_table_len = len;
+
+	return len;
+
+failed:
+	while (len > 0)
+		free(table[--len].company);
+
+	free(table);
+	fclose(fp);
+
+	return err;
+}
+
+void oui_cleanup(void)
+{
+	size_t i;
+
+	for (i = 0; i < oui_table_len; i++)
+		free(oui_table[i].company);
+
+	free(oui_table);
+	oui_table = NULL;
+	oui_table_len = 0;
+
+	for (i = 0; i < cache_len; i++)
+		free(cache[i].company);
+
+	memset(cache, 0, sizeof(cache));
+	memset(cache_hash, 0, sizeof(cache_hash));
+	cache_len = 0;
+	lru_head = 0;
+	lru_tail = 0;
+
+#ifdef HAVE_UDEV_HWDB_NEW
+	hwdb = udev_hwdb_unref(hwdb);
+	udev = udev_unref(udev);
+	hwdb_failed = false;
 #endif
+}
+
+char *batocomp(const bdaddr_t *ba)
+{
+	const char *comp;
+
+	comp = oui_get_company(ba->b[5] << 16 | ba->b[4] << 8 | ba->b[3]);
+	if (!comp)
+		return NULL;
+
+	return strdup(comp);
+}
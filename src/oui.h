@@ -21,4 +21,8 @@
  *
  */
 
+const char *oui_get_company(uint32_t oui);
+int oui_preload(const char *path);
+void oui_cleanup(void);
+
 char *batocomp(const bdaddr_t *ba);
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
@@ -38,10 +39,13 @@
 #include "src/shared/att.h"
 #include "src/shared/crypto.h"
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 #define ATT_MIN_PDU_LEN			1  /* At least 1 byte for the opcode. */
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_READ_BUDGET			16  /* Max PDUs read per wakeup */
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
@@ -70,6 +74,9 @@ struct bt_att {
 	uint8_t *buf;
 	uint16_t mtu;
 
+	unsigned int read_wakeups;	/* Number of read wakeups */
+	unsigned int read_pdus;		/* Number of PDUs read */
+
 	unsigned int next_send_id;	/* IDs for "send" ops */
 	unsigned int next_reg_id;	/* IDs for registered callbacks */
 
@@ -191,8 +198,85 @@ struct att_send_op {
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
+	struct bt_att_pdu *shared;	/* Set when pdu points to a shared PDU */
+	union {
+		struct att_send_op *next;	/* Link in the free list */
+		uint8_t buf[BT_ATT_DEFAULT_LE_MTU];	/* Inline small PDUs */
+	};
 };
 
+/*
+ * Operations are recycled through a per-thread free list, and PDUs that fit
+ * in the default LE MTU are stored inline, so that sending does not need to
+ * allocate memory in the common case.
+ */
+#define SEND_OP_POOL_MAX 16
+
+static __thread struct att_send_op *send_op_pool;
+static __thread unsigned int send_op_pool_len;
+
+/* The free list is released once the last bt_att of a thread is gone */
+static __thread unsigned int att_count;
+
+static void send_op_pool_drain(void)
+{
+	while (send_op_pool) {
+		struct att_send_op *op = send_op_pool;
+
+		send_op_pool = op->next;
+		free(op);
+	}
+
+	send_op_pool_len = 0;
+}
+
+static struct att_send_op *alloc_att_send_op(void)
+{
+	struct att_send_op *op;
+
+	op = send_op_pool;
+	if (!op)
+		return new0(struct att_send_op, 1);
+
+	send_op_pool = op->next;
+	send_op_pool_len--;
+
+	memset(op, 0, sizeof(*op));
+
+	return op;
+}
+
+struct bt_att_pdu {
+	int ref_count;
+	uint16_t len;
+	uint8_t data[0];
+};
+
+static void free_att_send_op_pdu(struct att_send_op *op)
+{
+	if (op->shared) {
+		bt_att_pdu_unref(op->shared);
+		op->shared = NULL;
+	} else if (op->pdu != op->buf)
+		free(op->pdu);
+
+	op->pdu = NULL;
+}
+
+static void free_att_send_op(struct att_send_op *op)
+{
+	free_att_send_op_pdu(op);
+
+	if (send_op_pool_len >= SEND_OP_POOL_MAX) {
+		free(op);
+		return;
+	}
+
+	op->next = send_op_pool;
+	send_op_pool = op;
+	send_op_pool_len++;
+}
+
 static void destroy_att_send_op(void *data)
 {
 	struct att_send_op *op = data;
@@ -203,8 +287,7 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->pdu);
-	free(op);
+	free_att_send_op(op);
 }
 
 static void cancel_att_send_op(struct att_send_op *op)
@@ -286,9 +369,14 @@ static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
 		return false;
 
 	op->len = pdu_len;
-	op->pdu = malloc(op->len);
-	if (!op->pdu)
-		return false;
+
+	if (pdu_len <= sizeof(op->buf)) {
+		op->pdu = op->buf;
+	} else {
+		op->pdu = malloc(op->len);
+		if (!op->pdu)
+			return false;
+	}
 
 	((uint8_t *) op->pdu)[0] = op->opcode;
 	if (pdu_len > 1)
@@ -308,7 +396,7 @@ static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
 					"ATT unable to generate signature");
 
 fail:
-	free(op->pdu);
+	free_att_send_op_pdu(op);
 	return false;
 }
 
@@ -343,7 +431,7 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	if (!callback && (op_type == ATT_OP_TYPE_REQ || op_type == ATT_OP_TYPE_IND))
 		return NULL;
 
-	op = new0(struct att_send_op, 1);
+	op = alloc_att_send_op();
 	if (!op)
 		return NULL;
 
@@ -354,7 +442,7 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	op->user_data = user_data;
 
 	if (!encode_pdu(att, op, pdu, length)) {
-		free(op);
+		free_att_send_op(op);
 		return NULL;
 	}
 
@@ -822,39 +910,30 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 	bt_att_unref(att);
 }
 
-static bool can_read_data(struct io *io, void *user_data)
+static bool process_pdu(struct bt_att *att, ssize_t len)
 {
-	struct bt_att *att = user_data;
 	uint8_t opcode;
 	uint8_t *pdu;
-	ssize_t bytes_read;
 
-	bytes_read = read(att->fd, att->buf, att->mtu);
-	if (bytes_read < 0)
-		return false;
+	util_hexdump('>', att->buf, len, att->debug_callback, att->debug_data);
 
-	util_hexdump('>', att->buf, bytes_read,
-					att->debug_callback, att->debug_data);
-
-	if (bytes_read < ATT_MIN_PDU_LEN)
+	if (len < ATT_MIN_PDU_LEN)
 		return true;
 
 	pdu = att->buf;
 	opcode = pdu[0];
 
-	bt_att_ref(att);
-
 	/* Act on the received PDU based on the opcode type */
 	switch (get_op_type(opcode)) {
 	case ATT_OP_TYPE_RSP:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT response received: 0x%02x", opcode);
-		handle_rsp(att, opcode, pdu + 1, bytes_read - 1);
+		handle_rsp(att, opcode, pdu + 1, len - 1);
 		break;
 	case ATT_OP_TYPE_CONF:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT confirmation received: 0x%02x", opcode);
-		handle_conf(att, pdu + 1, bytes_read - 1);
+		handle_conf(att, pdu + 1, len - 1);
 		break;
 	case ATT_OP_TYPE_REQ:
 		/*
@@ -867,7 +946,6 @@ static bool can_read_data(struct io *io, void *user_data)
 					"Received request while another is "
 					"pending: 0x%02x", opcode);
 			io_shutdown(att->io);
-			bt_att_unref(att);
 
 			return false;
 		}
@@ -885,13 +963,57 @@ static bool can_read_data(struct io *io, void *user_data)
 		 */
 		util_debug(att->debug_callback, att->debug_data,
 					"ATT PDU received: 0x%02x", opcode);
-		handle_notify(att, opcode, pdu + 1, bytes_read - 1);
+		handle_notify(att, opcode, pdu + 1, len - 1);
 		break;
 	}
 
+	return true;
+}
+
+static bool can_read_data(struct io *io, void *user_data)
+{
+	struct bt_att *att = user_data;
+	unsigned int count = 0;
+	ssize_t bytes_read;
+	bool ret = true;
+
+	bytes_read = read(att->fd, att->buf, att->mtu);
+	if (bytes_read < 0)
+		return false;
+
+	bt_att_ref(att);
+
+	att->read_wakeups++;
+
+	/*
+	 * Drain the PDUs already queued on the socket, up to a budget, so that
+	 * high rate notifications don't cost a main loop iteration each. Only
+	 * the first read is guaranteed not to block, the others are done
+	 * non-blocking and stop as soon as the socket is empty.
+	 */
+	while (1) {
+		count++;
+
+		ret = process_pdu(att, bytes_read);
+		if (!ret || count == ATT_READ_BUDGET || !att->io)
+			break;
+
+		bytes_read = recv(att->fd, att->buf, att->mtu, MSG_DONTWAIT);
+		if (bytes_read <= 0)
+			break;
+	}
+
+	att->read_pdus += count;
+
+	if (count > 1)
+		util_debug(att->debug_callback, att->debug_data,
+				"ATT read %u PDUs in one wakeup "
+				"(%u PDUs in %u wakeups)", count,
+				att->read_pdus, att->read_wakeups);
+
 	bt_att_unref(att);
 
-	return true;
+	return ret;
 }
 
 static bool is_io_l2cap_based(int fd)
@@ -948,6 +1070,9 @@ static void bt_att_free(struct bt_att *att)
 	free(att->buf);
 
 	free(att);
+
+	if (att_count && !--att_count)
+		send_op_pool_drain();
 }
 
 struct bt_att *bt_att_new(int fd, bool ext_signed)
@@ -961,6 +1086,8 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	if (!att)
 		return NULL;
 
+	att_count++;
+
 	att->fd = fd;
 	att->ext_signed = ext_signed;
 	att->mtu = BT_ATT_DEFAULT_LE_MTU;
@@ -1164,22 +1291,11 @@ bool bt_att_unregister_disconnect(struct bt_att *att, unsigned int id)
 	return true;
 }
 
-unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
-				const void *pdu, uint16_t length,
-				bt_att_response_func_t callback, void *user_data,
-				bt_att_destroy_func_t destroy)
+static unsigned int queue_att_send_op(struct bt_att *att,
+						struct att_send_op *op)
 {
-	struct att_send_op *op;
 	bool result;
 
-	if (!att || !att->io)
-		return 0;
-
-	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
-								destroy);
-	if (!op)
-		return 0;
-
 	if (att->next_send_id < 1)
 		att->next_send_id = 1;
 
@@ -1204,8 +1320,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	}
 
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		free_att_send_op(op);
 		return 0;
 	}
 
@@ -1214,6 +1329,109 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	return op->id;
 }
 
+unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
+				const void *pdu, uint16_t length,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || !att->io)
+		return 0;
+
+	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
+								destroy);
+	if (!op)
+		return 0;
+
+	return queue_att_send_op(att, op);
+}
+
+struct bt_att_pdu *bt_att_pdu_new(uint8_t opcode, const struct iovec *iov,
+								int iovcnt)
+{
+	struct bt_att_pdu *pdu;
+	size_t len = 1;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > UINT16_MAX)
+		return NULL;
+
+	pdu = malloc(sizeof(*pdu) + len);
+	if (!pdu)
+		return NULL;
+
+	pdu->len = len;
+	pdu->data[0] = opcode;
+
+	for (i = 0, len = 1; i < iovcnt; i++) {
+		memcpy(pdu->data + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	pdu->ref_count = 0;
+
+	return bt_att_pdu_ref(pdu);
+}
+
+struct bt_att_pdu *bt_att_pdu_ref(struct bt_att_pdu *pdu)
+{
+	if (!pdu)
+		return NULL;
+
+	__sync_fetch_and_add(&pdu->ref_count, 1);
+
+	return pdu;
+}
+
+void bt_att_pdu_unref(struct bt_att_pdu *pdu)
+{
+	if (!pdu)
+		return;
+
+	if (__sync_sub_and_fetch(&pdu->ref_count, 1))
+		return;
+
+	free(pdu);
+}
+
+unsigned int bt_att_send_pdu(struct bt_att *att, struct bt_att_pdu *pdu)
+{
+	struct att_send_op *op;
+	enum att_op_type op_type;
+
+	if (!att || !att->io || !pdu)
+		return 0;
+
+	/*
+	 * Only PDUs that do not elicit a response and are not signed can be
+	 * shared since they are sent as is.
+	 */
+	op_type = get_op_type(pdu->data[0]);
+	if (op_type != ATT_OP_TYPE_NOT && op_type != ATT_OP_TYPE_CMD)
+		return 0;
+
+	if (pdu->data[0] & ATT_OP_SIGNED_MASK)
+		return 0;
+
+	op = alloc_att_send_op();
+	if (!op)
+		return 0;
+
+	op->type = op_type;
+	op->opcode = pdu->data[0];
+	op->shared = bt_att_pdu_ref(pdu);
+	op->pdu = pdu->data;
+
+	/* PDUs exceeding the MTU are truncated as values are */
+	op->len = MIN(pdu->len, att->mtu);
+
+	return queue_att_send_op(att, op);
+}
+
 static bool match_op_id(const void *a, const void *b)
 {
 	const struct att_send_op *op = a;
@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "src/shared/att-types.h"
 
@@ -64,6 +65,18 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
 bool bt_att_cancel(struct bt_att *att, unsigned int id);
+
+/*
+ * Refcounted, pre-encoded PDU that can be queued on several bt_att instances
+ * without being copied. Only notifications and commands can be shared.
+ */
+struct bt_att_pdu;
+
+struct bt_att_pdu *bt_att_pdu_new(uint8_t opcode, const struct iovec *iov,
+								int iovcnt);
+struct bt_att_pdu *bt_att_pdu_ref(struct bt_att_pdu *pdu);
+void bt_att_pdu_unref(struct bt_att_pdu *pdu);
+unsigned int bt_att_send_pdu(struct bt_att *att, struct bt_att_pdu *pdu);
 bool bt_att_cancel_all(struct bt_att *att);
 
 unsigned int bt_att_send_error_rsp(struct bt_att *att, uint8_t opcode,
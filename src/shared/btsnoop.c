@@ -26,12 +26,16 @@
 #endif
 
 #include <endian.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 
 #include "src/shared/btsnoop.h"
 
@@ -72,8 +76,131 @@ struct btsnoop {
 	uint16_t index;
 	bool aborted;
 	bool pklg_format;
+	uint8_t *buf;
+	size_t buf_len;
+	size_t buf_size;
+	unsigned int flush_interval;
+	uint64_t last_flush;
+	char *path;
+	uint8_t *map;
+	size_t map_size;
+	size_t map_offset;
+	uint64_t map_mtime;
+	uint32_t packet;
+	struct btsnoop_index_entry *entries;
+	uint32_t num_entries;
+	uint32_t num_packets;
 };
 
+/*
+ * Sparse packet index: every BTSNOOP_INDEX_INTERVAL packets, the timestamp
+ * and file offset of the record are stored. Seeking jumps to the closest
+ * entry and then skips the remaining record headers in the mapped file.
+ */
+#define BTSNOOP_INDEX_INTERVAL	64
+
+struct btsnoop_index_entry {
+	uint64_t ts;
+	uint64_t offset;
+};
+
+/*
+ * Header of the index persisted as <path>.idx, in host byte order. Size and
+ * modification time of the trace identify the file the index was built for.
+ */
+struct btsnoop_index_hdr {
+	uint8_t		id[8];
+	uint32_t	version;
+	uint32_t	interval;
+	uint64_t	file_size;
+	uint64_t	file_mtime;
+	uint32_t	num_packets;
+	uint32_t	num_entries;
+} __attribute__ ((packed));
+
+static const uint8_t btsnoop_index_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					    0x69, 0x64, 0x78, 0x00 };
+
+static const uint32_t btsnoop_index_version = 2;
+
+static uint64_t get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t written;
+
+		written = write(fd, buf, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		buf += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+/*
+ * Map the whole trace so that records are parsed without a read() per field
+ * and so that it can be indexed and seeked cheaply. Reading falls back to
+ * read() if the file cannot be mapped.
+ */
+static void map_file(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_size <= (off_t) BTSNOOP_HDR_SIZE ||
+				(uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->map_offset = BTSNOOP_HDR_SIZE;
+	btsnoop->map_mtime = st.st_mtim.tv_sec * 1000000000ULL +
+							st.st_mtim.tv_nsec;
+}
+
+static ssize_t read_data(struct btsnoop *btsnoop, void *buf, size_t len)
+{
+	size_t avail;
+
+	if (!btsnoop->map)
+		return read(btsnoop->fd, buf, len);
+
+	if (btsnoop->map_offset >= btsnoop->map_size)
+		return 0;
+
+	avail = btsnoop->map_size - btsnoop->map_offset;
+	if (len > avail)
+		len = avail;
+
+	memcpy(buf, btsnoop->map + btsnoop->map_offset, len);
+	btsnoop->map_offset += len;
+
+	return len;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -92,6 +219,9 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 	btsnoop->flags = flags;
 
+	if (flags & BTSNOOP_FLAG_PERSIST_INDEX)
+		btsnoop->path = strdup(path);
+
 	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
 	if (len < 0 || len != BTSNOOP_HDR_SIZE)
 		goto failed;
@@ -119,10 +249,14 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
+	if (!btsnoop->pklg_format)
+		map_file(btsnoop);
+
 	return btsnoop_ref(btsnoop);
 
 failed:
 	close(btsnoop->fd);
+	free(btsnoop->path);
 	free(btsnoop);
 
 	return NULL;
@@ -180,9 +314,17 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	btsnoop_flush(btsnoop);
+
+	if (btsnoop->map)
+		munmap(btsnoop->map, btsnoop->map_size);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
+	free(btsnoop->entries);
+	free(btsnoop->path);
+	free(btsnoop->buf);
 	free(btsnoop);
 }
 
@@ -194,12 +336,92 @@ uint32_t btsnoop_get_type(struct btsnoop *btsnoop)
 	return btsnoop->type;
 }
 
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+						unsigned int flush_interval)
+{
+	uint8_t *buf;
+
+	if (!btsnoop)
+		return false;
+
+	if (!btsnoop_flush(btsnoop))
+		return false;
+
+	if (!size) {
+		free(btsnoop->buf);
+		btsnoop->buf = NULL;
+		btsnoop->buf_size = 0;
+		return true;
+	}
+
+	/* The buffer has to hold at least one packet of maximum size */
+	if (size < BTSNOOP_PKT_SIZE + BTSNOOP_MAX_PACKET_SIZE)
+		return false;
+
+	buf = realloc(btsnoop->buf, size);
+	if (!buf)
+		return false;
+
+	btsnoop->buf = buf;
+	btsnoop->buf_size = size;
+	btsnoop->flush_interval = flush_interval;
+	btsnoop->last_flush = get_time_ms();
+
+	return true;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	bool result;
+
+	if (!btsnoop)
+		return false;
+
+	if (!btsnoop->buf_len)
+		return true;
+
+	result = write_all(btsnoop->fd, btsnoop->buf, btsnoop->buf_len);
+
+	btsnoop->buf_len = 0;
+	btsnoop->last_flush = get_time_ms();
+
+	return result;
+}
+
+static bool buffer_write(struct btsnoop *btsnoop, const struct iovec *iov,
+								int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (btsnoop->buf_len + len > btsnoop->buf_size &&
+						!btsnoop_flush(btsnoop))
+		return false;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(btsnoop->buf + btsnoop->buf_len, iov[i].iov_base,
+							iov[i].iov_len);
+		btsnoop->buf_len += iov[i].iov_len;
+	}
+
+	if (btsnoop->flush_interval && get_time_ms() >=
+			btsnoop->last_flush + btsnoop->flush_interval)
+		return btsnoop_flush(btsnoop);
+
+	return true;
+}
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, const void *data, uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct iovec iov[2];
 	uint64_t ts;
 	ssize_t written;
+	int iovcnt = 1;
 
 	if (!btsnoop || !tv)
 		return false;
@@ -212,16 +434,22 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(0);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
-		return false;
+	iov[0].iov_base = &pkt;
+	iov[0].iov_len = BTSNOOP_PKT_SIZE;
 
 	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
-			return false;
+		iov[1].iov_base = (void *) data;
+		iov[1].iov_len = size;
+		iovcnt++;
 	}
 
+	if (btsnoop->buf)
+		return buffer_write(btsnoop, iov, iovcnt);
+
+	written = writev(btsnoop->fd, iov, iovcnt);
+	if (written < 0)
+		return false;
+
 	return true;
 }
 
@@ -350,6 +578,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	}
 
 	*size = toread;
+	btsnoop->packet++;
 
 	return true;
 }
@@ -405,7 +634,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = read_data(btsnoop, &pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -433,7 +662,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_TYPE_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
+		len = read_data(btsnoop, &pkt_type, 1);
 		if (len < 0) {
 			btsnoop->aborted = true;
 			return false;
@@ -454,13 +683,14 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = read_data(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
 	*size = toread;
+	btsnoop->packet++;
 
 	return true;
 }
@@ -470,3 +700,380 @@ bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 {
 	return false;
 }
+
+/* Returns the size of the record at offset or 0 if it is not valid */
+static size_t record_size(struct btsnoop *btsnoop, size_t offset,
+								uint64_t *ts)
+{
+	struct btsnoop_pkt pkt;
+	uint32_t size;
+
+	if (offset < BTSNOOP_HDR_SIZE ||
+				offset + BTSNOOP_PKT_SIZE > btsnoop->map_size)
+		return 0;
+
+	memcpy(&pkt, btsnoop->map + offset, BTSNOOP_PKT_SIZE);
+
+	size = be32toh(pkt.size);
+	if (size > BTSNOOP_MAX_PACKET_SIZE)
+		return 0;
+
+	if (offset + BTSNOOP_PKT_SIZE + size > btsnoop->map_size)
+		return 0;
+
+	if (ts)
+		*ts = be64toh(pkt.ts);
+
+	return BTSNOOP_PKT_SIZE + size;
+}
+
+static bool build_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_index_entry *entries = NULL;
+	uint32_t num_entries = 0, num_packets = 0, size = 0;
+	size_t offset = BTSNOOP_HDR_SIZE;
+
+	while (1) {
+		uint64_t ts;
+		size_t len;
+
+		len = record_size(btsnoop, offset, &ts);
+		if (!len)
+			break;
+
+		if (!(num_packets % BTSNOOP_INDEX_INTERVAL)) {
+			if (num_entries == size) {
+				struct btsnoop_index_entry *tmp;
+
+				size = size ? size * 2 : 256;
+				tmp = realloc(entries, size * sizeof(*tmp));
+				if (!tmp) {
+					free(entries);
+					return false;
+				}
+
+				entries = tmp;
+			}
+
+			entries[num_entries].ts = ts;
+			entries[num_entries].offset = offset;
+			num_entries++;
+		}
+
+		offset += len;
+		num_packets++;
+	}
+
+	btsnoop->entries = entries;
+	btsnoop->num_entries = num_entries;
+	btsnoop->num_packets = num_packets;
+
+	return true;
+}
+
+static char *index_path(struct btsnoop *btsnoop)
+{
+	size_t len = strlen(btsnoop->path);
+	char *path;
+
+	path = malloc(len + 5);
+	if (!path)
+		return NULL;
+
+	memcpy(path, btsnoop->path, len);
+	memcpy(path + len, ".idx", 5);
+
+	return path;
+}
+
+/*
+ * An index which does not match the trace, e.g. because the trace has been
+ * rewritten in place, must not make the reader seek outside of the mapping.
+ */
+static bool check_index(struct btsnoop *btsnoop,
+				const struct btsnoop_index_entry *entries,
+				uint32_t num_entries)
+{
+	uint64_t prev = 0;
+	uint32_t i;
+
+	if (entries[0].offset != BTSNOOP_HDR_SIZE)
+		return false;
+
+	for (i = 0; i < num_entries; i++) {
+		uint64_t offset = entries[i].offset;
+
+		if (offset < BTSNOOP_HDR_SIZE || offset >= btsnoop->map_size)
+			return false;
+
+		if (i && offset <= prev)
+			return false;
+
+		if (!record_size(btsnoop, offset, NULL))
+			return false;
+
+		prev = offset;
+	}
+
+	return true;
+}
+
+static bool load_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_index_hdr hdr;
+	struct btsnoop_index_entry *entries;
+	size_t len;
+	char *path;
+	int fd;
+
+	path = index_path(btsnoop);
+	if (!path)
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+
+	if (fd < 0)
+		return false;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto failed;
+
+	if (memcmp(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id)) ||
+			hdr.version != btsnoop_index_version ||
+			hdr.interval != BTSNOOP_INDEX_INTERVAL ||
+			hdr.file_size != btsnoop->map_size ||
+			hdr.file_mtime != btsnoop->map_mtime)
+		goto failed;
+
+	/* Every record takes at least a record header */
+	if (!hdr.num_packets || hdr.num_packets > (btsnoop->map_size -
+				BTSNOOP_HDR_SIZE) / BTSNOOP_PKT_SIZE)
+		goto failed;
+
+	if (hdr.num_entries != (hdr.num_packets - 1) /
+						BTSNOOP_INDEX_INTERVAL + 1)
+		goto failed;
+
+	len = hdr.num_entries * sizeof(*entries);
+
+	entries = malloc(len);
+	if (!entries)
+		goto failed;
+
+	if (read(fd, entries, len) != (ssize_t) len ||
+			!check_index(btsnoop, entries, hdr.num_entries)) {
+		free(entries);
+		goto failed;
+	}
+
+	close(fd);
+
+	btsnoop->entries = entries;
+	btsnoop->num_entries = hdr.num_entries;
+	btsnoop->num_packets = hdr.num_packets;
+
+	return true;
+
+failed:
+	close(fd);
+	return false;
+}
+
+static void save_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_index_hdr hdr;
+	struct iovec iov[2];
+	char *path;
+	int fd;
+
+	path = index_path(btsnoop);
+	if (!path)
+		return;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		free(path);
+		return;
+	}
+
+	memcpy(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id));
+	hdr.version = btsnoop_index_version;
+	hdr.interval = BTSNOOP_INDEX_INTERVAL;
+	hdr.file_size = btsnoop->map_size;
+	hdr.file_mtime = btsnoop->map_mtime;
+	hdr.num_packets = btsnoop->num_packets;
+	hdr.num_entries = btsnoop->num_entries;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = btsnoop->entries;
+	iov[1].iov_len = btsnoop->num_entries * sizeof(*btsnoop->entries);
+
+	/* Do not leave a truncated index behind */
+	if (writev(fd, iov, 2) != (ssize_t) (iov[0].iov_len + iov[1].iov_len))
+		unlink(path);
+
+	close(fd);
+	free(path);
+}
+
+static bool ensure_index(struct btsnoop *btsnoop)
+{
+	if (btsnoop->entries)
+		return true;
+
+	if (!btsnoop->map)
+		return false;
+
+	if (btsnoop->path && load_index(btsnoop))
+		return true;
+
+	if (!build_index(btsnoop) || !btsnoop->entries)
+		return false;
+
+	if (btsnoop->path)
+		save_index(btsnoop);
+
+	return true;
+}
+
+uint32_t btsnoop_get_packet_count(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || !ensure_index(btsnoop))
+		return 0;
+
+	return btsnoop->num_packets;
+}
+
+static void seek_entry(struct btsnoop *btsnoop, uint32_t entry)
+{
+	btsnoop->map_offset = btsnoop->entries[entry].offset;
+	btsnoop->packet = entry * BTSNOOP_INDEX_INTERVAL;
+	btsnoop->aborted = false;
+}
+
+bool btsnoop_seek(struct btsnoop *btsnoop, uint32_t packet)
+{
+	if (!btsnoop || !ensure_index(btsnoop))
+		return false;
+
+	if (packet >= btsnoop->num_packets)
+		return false;
+
+	seek_entry(btsnoop, packet / BTSNOOP_INDEX_INTERVAL);
+
+	while (btsnoop->packet < packet) {
+		size_t len;
+
+		len = record_size(btsnoop, btsnoop->map_offset, NULL);
+		if (!len)
+			return false;
+
+		btsnoop->map_offset += len;
+		btsnoop->packet++;
+	}
+
+	return true;
+}
+
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv)
+{
+	uint32_t lo, hi;
+	uint64_t ts;
+
+	if (!btsnoop || !tv || !ensure_index(btsnoop))
+		return false;
+
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+	ts += 0x00E03AB44A676000ll;
+
+	/* Find the last entry before the requested time */
+	lo = 0;
+	hi = btsnoop->num_entries;
+
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (btsnoop->entries[mid].ts < ts)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	seek_entry(btsnoop, lo);
+
+	while (btsnoop->packet < btsnoop->num_packets) {
+		uint64_t pkt_ts;
+		size_t len;
+
+		len = record_size(btsnoop, btsnoop->map_offset, &pkt_ts);
+		if (!len)
+			return false;
+
+		if (pkt_ts >= ts)
+			return true;
+
+		btsnoop->map_offset += len;
+		btsnoop->packet++;
+	}
+
+	return false;
+}
+
+uint32_t btsnoop_tell(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return 0;
+
+	return btsnoop->packet;
+}
+
+struct btsnoop *btsnoop_dup(struct btsnoop *btsnoop)
+{
+	struct btsnoop *dup;
+	size_t len;
+
+	if (!btsnoop || !ensure_index(btsnoop))
+		return NULL;
+
+	dup = calloc(1, sizeof(*dup));
+	if (!dup)
+		return NULL;
+
+	dup->fd = fcntl(btsnoop->fd, F_DUPFD_CLOEXEC, 0);
+	if (dup->fd < 0) {
+		free(dup);
+		return NULL;
+	}
+
+	dup->flags = btsnoop->flags & ~BTSNOOP_FLAG_PERSIST_INDEX;
+	dup->type = btsnoop->type;
+	dup->index = 0xffff;
+
+	map_file(dup);
+	if (!dup->map || dup->map_size != btsnoop->map_size)
+		goto failed;
+
+	len = btsnoop->num_entries * sizeof(*btsnoop->entries);
+
+	dup->entries = malloc(len);
+	if (!dup->entries)
+		goto failed;
+
+	memcpy(dup->entries, btsnoop->entries, len);
+	dup->num_entries = btsnoop->num_entries;
+	dup->num_packets = btsnoop->num_packets;
+
+	return btsnoop_ref(dup);
+
+failed:
+	if (dup->map)
+		munmap(dup->map, dup->map_size);
+
+	close(dup->fd);
+	free(dup);
+
+	return NULL;
+}
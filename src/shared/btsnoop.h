@@ -34,6 +34,7 @@
 #define BTSNOOP_TYPE_SIMULATOR		2002
 
 #define BTSNOOP_FLAG_PKLG_SUPPORT	(1 << 0)
+#define BTSNOOP_FLAG_PERSIST_INDEX	(1 << 1)
 
 #define BTSNOOP_OPCODE_NEW_INDEX	0
 #define BTSNOOP_OPCODE_DEL_INDEX	1
@@ -63,6 +64,10 @@ void btsnoop_unref(struct btsnoop *btsnoop);
 
 uint32_t btsnoop_get_type(struct btsnoop *btsnoop);
 
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+						unsigned int flush_interval);
+bool btsnoop_flush(struct btsnoop *btsnoop);
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, const void *data, uint16_t size);
 bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
@@ -76,3 +81,9 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					void *data, uint16_t *size);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
+
+uint32_t btsnoop_get_packet_count(struct btsnoop *btsnoop);
+bool btsnoop_seek(struct btsnoop *btsnoop, uint32_t packet);
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv);
+uint32_t btsnoop_tell(struct btsnoop *btsnoop);
+struct btsnoop *btsnoop_dup(struct btsnoop *btsnoop);
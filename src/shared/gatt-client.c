@@ -67,6 +67,13 @@ struct bt_gatt_client {
 	bool in_init;
 	bool ready;
 
+	/*
+	 * Set if the services already in db were restored from a persistent
+	 * cache, in which case discovery is skipped and Service Changed is
+	 * relied upon to keep them up to date.
+	 */
+	bool cached;
+
 	/*
 	 * Queue of long write requests. An error during "prepare write"
 	 * requests can result in a cancel through "execute write". To prevent
@@ -1058,6 +1065,37 @@ static void notify_client_ready(struct bt_gatt_client *client, bool success,
 	bt_gatt_client_unref(client);
 }
 
+static void get_first_attribute(struct gatt_db_attribute *attrib,
+								void *user_data)
+{
+	struct gatt_db_attribute **stored = user_data;
+
+	if (*stored)
+		return;
+
+	*stored = attrib;
+}
+
+static bool cache_is_usable(struct bt_gatt_client *client)
+{
+	struct gatt_db_attribute *attr = NULL;
+	bt_uuid_t uuid;
+
+	if (!client->cached || gatt_db_isempty(client->db))
+		return false;
+
+	/*
+	 * The cache can only be trusted if the remote is able to tell us when
+	 * it becomes stale, which requires the Service Changed characteristic.
+	 */
+	bt_uuid16_create(&uuid, SVC_CHNGD_UUID);
+
+	gatt_db_find_by_type(client->db, 0x0001, 0xffff, &uuid,
+						get_first_attribute, &attr);
+
+	return attr != NULL;
+}
+
 static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct discovery_op *op = user_data;
@@ -1091,6 +1129,14 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 					bt_att_get_mtu(client->att));
 
 discover:
+	if (cache_is_usable(client)) {
+		util_debug(client->debug_callback, client->debug_data,
+				"Using cached attributes, skipping discovery");
+		op->success = true;
+		op->complete_func(op, true, 0);
+		return;
+	}
+
 	client->discovery_req = bt_gatt_discover_all_primary_services(
 							client->att, NULL,
 							discover_primary_cb,
@@ -1302,17 +1348,6 @@ static unsigned int register_notify(struct bt_gatt_client *client,
 	return notify_data->id;
 }
 
-static void get_first_attribute(struct gatt_db_attribute *attrib,
-								void *user_data)
-{
-	struct gatt_db_attribute **stored = user_data;
-
-	if (*stored)
-		return;
-
-	*stored = attrib;
-}
-
 static void service_changed_register_cb(uint16_t att_ecode, void *user_data)
 {
 	bool success;
@@ -1704,9 +1739,10 @@ static void att_disconnect_cb(int err, void *user_data)
 		notify_client_ready(client, false, 0);
 }
 
-struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
+static struct bt_gatt_client *gatt_client_new(struct gatt_db *db,
 							struct bt_att *att,
-							uint16_t mtu)
+							uint16_t mtu,
+							bool cached)
 {
 	struct bt_gatt_client *client;
 
@@ -1754,6 +1790,7 @@ struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
 
 	client->att = bt_att_ref(att);
 	client->db = gatt_db_ref(db);
+	client->cached = cached;
 
 	if (!gatt_client_init(client, mtu))
 		goto fail;
@@ -1765,6 +1802,20 @@ fail:
 	return NULL;
 }
 
+struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
+							struct bt_att *att,
+							uint16_t mtu)
+{
+	return gatt_client_new(db, att, mtu, false);
+}
+
+struct bt_gatt_client *bt_gatt_client_new_from_cache(struct gatt_db *db,
+							struct bt_att *att,
+							uint16_t mtu)
+{
+	return gatt_client_new(db, att, mtu, true);
+}
+
 struct bt_gatt_client *bt_gatt_client_ref(struct bt_gatt_client *client)
 {
 	if (!client)
@@ -21,6 +21,7 @@
  *
  */
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
 
@@ -39,6 +40,7 @@
 #define MAX_CHAR_DECL_VALUE_LEN 19
 #define MAX_INCLUDED_VALUE_LEN 6
 #define ATTRIBUTE_TIMEOUT 5000
+#define TYPE_INDEX_BUCKETS 64
 
 static const bt_uuid_t primary_service_uuid = { .type = BT_UUID16,
 					.value.u16 = GATT_PRIM_SVC_UUID };
@@ -54,10 +56,25 @@ struct gatt_db {
 	uint16_t next_handle;
 	struct queue *services;
 
+	/* Services sorted by start handle, used for handle lookups */
+	struct gatt_db_service **index;
+	unsigned int index_len;
+	unsigned int index_size;
+
+	/* Attributes sorted by handle, hashed by their 128-bit type */
+	struct queue *types[TYPE_INDEX_BUCKETS];
+
 	struct queue *notify_list;
 	unsigned int next_notify_id;
 };
 
+struct type_entry {
+	bt_uuid_t uuid;
+	struct gatt_db_attribute **attrs;
+	unsigned int len;
+	unsigned int size;
+};
+
 struct notify {
 	unsigned int id;
 	gatt_db_attribute_cb_t service_added;
@@ -109,6 +126,137 @@ struct gatt_db_service {
 	struct gatt_db_attribute **attributes;
 };
 
+static struct queue *type_bucket(struct gatt_db *db, const bt_uuid_t *uuid128)
+{
+	const uint8_t *data = uuid128->value.u128.data;
+	unsigned int i, hash = 0;
+
+	for (i = 0; i < sizeof(uuid128->value.u128); i++)
+		hash = hash * 31 + data[i];
+
+	return db->types[hash % TYPE_INDEX_BUCKETS];
+}
+
+static bool match_type_entry(const void *a, const void *b)
+{
+	const struct type_entry *entry = a;
+	const bt_uuid_t *uuid128 = b;
+
+	return !memcmp(&entry->uuid.value.u128, &uuid128->value.u128,
+						sizeof(uuid128->value.u128));
+}
+
+static struct type_entry *type_entry_find(struct gatt_db *db,
+						const bt_uuid_t *uuid)
+{
+	bt_uuid_t uuid128;
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+
+	return queue_find(type_bucket(db, &uuid128), match_type_entry,
+								&uuid128);
+}
+
+static void type_entry_free(void *data)
+{
+	struct type_entry *entry = data;
+
+	free(entry->attrs);
+	free(entry);
+}
+
+/* Returns the position of the first attribute with handle >= given handle */
+static unsigned int type_entry_lookup(const struct type_entry *entry,
+							uint16_t handle)
+{
+	unsigned int low = 0, high = entry->len;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+
+		if (entry->attrs[mid]->handle < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool type_index_add(struct gatt_db *db,
+					struct gatt_db_attribute *attrib)
+{
+	struct type_entry *entry;
+	unsigned int pos;
+
+	entry = type_entry_find(db, &attrib->uuid);
+	if (!entry) {
+		entry = new0(struct type_entry, 1);
+		if (!entry)
+			return false;
+
+		bt_uuid_to_uuid128(&attrib->uuid, &entry->uuid);
+
+		if (!queue_push_tail(type_bucket(db, &entry->uuid), entry)) {
+			free(entry);
+			return false;
+		}
+	}
+
+	if (entry->len == entry->size) {
+		struct gatt_db_attribute **attrs;
+		unsigned int size;
+
+		size = entry->size ? entry->size * 2 : 4;
+
+		attrs = realloc(entry->attrs, size * sizeof(*attrs));
+		if (!attrs)
+			return false;
+
+		entry->attrs = attrs;
+		entry->size = size;
+	}
+
+	pos = type_entry_lookup(entry, attrib->handle);
+
+	memmove(&entry->attrs[pos + 1], &entry->attrs[pos],
+				(entry->len - pos) * sizeof(*entry->attrs));
+	entry->attrs[pos] = attrib;
+	entry->len++;
+
+	return true;
+}
+
+static void type_index_remove(struct gatt_db *db,
+					struct gatt_db_attribute *attrib)
+{
+	struct type_entry *entry;
+	unsigned int pos;
+
+	entry = type_entry_find(db, &attrib->uuid);
+	if (!entry)
+		return;
+
+	for (pos = type_entry_lookup(entry, attrib->handle);
+					pos < entry->len; pos++) {
+		if (entry->attrs[pos] == attrib)
+			break;
+	}
+
+	if (pos == entry->len)
+		return;
+
+	memmove(&entry->attrs[pos], &entry->attrs[pos + 1],
+			(entry->len - pos - 1) * sizeof(*entry->attrs));
+	entry->len--;
+
+	if (entry->len)
+		return;
+
+	queue_remove(type_bucket(db, &entry->uuid), entry);
+	type_entry_free(entry);
+}
+
 static void pending_read_result(struct pending_read *p, int err,
 					const uint8_t *data, size_t length)
 {
@@ -206,9 +354,20 @@ struct gatt_db *gatt_db_ref(struct gatt_db *db)
 	return db;
 }
 
+static void type_index_destroy(struct gatt_db *db)
+{
+	int i;
+
+	for (i = 0; i < TYPE_INDEX_BUCKETS; i++) {
+		queue_destroy(db->types[i], type_entry_free);
+		db->types[i] = NULL;
+	}
+}
+
 struct gatt_db *gatt_db_new(void)
 {
 	struct gatt_db *db;
+	int i;
 
 	db = new0(struct gatt_db, 1);
 	if (!db)
@@ -227,6 +386,17 @@ struct gatt_db *gatt_db_new(void)
 		return NULL;
 	}
 
+	for (i = 0; i < TYPE_INDEX_BUCKETS; i++) {
+		db->types[i] = queue_new();
+		if (!db->types[i]) {
+			type_index_destroy(db);
+			queue_destroy(db->notify_list, NULL);
+			queue_destroy(db->services, NULL);
+			free(db);
+			return NULL;
+		}
+	}
+
 	db->next_handle = 0x0001;
 
 	return gatt_db_ref(db);
@@ -293,8 +463,12 @@ static void gatt_db_service_destroy(void *data)
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
-	for (i = 0; i < service->num_handles; i++)
+	for (i = 0; i < service->num_handles; i++) {
+		if (service->db && service->attributes[i])
+			type_index_remove(service->db, service->attributes[i]);
+
 		attribute_destroy(service->attributes[i]);
+	}
 
 	free(service->attributes);
 	free(service);
@@ -312,7 +486,11 @@ static void gatt_db_destroy(struct gatt_db *db)
 	queue_destroy(db->notify_list, notify_destroy);
 	db->notify_list = NULL;
 
+	/* Drop the type index upfront instead of updating it per attribute */
+	type_index_destroy(db);
+
 	queue_destroy(db->services, gatt_db_service_destroy);
+	free(db->index);
 	free(db);
 }
 
@@ -412,6 +590,114 @@ static struct gatt_db_service *gatt_db_service_create(const bt_uuid_t *uuid,
 	return service;
 }
 
+static void gatt_db_service_get_handles(const struct gatt_db_service *service,
+							uint16_t *start_handle,
+							uint16_t *end_handle)
+{
+	if (start_handle)
+		*start_handle = service->attributes[0]->handle;
+
+	if (end_handle)
+		*end_handle = service->attributes[0]->handle +
+						service->num_handles - 1;
+}
+
+/*
+ * Returns the position in the index of the first service whose end handle is
+ * equal or greater than the given handle. Services never overlap so the end
+ * handles are sorted as well as the start handles.
+ */
+static unsigned int index_lookup(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int low = 0, high = db->index_len;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+		uint16_t end;
+
+		gatt_db_service_get_handles(db->index[mid], NULL, &end);
+
+		if (end < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool index_add(struct gatt_db *db, struct gatt_db_service *service)
+{
+	unsigned int pos;
+
+	if (db->index_len == db->index_size) {
+		struct gatt_db_service **index;
+		unsigned int size;
+
+		size = db->index_size ? db->index_size * 2 : 16;
+
+		index = realloc(db->index, size * sizeof(*index));
+		if (!index)
+			return false;
+
+		db->index = index;
+		db->index_size = size;
+	}
+
+	pos = index_lookup(db, service->attributes[0]->handle);
+
+	memmove(&db->index[pos + 1], &db->index[pos],
+				(db->index_len - pos) * sizeof(*db->index));
+	db->index[pos] = service;
+	db->index_len++;
+
+	return true;
+}
+
+static void index_remove_range(struct gatt_db *db, uint16_t start,
+								uint16_t end)
+{
+	unsigned int first, last;
+
+	first = index_lookup(db, start);
+
+	for (last = first; last < db->index_len; last++) {
+		uint16_t svc_start;
+
+		gatt_db_service_get_handles(db->index[last], &svc_start, NULL);
+		if (svc_start > end)
+			break;
+	}
+
+	memmove(&db->index[first], &db->index[last],
+				(db->index_len - last) * sizeof(*db->index));
+	db->index_len -= last - first;
+}
+
+static void index_remove(struct gatt_db *db, struct gatt_db_service *service)
+{
+	uint16_t start;
+
+	gatt_db_service_get_handles(service, &start, NULL);
+
+	index_remove_range(db, start, start);
+}
+
+static struct gatt_db_service *index_get(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int pos;
+	uint16_t start;
+
+	pos = index_lookup(db, handle);
+	if (pos == db->index_len)
+		return NULL;
+
+	gatt_db_service_get_handles(db->index[pos], &start, NULL);
+	if (start > handle)
+		return NULL;
+
+	return db->index[pos];
+}
 
 bool gatt_db_remove_service(struct gatt_db *db,
 					struct gatt_db_attribute *attrib)
@@ -423,6 +709,7 @@ bool gatt_db_remove_service(struct gatt_db *db,
 
 	service = attrib->service;
 
+	index_remove(db, service);
 	queue_remove(db->services, service);
 
 	gatt_db_service_destroy(service);
@@ -435,6 +722,7 @@ bool gatt_db_clear(struct gatt_db *db)
 	if (!db)
 		return false;
 
+	db->index_len = 0;
 	queue_remove_all(db->services, NULL, NULL, gatt_db_service_destroy);
 
 	db->next_handle = 0;
@@ -442,18 +730,6 @@ bool gatt_db_clear(struct gatt_db *db)
 	return true;
 }
 
-static void gatt_db_service_get_handles(const struct gatt_db_service *service,
-							uint16_t *start_handle,
-							uint16_t *end_handle)
-{
-	if (start_handle)
-		*start_handle = service->attributes[0]->handle;
-
-	if (end_handle)
-		*end_handle = service->attributes[0]->handle +
-						service->num_handles - 1;
-}
-
 struct clear_range {
 	uint16_t start, end;
 };
@@ -480,6 +756,7 @@ bool gatt_db_clear_range(struct gatt_db *db, uint16_t start_handle,
 	range.start = start_handle;
 	range.end = end_handle;
 
+	index_remove_range(db, start_handle, end_handle);
 	queue_remove_all(db->services, match_range, &range,
 						gatt_db_service_destroy);
 
@@ -490,31 +767,26 @@ static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 						uint16_t start, uint16_t end,
 						struct gatt_db_service **after)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
-	uint16_t cur_start, cur_end;
-
-	*after = NULL;
+	uint16_t cur_start;
+	unsigned int pos;
 
-	services_entry = queue_get_entries(db->services);
+	pos = index_lookup(db, start);
 
-	while (services_entry) {
-		service = services_entry->data;
+	*after = pos ? db->index[pos - 1] : NULL;
 
-		gatt_db_service_get_handles(service, &cur_start, &cur_end);
-
-		if (start >= cur_start && start <= cur_end)
-			return service;
+	if (pos == db->index_len)
+		return NULL;
 
-		if (end >= cur_start && end <= cur_end)
-			return service;
+	service = db->index[pos];
 
-		if (end < cur_start)
-			return NULL;
+	/* The service ends at or after start so it overlaps unless it begins
+	 * past the end of the new range.
+	 */
+	gatt_db_service_get_handles(service, &cur_start, NULL);
 
-		*after = service;
-		services_entry = services_entry->next;
-	}
+	if (cur_start <= end)
+		return service;
 
 	return NULL;
 }
@@ -563,22 +835,30 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	if (!service)
 		return NULL;
 
+	service->db = db;
+	service->attributes[0]->handle = handle;
+	service->num_handles = num_handles;
+
+	if (!type_index_add(db, service->attributes[0]))
+		goto fail;
+
+	if (!index_add(db, service))
+		goto fail;
+
 	if (after) {
 		if (!queue_push_after(db->services, after, service))
-			goto fail;
+			goto fail_index;
 	} else if (!queue_push_head(db->services, service)) {
-		goto fail;
+		goto fail_index;
 	}
 
-	service->db = db;
-	service->attributes[0]->handle = handle;
-	service->num_handles = num_handles;
-
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
 	return service->attributes[0];
 
+fail_index:
+	index_remove(db, service);
 fail:
 	gatt_db_service_destroy(service);
 	return NULL;
@@ -676,6 +956,17 @@ attribute_update(struct gatt_db_service *service, int index)
 	return service->attributes[index];
 }
 
+static bool index_attribute(struct gatt_db_service *service, int index)
+{
+	if (type_index_add(service->db, service->attributes[index]))
+		return true;
+
+	attribute_destroy(service->attributes[index]);
+	service->attributes[index] = NULL;
+
+	return false;
+}
+
 static void set_attribute_data(struct gatt_db_attribute *attribute,
 						gatt_db_read_t read_func,
 						gatt_db_write_t write_func,
@@ -742,15 +1033,28 @@ service_insert_characteristic(struct gatt_db_service *service,
 	i++;
 
 	service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
-	if (!service->attributes[i]) {
-		free(service->attributes[i - 1]);
+	if (!service->attributes[i])
+		goto failed;
+
+	if (!index_attribute(service, i - 1)) {
+		attribute_destroy(service->attributes[i]);
+		service->attributes[i] = NULL;
 		return NULL;
 	}
 
+	if (!index_attribute(service, i))
+		goto failed;
+
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
 	return service->attributes[i];
+
+failed:
+	type_index_remove(service->db, service->attributes[i - 1]);
+	attribute_destroy(service->attributes[i - 1]);
+	service->attributes[i - 1] = NULL;
+	return NULL;
 }
 
 struct gatt_db_attribute *
@@ -816,6 +1120,9 @@ service_insert_descriptor(struct gatt_db_service *service,
 	if (!service->attributes[i])
 		return NULL;
 
+	if (!index_attribute(service, i))
+		return NULL;
+
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
@@ -907,7 +1214,12 @@ gatt_db_service_add_included(struct gatt_db_attribute *attrib,
 	 */
 	set_attribute_data(service->attributes[index], NULL, NULL, 0, NULL);
 
-	return attribute_update(service, index);
+	attribute_update(service, index);
+
+	if (!index_attribute(service, index))
+		return NULL;
+
+	return service->attributes[index];
 }
 
 bool gatt_db_service_set_active(struct gatt_db_attribute *attrib, bool active)
@@ -961,31 +1273,28 @@ void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
 							const bt_uuid_t type,
 							struct queue *queue)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
-	uint16_t grp_start, grp_end, uuid_size;
+	uint16_t grp_start, uuid_size;
+	unsigned int i;
 
 	uuid_size = 0;
 
-	services_entry = queue_get_entries(db->services);
+	for (i = index_lookup(db, start_handle); i < db->index_len; i++) {
+		service = db->index[i];
 
-	while (services_entry) {
-		service = services_entry->data;
+		grp_start = service->attributes[0]->handle;
+
+		if (grp_start > end_handle)
+			return;
 
 		if (!service->active)
-			goto next_service;
+			continue;
 
 		if (bt_uuid_cmp(&type, &service->attributes[0]->uuid))
-			goto next_service;
-
-		grp_start = service->attributes[0]->handle;
-		grp_end = grp_start + service->num_handles - 1;
-
-		if (grp_end < start_handle || grp_start > end_handle)
-			goto next_service;
+			continue;
 
-		if (grp_start < start_handle || grp_start > end_handle)
-			goto next_service;
+		if (grp_start < start_handle)
+			continue;
 
 		if (!uuid_size)
 			uuid_size = service->attributes[0]->value_len;
@@ -993,16 +1302,40 @@ void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
 			return;
 
 		queue_push_tail(queue, service->attributes[0]);
+	}
+}
+
+/*
+ * Calls func for every service overlapping the given range, starting from the
+ * first one found in the index. The service at the current position may be
+ * removed by func so the next one is looked up again after every call.
+ */
+static void foreach_service_overlapping(struct gatt_db *db,
+					uint16_t start_handle,
+					uint16_t end_handle,
+					queue_foreach_func_t func,
+					void *user_data)
+{
+	unsigned int i;
+	uint16_t start, end;
+
+	for (i = index_lookup(db, start_handle); i < db->index_len;
+					i = index_lookup(db, end + 1)) {
+		struct gatt_db_service *service = db->index[i];
+
+		gatt_db_service_get_handles(service, &start, &end);
 
-next_service:
-		services_entry = services_entry->next;
+		if (start > end_handle)
+			return;
+
+		func(service, user_data);
+
+		if (end == UINT16_MAX)
+			return;
 	}
 }
 
 struct find_by_type_value_data {
-	bt_uuid_t uuid;
-	uint16_t start_handle;
-	uint16_t end_handle;
 	gatt_db_attribute_cb_t func;
 	void *user_data;
 	const void *value;
@@ -1010,37 +1343,57 @@ struct find_by_type_value_data {
 	unsigned int num_of_res;
 };
 
-static void find_by_type(void *data, void *user_data)
+static void find_by_type(struct gatt_db_attribute *attribute, void *user_data)
 {
 	struct find_by_type_value_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
 
-	if (!service->active)
+	/* TODO: fix for read-callback based attributes */
+	if (search_data->value && memcmp(attribute->value,
+						search_data->value,
+						search_data->value_len))
 		return;
 
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
+	search_data->num_of_res++;
+	search_data->func(attribute, search_data->user_data);
+}
 
-		if (!attribute)
-			continue;
+/*
+ * Calls func for every attribute of the given type within range, in handle
+ * order, using the type index so that attributes of other types are never
+ * visited. Attributes of inactive services are skipped.
+ */
+static void foreach_attribute_of_type(struct gatt_db *db, uint16_t start_handle,
+						uint16_t end_handle,
+						const bt_uuid_t *type,
+						gatt_db_attribute_cb_t func,
+						void *user_data)
+{
+	struct type_entry *entry;
+	unsigned int i;
 
-		if ((attribute->handle < search_data->start_handle) ||
-				(attribute->handle > search_data->end_handle))
-			continue;
+	entry = type_entry_find(db, type);
+	if (!entry)
+		return;
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
-			continue;
+	for (i = type_entry_lookup(entry, start_handle); i < entry->len; i++) {
+		struct gatt_db_attribute *attribute = entry->attrs[i];
+		uint16_t handle = attribute->handle;
+
+		if (handle > end_handle)
+			return;
 
-		/* TODO: fix for read-callback based attributes */
-		if (search_data->value && memcmp(attribute->value,
-							search_data->value,
-							search_data->value_len))
+		if (!attribute->service->active)
 			continue;
 
-		search_data->num_of_res++;
-		search_data->func(attribute, search_data->user_data);
+		func(attribute, user_data);
+
+		/* func may have removed attributes from the index */
+		entry = type_entry_find(db, type);
+		if (!entry || handle == UINT16_MAX)
+			return;
+
+		if (i >= entry->len || entry->attrs[i] != attribute)
+			i = type_entry_lookup(entry, handle + 1) - 1;
 	}
 }
 
@@ -1054,13 +1407,11 @@ unsigned int gatt_db_find_by_type(struct gatt_db *db, uint16_t start_handle,
 
 	memset(&data, 0, sizeof(data));
 
-	data.uuid = *type;
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
 	data.func = func;
 	data.user_data = user_data;
 
-	queue_foreach(db->services, find_by_type, &data);
+	foreach_attribute_of_type(db, start_handle, end_handle, type,
+							find_by_type, &data);
 
 	return data.num_of_res;
 }
@@ -1076,52 +1427,23 @@ unsigned int gatt_db_find_by_type_value(struct gatt_db *db,
 {
 	struct find_by_type_value_data data;
 
-	data.uuid = *type;
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
 	data.func = func;
 	data.user_data = user_data;
 	data.value = value;
 	data.value_len = value_len;
+	data.num_of_res = 0;
 
-	queue_foreach(db->services, find_by_type, &data);
+	foreach_attribute_of_type(db, start_handle, end_handle, type,
+							find_by_type, &data);
 
 	return data.num_of_res;
 }
 
-struct read_by_type_data {
-	struct queue *queue;
-	bt_uuid_t uuid;
-	uint16_t start_handle;
-	uint16_t end_handle;
-};
-
-static void read_by_type(void *data, void *user_data)
+static void read_by_type(struct gatt_db_attribute *attribute, void *user_data)
 {
-	struct read_by_type_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
+	struct queue *queue = user_data;
 
-	if (!service->active)
-		return;
-
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
-		if (!attribute)
-			continue;
-
-		if (attribute->handle < search_data->start_handle)
-			continue;
-
-		if (attribute->handle > search_data->end_handle)
-			return;
-
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
-			continue;
-
-		queue_push_tail(search_data->queue, attribute);
-	}
+	queue_push_tail(queue, attribute);
 }
 
 void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
@@ -1129,13 +1451,8 @@ void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
 						const bt_uuid_t type,
 						struct queue *queue)
 {
-	struct read_by_type_data data;
-	data.uuid = type;
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
-	data.queue = queue;
-
-	queue_foreach(db->services, read_by_type, &data);
+	foreach_attribute_of_type(db, start_handle, end_handle, &type,
+							read_by_type, queue);
 }
 
 
@@ -1185,7 +1502,8 @@ void gatt_db_find_information(struct gatt_db *db, uint16_t start_handle,
 	data.end_handle = end_handle;
 	data.queue = queue;
 
-	queue_foreach(db->services, find_information, &data);
+	foreach_service_overlapping(db, start_handle, end_handle,
+						find_information, &data);
 }
 
 void gatt_db_foreach_service(struct gatt_db *db, const bt_uuid_t *uuid,
@@ -1326,31 +1644,25 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute *attrib,
 								user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
-{
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_UINT(user_data);
-	uint16_t start, end;
-
-	gatt_db_service_get_handles(service, &start, &end);
-
-	return (start <= handle) && (handle <= end);
-}
-
 struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 							uint16_t handle)
 {
 	struct gatt_db_service *service;
+	struct gatt_db_attribute *attrib;
 	int i;
 
 	if (!db || !handle)
 		return NULL;
 
-	service = queue_find(db->services, find_service_for_handle,
-							UINT_TO_PTR(handle));
+	service = index_get(db, handle);
 	if (!service)
 		return NULL;
 
+	/* Attributes are usually allocated in handle order */
+	attrib = service->attributes[handle - service->attributes[0]->handle];
+	if (attrib && attrib->handle == handle)
+		return attrib;
+
 	for (i = 0; i < service->num_handles; i++) {
 		if (!service->attributes[i])
 			continue;
@@ -1754,3 +2066,279 @@ bool gatt_db_attribute_reset(struct gatt_db_attribute *attrib)
 
 	return true;
 }
+
+/*
+ * Attribute caches store one key and value pair per attribute, in handle
+ * order. The key is the handle and the value depends on the attribute type,
+ * see the Attributes group in doc/settings-storage.txt.
+ */
+struct store_data {
+	struct gatt_db *db;
+	gatt_db_store_func_t func;
+	void *user_data;
+};
+
+static void store_attribute(struct store_data *data, uint16_t handle,
+							const char *value)
+{
+	char key[5];
+
+	snprintf(key, sizeof(key), "%04hx", handle);
+
+	data->func(key, value, data->user_data);
+}
+
+static void store_desc(struct gatt_db_attribute *attrib, void *user_data)
+{
+	char uuid_str[MAX_LEN_UUID_STR];
+
+	bt_uuid_to_string(&attrib->uuid, uuid_str, sizeof(uuid_str));
+
+	store_attribute(user_data, attrib->handle, uuid_str);
+}
+
+static void store_chrc(struct gatt_db_attribute *attrib, void *user_data)
+{
+	char value[100], uuid_str[MAX_LEN_UUID_STR];
+	uint16_t handle, value_handle;
+	uint8_t properties;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_char_data(attrib, &handle, &value_handle,
+							&properties, &uuid))
+		return;
+
+	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	snprintf(value, sizeof(value), "%04x:%04hx:%02hhx:%s",
+				GATT_CHARAC_UUID, value_handle, properties,
+				uuid_str);
+
+	store_attribute(user_data, handle, value);
+
+	gatt_db_service_foreach_desc(attrib, store_desc, user_data);
+}
+
+static void store_incl(struct gatt_db_attribute *attrib, void *user_data)
+{
+	struct store_data *data = user_data;
+	struct gatt_db_attribute *service;
+	char value[100], uuid_str[MAX_LEN_UUID_STR];
+	uint16_t handle, start, end;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_incl_data(attrib, &handle, &start, &end))
+		return;
+
+	service = gatt_db_get_attribute(data->db, start);
+	if (!service || !gatt_db_attribute_get_service_uuid(service, &uuid))
+		return;
+
+	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	snprintf(value, sizeof(value), "%04x:%04hx:%04hx:%s",
+				GATT_INCLUDE_UUID, start, end, uuid_str);
+
+	store_attribute(data, handle, value);
+}
+
+static void store_service(struct gatt_db_attribute *attrib, void *user_data)
+{
+	char value[100], uuid_str[MAX_LEN_UUID_STR];
+	uint16_t start, end;
+	bt_uuid_t uuid;
+	bool primary;
+
+	if (!gatt_db_attribute_get_service_data(attrib, &start, &end, &primary,
+								&uuid))
+		return;
+
+	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	snprintf(value, sizeof(value), "%04x:%04hx:%s",
+				primary ? GATT_PRIM_SVC_UUID : GATT_SND_SVC_UUID,
+				end, uuid_str);
+
+	store_attribute(user_data, start, value);
+
+	gatt_db_service_foreach_incl(attrib, store_incl, user_data);
+	gatt_db_service_foreach_char(attrib, store_chrc, user_data);
+}
+
+void gatt_db_store(struct gatt_db *db, gatt_db_store_func_t func,
+							void *user_data)
+{
+	struct store_data data;
+
+	if (!db || !func)
+		return;
+
+	data.db = db;
+	data.func = func;
+	data.user_data = user_data;
+
+	gatt_db_foreach_service(db, NULL, store_service, &data);
+}
+
+static bool load_handle(const char *key, uint16_t *handle)
+{
+	return sscanf(key, "%04hx", handle) == 1;
+}
+
+static bool load_type(const char *value, uint16_t *type)
+{
+	/* Descriptors are stored as a plain UUID without type prefix */
+	if (!strchr(value, ':')) {
+		*type = 0;
+		return true;
+	}
+
+	return sscanf(value, "%04hx:", type) == 1;
+}
+
+static bool is_service_type(uint16_t type)
+{
+	return type == GATT_PRIM_SVC_UUID || type == GATT_SND_SVC_UUID;
+}
+
+static bool load_service(struct gatt_db *db, const char *key,
+							const char *value)
+{
+	char uuid_str[MAX_LEN_UUID_STR];
+	uint16_t start, end, type;
+	bt_uuid_t uuid;
+
+	if (!load_handle(key, &start))
+		return false;
+
+	if (sscanf(value, "%04hx:%04hx:%36s", &type, &end, uuid_str) != 3)
+		return false;
+
+	if (start > end || bt_string_to_uuid(&uuid, uuid_str) < 0)
+		return false;
+
+	return gatt_db_insert_service(db, start, &uuid,
+					type == GATT_PRIM_SVC_UUID,
+					end - start + 1) != NULL;
+}
+
+static bool load_incl(struct gatt_db *db, struct gatt_db_attribute *service,
+					uint16_t handle, const char *value)
+{
+	struct gatt_db_attribute *attrib;
+	uint16_t start, end;
+
+	if (sscanf(value, "%*04x:%04hx:%04hx:", &start, &end) != 2)
+		return false;
+
+	attrib = gatt_db_get_attribute(db, start);
+	if (!attrib)
+		return false;
+
+	attrib = gatt_db_service_add_included(service, attrib);
+
+	return attrib && attrib->handle == handle;
+}
+
+static bool load_chrc(struct gatt_db_attribute *service, const char *value)
+{
+	char uuid_str[MAX_LEN_UUID_STR];
+	uint16_t value_handle, properties;
+	struct gatt_db_attribute *attrib;
+	bt_uuid_t uuid;
+
+	if (sscanf(value, "%*04x:%04hx:%02hx:%36s", &value_handle,
+					&properties, uuid_str) != 3)
+		return false;
+
+	if (bt_string_to_uuid(&uuid, uuid_str) < 0)
+		return false;
+
+	/*
+	 * The declaration is always placed right before the value so the
+	 * value handle is enough to restore both.
+	 */
+	attrib = gatt_db_service_insert_characteristic(service, value_handle,
+							&uuid, 0, properties,
+							NULL, NULL, NULL);
+
+	return attrib && attrib->handle == value_handle;
+}
+
+static bool load_desc(struct gatt_db_attribute *service, uint16_t handle,
+							const char *value)
+{
+	char uuid_str[MAX_LEN_UUID_STR];
+	struct gatt_db_attribute *attrib;
+	bt_uuid_t uuid;
+
+	if (sscanf(value, "%36s", uuid_str) != 1)
+		return false;
+
+	if (bt_string_to_uuid(&uuid, uuid_str) < 0)
+		return false;
+
+	attrib = gatt_db_service_insert_descriptor(service, handle, &uuid, 0,
+							NULL, NULL, NULL);
+
+	return attrib && attrib->handle == handle;
+}
+
+static bool load_attributes(struct gatt_db *db, char **keys, char **values)
+{
+	struct gatt_db_attribute *service = NULL;
+	uint16_t handle, type;
+	bool ret = true;
+	unsigned int i;
+
+	/* First load the service declarations so includes can be resolved */
+	for (i = 0; keys[i]; i++) {
+		if (!values[i] || !load_type(values[i], &type))
+			return false;
+
+		if (is_service_type(type) &&
+					!load_service(db, keys[i], values[i]))
+			return false;
+	}
+
+	/* Then fill them with their attributes */
+	for (i = 0; ret && keys[i]; i++) {
+		if (!load_handle(keys[i], &handle) ||
+					!load_type(values[i], &type)) {
+			ret = false;
+			break;
+		}
+
+		if (is_service_type(type)) {
+			if (service)
+				gatt_db_service_set_active(service, true);
+
+			service = gatt_db_get_attribute(db, handle);
+			ret = service != NULL;
+		} else if (!service)
+			ret = false;
+		else if (type == GATT_INCLUDE_UUID)
+			ret = load_incl(db, service, handle, values[i]);
+		else if (type == GATT_CHARAC_UUID)
+			ret = load_chrc(service, values[i]);
+		else if (!type)
+			ret = load_desc(service, handle, values[i]);
+		else
+			ret = false;
+	}
+
+	if (service)
+		gatt_db_service_set_active(service, true);
+
+	return ret;
+}
+
+bool gatt_db_load(struct gatt_db *db, char **keys, char **values)
+{
+	if (!db || !keys || !values)
+		return false;
+
+	if (!load_attributes(db, keys, values)) {
+		gatt_db_clear(db);
+		return false;
+	}
+
+	return true;
+}
@@ -234,3 +234,10 @@ bool gatt_db_attribute_write_result(struct gatt_db_attribute *attrib,
 						unsigned int id, int err);
 
 bool gatt_db_attribute_reset(struct gatt_db_attribute *attrib);
+
+typedef void (*gatt_db_store_func_t) (const char *key, const char *value,
+							void *user_data);
+
+void gatt_db_store(struct gatt_db *db, gatt_db_store_func_t func,
+							void *user_data);
+bool gatt_db_load(struct gatt_db *db, char **keys, char **values);
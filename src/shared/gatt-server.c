@@ -1483,26 +1483,53 @@ bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length)
 {
-	uint16_t pdu_len;
-	uint8_t *pdu;
-	bool result;
-
-	if (!server || (length && !value))
+	if (!server)
 		return false;
 
-	pdu_len = MIN(bt_att_get_mtu(server->att) - 1, length + 2);
-	pdu = malloc(pdu_len);
+	return bt_gatt_server_broadcast_notification(&server, 1, handle,
+							value, length) == 1;
+}
+
+unsigned int bt_gatt_server_broadcast_notification(
+					struct bt_gatt_server **servers,
+					unsigned int num_servers,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length)
+{
+	struct bt_att_pdu *pdu;
+	struct iovec iov[2];
+	uint8_t hdr[2];
+	unsigned int i, count = 0;
+
+	if (!servers || !num_servers || (length && !value))
+		return 0;
+
+	/*
+	 * Encode the PDU once for all servers. Each bt_att truncates it to its
+	 * own MTU when sending, so the value is never copied again.
+	 */
+	put_le16(handle, hdr);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) value;
+	iov[1].iov_len = length;
+
+	pdu = bt_att_pdu_new(BT_ATT_OP_HANDLE_VAL_NOT, iov, 2);
 	if (!pdu)
-		return false;
+		return 0;
 
-	put_le16(handle, pdu);
-	memcpy(pdu + 2, value, pdu_len - 2);
+	for (i = 0; i < num_servers; i++) {
+		if (!servers[i])
+			continue;
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_VAL_NOT, pdu,
-						pdu_len, NULL, NULL, NULL);
-	free(pdu);
+		if (bt_att_send_pdu(servers[i]->att, pdu))
+			count++;
+	}
 
-	return result;
+	bt_att_pdu_unref(pdu);
+
+	return count;
 }
 
 struct ind_data {
@@ -44,6 +44,12 @@ bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length);
 
+unsigned int bt_gatt_server_broadcast_notification(
+					struct bt_gatt_server **servers,
+					unsigned int num_servers,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length);
+
 bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length,
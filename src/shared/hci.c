@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 
@@ -66,6 +67,9 @@ struct bt_hci {
 	struct queue *cmd_queue;
 	struct queue *rsp_queue;
 	struct queue *evt_list;
+	struct queue *cmd_stats;
+	struct bt_hci_stats stats;
+	uint64_t stall_start;
 };
 
 struct cmd {
@@ -73,6 +77,8 @@ struct cmd {
 	uint16_t opcode;
 	void *data;
 	uint8_t size;
+	uint64_t queue_time;
+	uint64_t send_time;
 	bt_hci_callback_func_t callback;
 	bt_hci_destroy_func_t destroy;
 	void *user_data;
@@ -86,6 +92,63 @@ struct evt {
 	void *user_data;
 };
 
+static uint64_t get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void latency_add(struct bt_hci_latency *latency, uint64_t value)
+{
+	unsigned int bucket = 0;
+
+	/* Bucket n counts values of less than 2^n microseconds */
+	while (bucket < BT_HCI_LATENCY_BUCKETS - 1 && value >> bucket)
+		bucket++;
+
+	latency->buckets[bucket]++;
+	latency->count++;
+	latency->total += value;
+
+	if (value > latency->max)
+		latency->max = value;
+}
+
+static bool match_stats_opcode(const void *a, const void *b)
+{
+	const struct bt_hci_cmd_stats *stats = a;
+	uint16_t opcode = PTR_TO_UINT(b);
+
+	return stats->opcode == opcode;
+}
+
+static struct bt_hci_cmd_stats *get_cmd_stats(struct bt_hci *hci,
+							uint16_t opcode)
+{
+	struct bt_hci_cmd_stats *stats;
+
+	stats = queue_find(hci->cmd_stats, match_stats_opcode,
+						UINT_TO_PTR(opcode));
+	if (stats)
+		return stats;
+
+	stats = new0(struct bt_hci_cmd_stats, 1);
+	if (!stats)
+		return NULL;
+
+	stats->opcode = opcode;
+
+	if (!queue_push_tail(hci->cmd_stats, stats)) {
+		free(stats);
+		return NULL;
+	}
+
+	return stats;
+}
+
 static void cmd_free(void *data)
 {
 	struct cmd *cmd = data;
@@ -107,7 +170,7 @@ static void evt_free(void *data)
 	free(evt);
 }
 
-static void send_command(struct bt_hci *hci, uint16_t opcode,
+static bool send_command(struct bt_hci *hci, uint16_t opcode,
 						void *data, uint8_t size)
 {
 	uint8_t type = BT_H4_CMD_PKT;
@@ -116,7 +179,7 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 	int iovcnt;
 
 	if (hci->num_cmds < 1)
-		return;
+		return false;
 
 	hdr.opcode = cpu_to_le16(opcode);
 	hdr.plen = size;
@@ -134,9 +197,21 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 		iovcnt = 2;
 
 	if (io_send(hci->io, iov, iovcnt) < 0)
-		return;
+		return false;
 
 	hci->num_cmds--;
+
+	return true;
+}
+
+static void start_stall(struct bt_hci *hci)
+{
+	/* Commands are waiting for the controller to allow more */
+	if (hci->stall_start)
+		return;
+
+	hci->stall_start = get_time_us();
+	hci->stats.credit_stalls++;
 }
 
 static bool io_write_callback(struct io *io, void *user_data)
@@ -146,12 +221,25 @@ static bool io_write_callback(struct io *io, void *user_data)
 
 	cmd = queue_pop_head(hci->cmd_queue);
 	if (cmd) {
-		send_command(hci, cmd->opcode, cmd->data, cmd->size);
+		if (send_command(hci, cmd->opcode, cmd->data, cmd->size)) {
+			struct bt_hci_cmd_stats *stats;
+
+			cmd->send_time = get_time_us();
+
+			stats = get_cmd_stats(hci, cmd->opcode);
+			if (stats)
+				latency_add(&stats->queue,
+					cmd->send_time - cmd->queue_time);
+		}
+
 		queue_push_tail(hci->rsp_queue, cmd);
 	}
 
 	hci->writer_active = false;
 
+	if (hci->num_cmds < 1 && !queue_isempty(hci->cmd_queue))
+		start_stall(hci);
+
 	return false;
 }
 
@@ -160,11 +248,13 @@ static void wakeup_writer(struct bt_hci *hci)
 	if (hci->writer_active)
 		return;
 
-	if (hci->num_cmds < 1)
+	if (queue_isempty(hci->cmd_queue))
 		return;
 
-	if (queue_isempty(hci->cmd_queue))
+	if (hci->num_cmds < 1) {
+		start_stall(hci);
 		return;
+	}
 
 	if (!io_set_write_handler(hci->io, io_write_callback, hci, NULL))
 		return;
@@ -193,6 +283,15 @@ static void process_response(struct bt_hci *hci, uint16_t opcode,
 	if (!cmd)
 		return;
 
+	if (cmd->send_time) {
+		struct bt_hci_cmd_stats *stats;
+
+		stats = get_cmd_stats(hci, opcode);
+		if (stats)
+			latency_add(&stats->response,
+					get_time_us() - cmd->send_time);
+	}
+
 	if (cmd->callback)
 		cmd->callback(data, size, cmd->user_data);
 
@@ -212,6 +311,17 @@ static void process_notify(void *data, void *user_data)
 						hdr->plen, evt->user_data);
 }
 
+static void update_num_cmds(struct bt_hci *hci, uint8_t ncmd)
+{
+	hci->num_cmds = ncmd;
+
+	if (ncmd > 0 && hci->stall_start) {
+		hci->stats.credit_stall_time += get_time_us() -
+							hci->stall_start;
+		hci->stall_start = 0;
+	}
+}
+
 static void process_event(struct bt_hci *hci, const void *data, size_t size)
 {
 	const struct bt_hci_evt_hdr *hdr = data;
@@ -232,7 +342,7 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 		if (size < sizeof(*cc))
 			return;
 		cc = data;
-		hci->num_cmds = cc->ncmd;
+		update_num_cmds(hci, cc->ncmd);
 		process_response(hci, le16_to_cpu(cc->opcode),
 						data + sizeof(*cc),
 						size - sizeof(*cc));
@@ -242,7 +352,7 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 		if (size < sizeof(*cs))
 			return;
 		cs = data;
-		hci->num_cmds = cs->ncmd;
+		update_num_cmds(hci, cs->ncmd);
 		process_response(hci, le16_to_cpu(cs->opcode), &cs->status, 1);
 		break;
 
@@ -329,7 +439,18 @@ static struct bt_hci *create_hci(int fd)
 		return NULL;
 	}
 
+	hci->cmd_stats = queue_new();
+	if (!hci->cmd_stats) {
+		queue_destroy(hci->evt_list, NULL);
+		queue_destroy(hci->rsp_queue, NULL);
+		queue_destroy(hci->cmd_queue, NULL);
+		io_destroy(hci->io);
+		free(hci);
+		return NULL;
+	}
+
 	if (!io_set_read_handler(hci->io, io_read_callback, hci, NULL)) {
+		queue_destroy(hci->cmd_stats, NULL);
 		queue_destroy(hci->evt_list, NULL);
 		queue_destroy(hci->rsp_queue, NULL);
 		queue_destroy(hci->cmd_queue, NULL);
@@ -451,6 +572,7 @@ void bt_hci_unref(struct bt_hci *hci)
 	queue_destroy(hci->evt_list, evt_free);
 	queue_destroy(hci->cmd_queue, cmd_free);
 	queue_destroy(hci->rsp_queue, cmd_free);
+	queue_destroy(hci->cmd_stats, free);
 
 	io_destroy(hci->io);
 
@@ -481,6 +603,7 @@ unsigned int bt_hci_send(struct bt_hci *hci, uint16_t opcode,
 
 	cmd->opcode = opcode;
 	cmd->size = size;
+	cmd->queue_time = get_time_us();
 
 	if (cmd->size > 0) {
 		cmd->data = malloc(cmd->size);
@@ -613,3 +736,59 @@ bool bt_hci_unregister(struct bt_hci *hci, unsigned int id)
 
 	return true;
 }
+
+bool bt_hci_get_stats(struct bt_hci *hci, struct bt_hci_stats *stats)
+{
+	if (!hci || !stats)
+		return false;
+
+	*stats = hci->stats;
+
+	/* Include a stall that is still ongoing */
+	if (hci->stall_start)
+		stats->credit_stall_time += get_time_us() - hci->stall_start;
+
+	return true;
+}
+
+struct foreach_stats {
+	bt_hci_cmd_stats_func_t func;
+	void *user_data;
+};
+
+static void foreach_cmd_stats(void *data, void *user_data)
+{
+	struct foreach_stats *foreach = user_data;
+
+	foreach->func(data, foreach->user_data);
+}
+
+bool bt_hci_foreach_cmd_stats(struct bt_hci *hci,
+				bt_hci_cmd_stats_func_t func, void *user_data)
+{
+	struct foreach_stats foreach;
+
+	if (!hci || !func)
+		return false;
+
+	foreach.func = func;
+	foreach.user_data = user_data;
+
+	queue_foreach(hci->cmd_stats, foreach_cmd_stats, &foreach);
+
+	return true;
+}
+
+bool bt_hci_reset_stats(struct bt_hci *hci)
+{
+	if (!hci)
+		return false;
+
+	queue_remove_all(hci->cmd_stats, NULL, NULL, free);
+	memset(&hci->stats, 0, sizeof(hci->stats));
+
+	if (hci->stall_start)
+		hci->stall_start = get_time_us();
+
+	return true;
+}
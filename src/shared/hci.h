@@ -51,3 +51,32 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 				bt_hci_callback_func_t callback,
 				void *user_data, bt_hci_destroy_func_t destroy);
 bool bt_hci_unregister(struct bt_hci *hci, unsigned int id);
+
+/* Latencies in microseconds, bucket n counts values below 2^n usec */
+#define BT_HCI_LATENCY_BUCKETS	24
+
+struct bt_hci_latency {
+	uint32_t count;
+	uint64_t total;
+	uint64_t max;
+	uint32_t buckets[BT_HCI_LATENCY_BUCKETS];
+};
+
+struct bt_hci_cmd_stats {
+	uint16_t opcode;
+	struct bt_hci_latency queue;
+	struct bt_hci_latency response;
+};
+
+struct bt_hci_stats {
+	uint32_t credit_stalls;
+	uint64_t credit_stall_time;
+};
+
+typedef void (*bt_hci_cmd_stats_func_t)(const struct bt_hci_cmd_stats *stats,
+							void *user_data);
+
+bool bt_hci_get_stats(struct bt_hci *hci, struct bt_hci_stats *stats);
+bool bt_hci_foreach_cmd_stats(struct bt_hci *hci,
+				bt_hci_cmd_stats_func_t func, void *user_data);
+bool bt_hci_reset_stats(struct bt_hci *hci);
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
@@ -52,17 +53,35 @@ struct mainloop_data {
 	void *user_data;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MIN_MAINLOOP_ENTRIES 128
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_list_size;
+
+#define TIMEOUT_NOT_QUEUED UINT32_MAX
 
 struct timeout_data {
-	int fd;
+	int id;
+	uint64_t expire;		/* Absolute CLOCK_MONOTONIC time in ns */
+	uint32_t index;			/* Position in timeout_heap */
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+/*
+ * All timeouts are multiplexed onto a single timerfd, armed for the earliest
+ * expiration found at the top of a binary min-heap. Timeout ids are indexes
+ * in timeout_list plus one.
+ */
+static int timeout_fd = -1;
+static uint64_t timeout_armed;
+static struct timeout_data **timeout_list;
+static unsigned int timeout_list_size;
+static struct timeout_data **timeout_heap;
+static unsigned int timeout_heap_len;
+static unsigned int timeout_heap_size;
+
 struct signal_data {
 	int fd;
 	sigset_t mask;
@@ -75,12 +94,11 @@ static struct signal_data *signal_data;
 
 void mainloop_init(void)
 {
-	unsigned int i;
-
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
 
 	epoll_terminate = 0;
 }
@@ -167,7 +185,7 @@ int mainloop_run(void)
 			signal_data->destroy(signal_data->user_data);
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	for (i = 0; i < mainloop_list_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
@@ -182,12 +200,39 @@ int mainloop_run(void)
 		}
 	}
 
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
 	return exit_status;
 }
 
+static int mainloop_list_grow(int fd)
+{
+	struct mainloop_data **list;
+	unsigned int size;
+
+	size = mainloop_list_size ? mainloop_list_size : MIN_MAINLOOP_ENTRIES;
+
+	while (size <= (unsigned int) fd)
+		size *= 2;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + mainloop_list_size, 0,
+			(size - mainloop_list_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_list_size = size;
+
+	return 0;
+}
+
 int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 				void *user_data, mainloop_destroy_func destroy)
 {
@@ -195,9 +240,15 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if ((unsigned int) fd >= mainloop_list_size) {
+		err = mainloop_list_grow(fd);
+		if (err < 0)
+			return err;
+	}
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -230,7 +281,7 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
 		return -EINVAL;
 
 	data = mainloop_list[fd];
@@ -255,7 +306,7 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
 		return -EINVAL;
 
 	data = mainloop_list[fd];
@@ -274,46 +325,268 @@ int mainloop_remove_fd(int fd)
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static uint64_t timeout_now(void)
 {
-	struct timeout_data *data = user_data;
+	struct timespec ts;
 
-	close(data->fd);
-	data->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void heap_set(unsigned int index, struct timeout_data *data)
+{
+	timeout_heap[index] = data;
+	data->index = index;
+}
+
+static void heap_up(unsigned int index)
+{
+	struct timeout_data *data = timeout_heap[index];
+
+	while (index > 0) {
+		unsigned int parent = (index - 1) / 2;
+
+		if (timeout_heap[parent]->expire <= data->expire)
+			break;
+
+		heap_set(index, timeout_heap[parent]);
+		index = parent;
+	}
+
+	heap_set(index, data);
+}
+
+static void heap_down(unsigned int index)
+{
+	struct timeout_data *data = timeout_heap[index];
+
+	while (1) {
+		unsigned int child = index * 2 + 1;
+
+		if (child >= timeout_heap_len)
+			break;
+
+		if (child + 1 < timeout_heap_len &&
+				timeout_heap[child + 1]->expire <
+						timeout_heap[child]->expire)
+			child++;
+
+		if (data->expire <= timeout_heap[child]->expire)
+			break;
+
+		heap_set(index, timeout_heap[child]);
+		index = child;
+	}
+
+	heap_set(index, data);
+}
+
+static void heap_remove(struct timeout_data *data)
+{
+	unsigned int index = data->index;
+	struct timeout_data *last;
+
+	if (index == TIMEOUT_NOT_QUEUED)
+		return;
+
+	data->index = TIMEOUT_NOT_QUEUED;
+
+	last = timeout_heap[--timeout_heap_len];
+	if (last == data)
+		return;
+
+	heap_set(index, last);
+
+	if (index > 0 && timeout_heap[(index - 1) / 2]->expire > last->expire)
+		heap_up(index);
+	else
+		heap_down(index);
+}
+
+static int heap_insert(struct timeout_data *data)
+{
+	if (timeout_heap_len == timeout_heap_size) {
+		struct timeout_data **heap;
+		unsigned int size;
+
+		size = timeout_heap_size ? timeout_heap_size * 2 : 16;
+
+		heap = realloc(timeout_heap, size * sizeof(*heap));
+		if (!heap)
+			return -ENOMEM;
+
+		timeout_heap = heap;
+		timeout_heap_size = size;
+	}
+
+	heap_set(timeout_heap_len++, data);
+	heap_up(data->index);
+
+	return 0;
+}
+
+/* Arms the timerfd for the earliest timeout, if it has changed */
+static void timeout_rearm(void)
+{
+	struct itimerspec itimer;
+	uint64_t expire;
+
+	expire = timeout_heap_len ? timeout_heap[0]->expire : 0;
+	if (expire == timeout_armed)
+		return;
+
+	memset(&itimer, 0, sizeof(itimer));
+	itimer.it_value.tv_sec = expire / 1000000000ULL;
+	itimer.it_value.tv_nsec = expire % 1000000000ULL;
+
+	if (timerfd_settime(timeout_fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	timeout_armed = expire;
+}
+
+static void timeout_free(struct timeout_data *data)
+{
+	timeout_list[data->id - 1] = NULL;
 
 	if (data->destroy)
 		data->destroy(data->user_data);
+
+	free(data);
+}
+
+static void timeout_destroy(void *user_data)
+{
+	unsigned int i;
+
+	close(timeout_fd);
+	timeout_fd = -1;
+	timeout_armed = 0;
+
+	timeout_heap_len = 0;
+
+	for (i = 0; i < timeout_list_size; i++) {
+		if (timeout_list[i])
+			timeout_free(timeout_list[i]);
+	}
+
+	free(timeout_list);
+	timeout_list = NULL;
+	timeout_list_size = 0;
+
+	free(timeout_heap);
+	timeout_heap = NULL;
+	timeout_heap_size = 0;
 }
 
 static void timeout_callback(int fd, uint32_t events, void *user_data)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
+	uint64_t expired, now;
 	ssize_t result;
 
 	if (events & (EPOLLERR | EPOLLHUP))
 		return;
 
-	result = read(data->fd, &expired, sizeof(expired));
+	result = read(fd, &expired, sizeof(expired));
 	if (result != sizeof(expired))
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	/* The timerfd is disarmed once it has expired */
+	timeout_armed = 0;
+
+	now = timeout_now();
+
+	/*
+	 * Callbacks may add, modify or remove any timeout so the top of the
+	 * heap is checked again after each one.
+	 */
+	while (timeout_heap_len && timeout_heap[0]->expire <= now) {
+		struct timeout_data *data = timeout_heap[0];
+
+		heap_remove(data);
+
+		if (data->callback)
+			data->callback(data->id, data->user_data);
+	}
+
+	if (timeout_fd >= 0)
+		timeout_rearm();
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static int timeout_init(void)
 {
-	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	timeout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timeout_fd < 0)
+		return -EIO;
 
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000;
+	if (mainloop_add_fd(timeout_fd, EPOLLIN, timeout_callback, NULL,
+						timeout_destroy) < 0) {
+		close(timeout_fd);
+		timeout_fd = -1;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int timeout_alloc_id(struct timeout_data *data)
+{
+	struct timeout_data **list;
+	unsigned int i, size;
+
+	for (i = 0; i < timeout_list_size; i++) {
+		if (!timeout_list[i])
+			goto done;
+	}
+
+	size = timeout_list_size ? timeout_list_size * 2 : 16;
+
+	list = realloc(timeout_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + timeout_list_size, 0,
+				(size - timeout_list_size) * sizeof(*list));
+
+	timeout_list = list;
+	timeout_list_size = size;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+done:
+	timeout_list[i] = data;
+	data->id = i + 1;
+
+	return data->id;
+}
+
+static struct timeout_data *timeout_lookup(int id)
+{
+	if (id <= 0 || (unsigned int) id > timeout_list_size)
+		return NULL;
+
+	return timeout_list[id - 1];
+}
+
+static int timeout_set(struct timeout_data *data, unsigned int msec)
+{
+	int err;
+
+	heap_remove(data);
+
+	/* A timeout of zero leaves it disarmed */
+	if (!msec)
+		goto done;
+
+	data->expire = timeout_now() + msec * 1000000ULL;
+
+	err = heap_insert(data);
+	if (err < 0)
+		return err;
+
+done:
+	timeout_rearm();
+
+	return 0;
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
@@ -324,47 +597,42 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	if (!callback)
 		return -EINVAL;
 
+	if (timeout_fd < 0 && timeout_init() < 0)
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
 
 	memset(data, 0, sizeof(*data));
+	data->index = TIMEOUT_NOT_QUEUED;
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
+	if (timeout_alloc_id(data) < 0) {
 		free(data);
-		return -EIO;
-	}
-
-	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
+		return -ENOMEM;
 	}
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
+	if (timeout_set(data, msec) < 0) {
+		timeout_list[data->id - 1] = NULL;
 		free(data);
 		return -EIO;
 	}
 
-	return data->fd;
+	return data->id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
-	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
+	data = timeout_lookup(id);
+	if (!data)
+		return -EIO;
+
+	if (timeout_set(data, msec) < 0)
 		return -EIO;
 
 	return 0;
@@ -372,7 +640,18 @@ int mainloop_modify_timeout(int id, unsigned int msec)
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	heap_remove(data);
+	timeout_rearm();
+
+	timeout_free(data);
+
+	return 0;
 }
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
@@ -49,6 +49,7 @@ struct mgmt {
 	struct queue *reply_queue;
 	struct queue *pending_list;
 	struct queue *notify_list;
+	unsigned int max_pending;
 	unsigned int next_request_id;
 	unsigned int next_notify_id;
 	void *buf;
@@ -64,6 +65,7 @@ struct mgmt_request {
 	uint16_t index;
 	void *buf;
 	uint16_t len;
+	bool unordered;
 	mgmt_request_func_t callback;
 	mgmt_destroy_func_t destroy;
 	void *user_data;
@@ -169,6 +171,94 @@ static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 	return true;
 }
 
+struct opcode_index {
+	uint16_t opcode;
+	uint16_t index;
+};
+
+static bool match_request_opcode_index(const void *a, const void *b)
+{
+	const struct mgmt_request *request = a;
+	const struct opcode_index *match = b;
+
+	return request->opcode == match->opcode &&
+					request->index == match->index;
+}
+
+static bool match_ordered_request_index(const void *a, const void *b)
+{
+	const struct mgmt_request *request = a;
+	uint16_t index = PTR_TO_UINT(b);
+
+	return request->index == index && !request->unordered;
+}
+
+/*
+ * Upper bound for the number of different indexes considered when looking
+ * for a request that can be sent next. This keeps the queue scan cheap even
+ * with thousands of queued requests for a single controller.
+ */
+#define MAX_SCAN_INDEXES 16
+
+static bool request_can_be_sent(struct mgmt *mgmt,
+					struct mgmt_request *request)
+{
+	struct opcode_index match = { .opcode = request->opcode,
+					.index = request->index };
+
+	/*
+	 * Ordinary requests wait for everything else in flight for the
+	 * same index. Unordered requests only wait for ordinary requests
+	 * and for an identical opcode, since responses are matched by
+	 * opcode and index.
+	 */
+	if (!request->unordered)
+		return !queue_find(mgmt->pending_list, match_request_index,
+						UINT_TO_PTR(request->index));
+
+	if (queue_find(mgmt->pending_list, match_ordered_request_index,
+						UINT_TO_PTR(request->index)))
+		return false;
+
+	return !queue_find(mgmt->pending_list, match_request_opcode_index,
+								&match);
+}
+
+static struct mgmt_request *next_request(struct mgmt *mgmt)
+{
+	const struct queue_entry *entry;
+	uint16_t seen[MAX_SCAN_INDEXES];
+	unsigned int num_seen = 0;
+
+	if (queue_length(mgmt->pending_list) >= mgmt->max_pending)
+		return NULL;
+
+	for (entry = queue_get_entries(mgmt->request_queue); entry;
+							entry = entry->next) {
+		struct mgmt_request *request = entry->data;
+		unsigned int i;
+
+		/* Only the oldest queued request of each index is eligible */
+		for (i = 0; i < num_seen; i++) {
+			if (seen[i] == request->index)
+				break;
+		}
+
+		if (i < num_seen)
+			continue;
+
+		if (request_can_be_sent(mgmt, request))
+			return request;
+
+		if (num_seen == MAX_SCAN_INDEXES)
+			break;
+
+		seen[num_seen++] = request->index;
+	}
+
+	return NULL;
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct mgmt *mgmt = user_data;
@@ -178,14 +268,14 @@ static bool can_write_data(struct io *io, void *user_data)
 	request = queue_pop_head(mgmt->reply_queue);
 	if (!request) {
 		/* only reply commands can jump the queue */
-		if (!queue_isempty(mgmt->pending_list))
-			return false;
-
-		request = queue_pop_head(mgmt->request_queue);
+		request = next_request(mgmt);
 		if (!request)
 			return false;
 
-		can_write = false;
+		queue_remove(mgmt->request_queue, request);
+
+		/* in pipelined mode further requests might be ready */
+		can_write = mgmt->max_pending > 1;
 	} else {
 		/* allow multiple replies to jump the queue */
 		can_write = !queue_isempty(mgmt->reply_queue);
@@ -200,8 +290,11 @@ static bool can_write_data(struct io *io, void *user_data)
 static void wakeup_writer(struct mgmt *mgmt)
 {
 	if (!queue_isempty(mgmt->pending_list)) {
-		/* only queued reply commands trigger wakeup */
-		if (queue_isempty(mgmt->reply_queue))
+		/*
+		 * only queued reply commands or, in pipelined mode,
+		 * requests for another index trigger wakeup
+		 */
+		if (queue_isempty(mgmt->reply_queue) && !next_request(mgmt))
 			return;
 	}
 
@@ -214,20 +307,6 @@ static void wakeup_writer(struct mgmt *mgmt)
 						write_watch_destroy);
 }
 
-struct opcode_index {
-	uint16_t opcode;
-	uint16_t index;
-};
-
-static bool match_request_opcode_index(const void *a, const void *b)
-{
-	const struct mgmt_request *request = a;
-	const struct opcode_index *match = b;
-
-	return request->opcode == match->opcode &&
-					request->index == match->index;
-}
-
 static void request_complete(struct mgmt *mgmt, uint8_t status,
 					uint16_t opcode, uint16_t index,
 					uint16_t length, const void *param)
@@ -423,6 +502,7 @@ struct mgmt *mgmt_new(int fd)
 	}
 
 	mgmt->writer_active = false;
+	mgmt->max_pending = 1;
 
 	return mgmt_ref(mgmt);
 }
@@ -534,6 +614,18 @@ bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 	return true;
 }
 
+bool mgmt_set_pipeline(struct mgmt *mgmt, unsigned int max_pending)
+{
+	if (!mgmt)
+		return false;
+
+	mgmt->max_pending = max_pending ? max_pending : 1;
+
+	wakeup_writer(mgmt);
+
+	return true;
+}
+
 static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
@@ -577,8 +669,9 @@ static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 	return request;
 }
 
-unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
-				uint16_t length, const void *param,
+static unsigned int queue_request(struct mgmt *mgmt, uint16_t opcode,
+				uint16_t index, uint16_t length,
+				const void *param, bool unordered,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy)
 {
@@ -596,6 +689,7 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 		mgmt->next_request_id = 1;
 
 	request->id = mgmt->next_request_id++;
+	request->unordered = unordered;
 
 	if (!queue_push_tail(mgmt->request_queue, request)) {
 		free(request->buf);
@@ -608,6 +702,25 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	return request->id;
 }
 
+unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
+				uint16_t length, const void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	return queue_request(mgmt, opcode, index, length, param, false,
+					callback, user_data, destroy);
+}
+
+unsigned int mgmt_send_unordered(struct mgmt *mgmt, uint16_t opcode,
+				uint16_t index, uint16_t length,
+				const void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	return queue_request(mgmt, opcode, index, length, param, true,
+					callback, user_data, destroy);
+}
+
 unsigned int mgmt_send_nowait(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
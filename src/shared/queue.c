@@ -25,9 +25,20 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
+/*
+ * Freed entries are kept on a per-thread free list so that busy queues do
+ * not hit the allocator on every push and pop.
+ */
+#define ENTRY_POOL_MAX 64
+
+static __thread struct queue_entry *entry_pool;
+static __thread unsigned int entry_pool_len;
+
 struct queue {
 	int ref_count;
 	struct queue_entry *head;
@@ -93,22 +104,52 @@ static void queue_entry_unref(struct queue_entry *entry)
 	if (__sync_sub_and_fetch(&entry->ref_count, 1))
 		return;
 
-	free(entry);
+	if (entry_pool_len >= ENTRY_POOL_MAX) {
+		free(entry);
+		return;
+	}
+
+	entry->next = entry_pool;
+	entry_pool = entry;
+	entry_pool_len++;
 }
 
 static struct queue_entry *queue_entry_new(void *data)
 {
 	struct queue_entry *entry;
 
-	entry = new0(struct queue_entry, 1);
-	if (!entry)
-		return NULL;
+	entry = entry_pool;
+	if (entry) {
+		entry_pool = entry->next;
+		entry_pool_len--;
+		memset(entry, 0, sizeof(*entry));
+	} else {
+		entry = new0(struct queue_entry, 1);
+		if (!entry)
+			return NULL;
+	}
 
 	entry->data = data;
 
 	return queue_entry_ref(entry);
 }
 
+/*
+ * Releases the free list of the calling thread. Threads other than the main
+ * one need to call this before they exit, otherwise the entries are leaked.
+ */
+void queue_pool_drain(void)
+{
+	while (entry_pool) {
+		struct queue_entry *entry = entry_pool;
+
+		entry_pool = entry->next;
+		free(entry);
+	}
+
+	entry_pool_len = 0;
+}
+
 bool queue_push_tail(struct queue *queue, void *data)
 {
 	struct queue_entry *entry;
@@ -34,6 +34,7 @@ struct queue_entry {
 };
 
 struct queue *queue_new(void);
+void queue_pool_drain(void);
 void queue_destroy(struct queue *queue, queue_destroy_func_t destroy);
 
 bool queue_push_tail(struct queue *queue, void *data);
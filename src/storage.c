@@ -27,14 +27,18 @@
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -43,6 +47,9 @@
 #include "lib/sdp_lib.h"
 #include "lib/uuid.h"
 
+#include "src/shared/util.h"
+#include "log.h"
+#include "hcid.h"
 #include "textfile.h"
 #include "uuid-helper.h"
 #include "storage.h"
@@ -196,3 +203,786 @@ sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
 	}
 	return NULL;
 }
+
+/*
+ * Consolidated device storage index
+ *
+ * The per device keyfiles (info, attributes and cache) remain the
+ * authoritative storage and are always written. In addition every update
+ * done through storage_set_contents() is appended to a per adapter log
+ * file, so that on startup all device files can be served from a single
+ * mmap instead of opening and reading thousands of small files.
+ *
+ * The log is rebuilt from the keyfiles whenever it is missing, was not
+ * closed cleanly or the storage directories have been modified behind
+ * its back. Stale records are dropped by compacting the log on load.
+ */
+
+#define INDEX_FILENAME		"storage.idx"
+#define INDEX_MAGIC		"BZSTIDX"
+#define INDEX_VERSION		1
+#define INDEX_HDR_SIZE		16
+#define INDEX_FLAG_CLEAN	0x00000001
+
+#define RECORD_HDR_SIZE		8
+#define RECORD_FLAG_REMOVED	0x0001
+
+#define COMPACT_MIN_SIZE	(64 * 1024)
+
+struct index_entry {
+	const uint8_t *data;
+	uint32_t len;
+	uint8_t *buf;
+};
+
+struct storage_index {
+	char address[18];
+	char *filename;
+	int fd;
+	void *map;
+	size_t map_size;
+	size_t size;
+	size_t live;
+	GHashTable *entries;
+};
+
+static GSList *indexes = NULL;
+
+static size_t record_size(const char *path, uint32_t len)
+{
+	return RECORD_HDR_SIZE + strlen(path) + len;
+}
+
+static void entry_free(gpointer data)
+{
+	struct index_entry *entry = data;
+
+	g_free(entry->buf);
+	g_free(entry);
+}
+
+static struct storage_index *find_index(const char *address)
+{
+	GSList *l;
+
+	for (l = indexes; l; l = l->next) {
+		struct storage_index *index = l->data;
+
+		if (!strcmp(index->address, address))
+			return index;
+	}
+
+	return NULL;
+}
+
+/*
+ * Splits STORAGEDIR/<adapter>/<path> into the adapter address and the
+ * path relative to the adapter directory.
+ */
+static const char *index_path(const char *filename, char *address)
+{
+	size_t len = strlen(STORAGEDIR);
+
+	if (strncmp(filename, STORAGEDIR "/", len + 1))
+		return NULL;
+
+	filename += len + 1;
+
+	if (strlen(filename) < 19 || filename[17] != '/')
+		return NULL;
+
+	memcpy(address, filename, 17);
+	address[17] = '\0';
+
+	return filename + 18;
+}
+
+static void index_replace(struct storage_index *index, const char *path,
+				const uint8_t *data, uint32_t len, uint8_t *buf)
+{
+	struct index_entry *entry;
+
+	entry = g_hash_table_lookup(index->entries, path);
+	if (entry)
+		index->live -= record_size(path, entry->len);
+
+	entry = g_new0(struct index_entry, 1);
+	entry->data = buf ? buf : data;
+	entry->len = len;
+	entry->buf = buf;
+
+	g_hash_table_replace(index->entries, g_strdup(path), entry);
+	index->live += record_size(path, len);
+}
+
+static void index_remove(struct storage_index *index, const char *path)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	size_t len = strlen(path);
+
+	/* Removing a directory drops everything stored below it */
+	g_hash_table_iter_init(&iter, index->entries);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct index_entry *entry = value;
+		const char *str = key;
+
+		if (strncmp(str, path, len))
+			continue;
+
+		if (str[len] != '\0' && str[len] != '/')
+			continue;
+
+		index->live -= record_size(str, entry->len);
+		g_hash_table_iter_remove(&iter);
+	}
+}
+
+static void index_unmap(struct storage_index *index)
+{
+	if (index->entries) {
+		g_hash_table_destroy(index->entries);
+		index->entries = NULL;
+	}
+
+	if (index->map) {
+		munmap(index->map, index->map_size);
+		index->map = NULL;
+		index->map_size = 0;
+	}
+}
+
+static bool newer_than(const struct stat *st, const struct stat *ref)
+{
+	if (st->st_mtim.tv_sec != ref->st_mtim.tv_sec)
+		return st->st_mtim.tv_sec > ref->st_mtim.tv_sec;
+
+	return st->st_mtim.tv_nsec > ref->st_mtim.tv_nsec;
+}
+
+/*
+ * Keyfiles are replaced by renaming a new file over them, which updates
+ * the modification time of the containing directory. So any update not
+ * recorded in the log shows up as a directory newer than the log.
+ */
+static bool index_is_stale(struct storage_index *index)
+{
+	char dirname[PATH_MAX];
+	struct stat st, dir_st;
+	struct dirent *entry;
+	bool stale = false;
+	DIR *dir;
+
+	if (stat(index->filename, &st) < 0)
+		return true;
+
+	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s", index->address);
+
+	dir = opendir(dirname);
+	if (!dir)
+		return true;
+
+	if (fstat(dirfd(dir), &dir_st) < 0 || newer_than(&dir_st, &st))
+		stale = true;
+
+	while (!stale && (entry = readdir(dir)) != NULL) {
+		if (bachk(entry->d_name) < 0 && strcmp(entry->d_name, "cache"))
+			continue;
+
+		if (fstatat(dirfd(dir), entry->d_name, &dir_st, 0) < 0)
+			continue;
+
+		if (S_ISDIR(dir_st.st_mode) && newer_than(&dir_st, &st))
+			stale = true;
+	}
+
+	closedir(dir);
+
+	return stale;
+}
+
+static bool index_map(struct storage_index *index)
+{
+	const uint8_t *ptr;
+	struct stat st;
+	size_t offset;
+	int fd;
+
+	fd = open(index->filename, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < INDEX_HDR_SIZE) {
+		close(fd);
+		return false;
+	}
+
+	index->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (index->map == MAP_FAILED) {
+		index->map = NULL;
+		close(fd);
+		return false;
+	}
+
+	index->map_size = st.st_size;
+	ptr = index->map;
+
+	if (memcmp(ptr, INDEX_MAGIC, 8) ||
+				get_le32(ptr + 8) != INDEX_VERSION ||
+				!(get_le32(ptr + 12) & INDEX_FLAG_CLEAN))
+		goto failed;
+
+	index->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, entry_free);
+	index->live = 0;
+
+	for (offset = INDEX_HDR_SIZE; offset < index->map_size;) {
+		uint16_t path_len, flags;
+		uint32_t data_len;
+		char *path;
+
+		if (index->map_size - offset < RECORD_HDR_SIZE)
+			goto failed;
+
+		path_len = get_le16(ptr + offset);
+		flags = get_le16(ptr + offset + 2);
+		data_len = get_le32(ptr + offset + 4);
+		offset += RECORD_HDR_SIZE;
+
+		if (index->map_size - offset < (size_t) path_len + data_len)
+			goto failed;
+
+		path = g_strndup((const char *) ptr + offset, path_len);
+		offset += path_len;
+
+		if (flags & RECORD_FLAG_REMOVED)
+			index_remove(index, path);
+		else
+			index_replace(index, path, ptr + offset, data_len,
+									NULL);
+
+		g_free(path);
+		offset += data_len;
+	}
+
+	index->fd = fd;
+	index->size = index->map_size;
+
+	return true;
+
+failed:
+	index_unmap(index);
+	close(fd);
+	return false;
+}
+
+static bool write_record(int fd, size_t offset, const char *path,
+				uint16_t flags, const void *data, uint32_t len)
+{
+	uint8_t hdr[RECORD_HDR_SIZE];
+	struct iovec iov[3];
+	size_t path_len = strlen(path);
+	ssize_t ret;
+
+	put_le16(path_len, hdr);
+	put_le16(flags, hdr + 2);
+	put_le32(len, hdr + 4);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) path;
+	iov[1].iov_len = path_len;
+	iov[2].iov_base = (void *) data;
+	iov[2].iov_len = len;
+
+	ret = pwritev(fd, iov, 3, offset);
+
+	return ret == (ssize_t) (sizeof(hdr) + path_len + len);
+}
+
+static bool write_header(int fd, uint32_t flags)
+{
+	uint8_t hdr[INDEX_HDR_SIZE];
+
+	memcpy(hdr, INDEX_MAGIC, 8);
+	put_le32(INDEX_VERSION, hdr + 8);
+	put_le32(flags, hdr + 12);
+
+	return pwrite(fd, hdr, sizeof(hdr), 0) == sizeof(hdr);
+}
+
+/* Writes all live entries into a fresh, cleanly closed log */
+static bool index_write(struct storage_index *index, GHashTable *entries)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	char *tmpname;
+	size_t offset = INDEX_HDR_SIZE;
+	int fd;
+
+	tmpname = g_strdup_printf("%s.tmp", index->filename);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		g_free(tmpname);
+		return false;
+	}
+
+	g_hash_table_iter_init(&iter, entries);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct index_entry *entry = value;
+
+		if (!write_record(fd, offset, key, 0, entry->data, entry->len))
+			goto failed;
+
+		offset += record_size(key, entry->len);
+	}
+
+	if (!write_header(fd, INDEX_FLAG_CLEAN) || fdatasync(fd) < 0)
+		goto failed;
+
+	close(fd);
+
+	if (rename(tmpname, index->filename) < 0) {
+		unlink(tmpname);
+		g_free(tmpname);
+		return false;
+	}
+
+	g_free(tmpname);
+	return true;
+
+failed:
+	close(fd);
+	unlink(tmpname);
+	g_free(tmpname);
+	return false;
+}
+
+static void import_file(GHashTable *entries, const char *dirname,
+							const char *path)
+{
+	struct index_entry *entry;
+	char filename[PATH_MAX];
+	gchar *data;
+	gsize len;
+
+	snprintf(filename, PATH_MAX, "%s/%s", dirname, path);
+
+	if (!g_file_get_contents(filename, &data, &len, NULL))
+		return;
+
+	entry = g_new0(struct index_entry, 1);
+	entry->buf = (uint8_t *) data;
+	entry->data = entry->buf;
+	entry->len = len;
+
+	g_hash_table_replace(entries, g_strdup(path), entry);
+}
+
+/* Builds the log from the keyfile based storage of the adapter */
+static bool index_import(struct storage_index *index)
+{
+	GHashTable *entries;
+	char dirname[PATH_MAX], path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	bool ret;
+
+	DBG("importing device storage of %s", index->address);
+
+	entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, entry_free);
+
+	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s", index->address);
+
+	dir = opendir(dirname);
+	if (dir) {
+		while ((entry = readdir(dir)) != NULL) {
+			if (bachk(entry->d_name) < 0)
+				continue;
+
+			snprintf(path, PATH_MAX, "%s/info", entry->d_name);
+			import_file(entries, dirname, path);
+
+			snprintf(path, PATH_MAX, "%s/attributes",
+							entry->d_name);
+			import_file(entries, dirname, path);
+		}
+
+		closedir(dir);
+	}
+
+	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s/cache", index->address);
+
+	dir = opendir(dirname);
+	if (dir) {
+		snprintf(dirname, PATH_MAX, STORAGEDIR "/%s", index->address);
+
+		while ((entry = readdir(dir)) != NULL) {
+			if (bachk(entry->d_name) < 0)
+				continue;
+
+			snprintf(path, PATH_MAX, "cache/%s", entry->d_name);
+			import_file(entries, dirname, path);
+		}
+
+		closedir(dir);
+	}
+
+	ret = index_write(index, entries);
+
+	g_hash_table_destroy(entries);
+
+	return ret;
+}
+
+static void index_free(struct storage_index *index)
+{
+	index_unmap(index);
+
+	if (index->fd >= 0)
+		close(index->fd);
+
+	g_free(index->filename);
+	g_free(index);
+}
+
+static void index_append(const char *filename, uint16_t flags,
+					const gchar *data, gsize length)
+{
+	struct storage_index *index;
+	char address[18];
+	const char *path;
+
+	path = index_path(filename, address);
+	if (!path)
+		return;
+
+	index = find_index(address);
+	if (!index)
+		return;
+
+	if (!write_record(index->fd, index->size, path, flags, data,
+								length)) {
+		error("Unable to update storage index for %s", address);
+
+		/* Better rebuild the log than to serve outdated data */
+		indexes = g_slist_remove(indexes, index);
+		index_free(index);
+		return;
+	}
+
+	index->size += record_size(path, length);
+
+	if (!index->entries)
+		return;
+
+	if (flags & RECORD_FLAG_REMOVED)
+		index_remove(index, path);
+	else
+		index_replace(index, path, NULL, length,
+					(uint8_t *) g_memdup(data, length));
+}
+
+/*
+ * Write-back of device storage files
+ *
+ * With a non-zero StorageDelay the contents passed to
+ * storage_set_contents() are only kept in memory and written out once the
+ * delay expires, so that a burst of updates to the same file results in a
+ * single write. Reads through storage_load_key_file() see pending data.
+ */
+
+struct pending_write {
+	gchar *data;
+	gsize length;
+};
+
+/* Counters are reported on cleanup, progress of flushes in debug output */
+struct storage_stats {
+	unsigned int pending;
+	unsigned long updates;
+	unsigned long coalesced;
+	unsigned long writes;
+	unsigned long errors;
+};
+
+static GHashTable *pending_writes = NULL;
+static guint flush_id = 0;
+static struct storage_stats stats;
+
+static void pending_write_free(gpointer data)
+{
+	struct pending_write *pending = data;
+
+	g_free(pending->data);
+	g_free(pending);
+}
+
+static gboolean write_file(const char *filename, const gchar *data,
+								gsize length)
+{
+	stats.writes++;
+
+	if (!g_file_set_contents(filename, data, length, NULL)) {
+		stats.errors++;
+		return FALSE;
+	}
+
+	index_append(filename, 0, data, length);
+
+	return TRUE;
+}
+
+static bool path_has_prefix(const char *path, const char *prefix)
+{
+	size_t len = strlen(prefix);
+
+	if (strncmp(path, prefix, len))
+		return false;
+
+	return path[len] == '\0' || path[len] == '/';
+}
+
+/* Writes out all pending files below prefix, or all if prefix is NULL */
+static void flush_pending(const char *prefix)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	unsigned int count = 0;
+
+	if (!pending_writes)
+		return;
+
+	g_hash_table_iter_init(&iter, pending_writes);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct pending_write *pending = value;
+
+		if (prefix && !path_has_prefix(key, prefix))
+			continue;
+
+		write_file(key, pending->data, pending->length);
+		g_hash_table_iter_remove(&iter);
+		count++;
+	}
+
+	stats.pending = g_hash_table_size(pending_writes);
+
+	if (count)
+		DBG("flushed %u files (%u pending, %lu coalesced updates)",
+					count, stats.pending, stats.coalesced);
+
+	if (!stats.pending && flush_id) {
+		g_source_remove(flush_id);
+		flush_id = 0;
+	}
+}
+
+static gboolean flush_timeout(gpointer user_data)
+{
+	flush_id = 0;
+
+	flush_pending(NULL);
+
+	return FALSE;
+}
+
+static void drop_pending(const char *prefix)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (!pending_writes)
+		return;
+
+	g_hash_table_iter_init(&iter, pending_writes);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (path_has_prefix(key, prefix))
+			g_hash_table_iter_remove(&iter);
+	}
+
+	stats.pending = g_hash_table_size(pending_writes);
+}
+
+int storage_index_open(const char *address)
+{
+	struct storage_index *index;
+
+	if (find_index(address))
+		return -EALREADY;
+
+	index = g_new0(struct storage_index, 1);
+	index->fd = -1;
+	strncpy(index->address, address, sizeof(index->address) - 1);
+	index->filename = g_strdup_printf(STORAGEDIR "/%s/" INDEX_FILENAME,
+								address);
+
+	if (index_is_stale(index) || !index_map(index)) {
+		if (!index_import(index) || !index_map(index)) {
+			error("Unable to create storage index for %s",
+								address);
+			index_free(index);
+			return -EIO;
+		}
+	} else if (index->size > COMPACT_MIN_SIZE &&
+					index->size > 2 * index->live) {
+		DBG("compacting storage index of %s", address);
+
+		if (index_write(index, index->entries)) {
+			index_unmap(index);
+			close(index->fd);
+			index->fd = -1;
+
+			if (!index_map(index)) {
+				index_free(index);
+				return -EIO;
+			}
+		}
+	}
+
+	/* Mark the log as in use until it gets closed again */
+	if (!write_header(index->fd, 0)) {
+		index_free(index);
+		return -EIO;
+	}
+
+	DBG("%s: %u entries", address, g_hash_table_size(index->entries));
+
+	indexes = g_slist_prepend(indexes, index);
+
+	return 0;
+}
+
+void storage_index_release(const char *address)
+{
+	struct storage_index *index = find_index(address);
+
+	if (!index)
+		return;
+
+	index_unmap(index);
+}
+
+void storage_index_close(const char *address)
+{
+	struct storage_index *index = find_index(address);
+	char dirname[PATH_MAX];
+
+	/* Pending writes do not depend on the index being in use */
+	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s", address);
+	flush_pending(dirname);
+
+	if (!index)
+		return;
+
+	indexes = g_slist_remove(indexes, index);
+
+	if (fdatasync(index->fd) == 0)
+		write_header(index->fd, INDEX_FLAG_CLEAN);
+
+	index_free(index);
+}
+
+gboolean storage_load_key_file(GKeyFile *key_file, const char *filename)
+{
+	struct storage_index *index;
+	struct index_entry *entry;
+	struct pending_write *pending;
+	char address[18];
+	const char *path;
+
+	if (pending_writes) {
+		pending = g_hash_table_lookup(pending_writes, filename);
+		if (pending)
+			return g_key_file_load_from_data(key_file,
+						pending->data, pending->length,
+						0, NULL);
+	}
+
+	path = index_path(filename, address);
+	if (!path)
+		goto load;
+
+	index = find_index(address);
+	if (!index || !index->entries)
+		goto load;
+
+	entry = g_hash_table_lookup(index->entries, path);
+	if (!entry)
+		return FALSE;
+
+	return g_key_file_load_from_data(key_file,
+					(const gchar *) entry->data,
+					entry->len, 0, NULL);
+
+load:
+	return g_key_file_load_from_file(key_file, filename, 0, NULL);
+}
+
+gboolean storage_set_contents(const char *filename, const gchar *data,
+								gsize length)
+{
+	struct pending_write *pending;
+
+	stats.updates++;
+
+	if (!main_opts.storage_delay)
+		return write_file(filename, data, length);
+
+	if (!pending_writes)
+		pending_writes = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, pending_write_free);
+
+	pending = g_hash_table_lookup(pending_writes, filename);
+	if (pending) {
+		g_free(pending->data);
+		stats.coalesced++;
+	} else {
+		pending = g_new0(struct pending_write, 1);
+		g_hash_table_insert(pending_writes, g_strdup(filename),
+								pending);
+		stats.pending++;
+	}
+
+	pending->data = g_memdup(data, length);
+	pending->length = length;
+
+	/* The delay counts from the first update, not the latest one */
+	if (!flush_id)
+		flush_id = g_timeout_add_seconds(main_opts.storage_delay,
+							flush_timeout, NULL);
+
+	return TRUE;
+}
+
+void storage_remove(const char *filename)
+{
+	drop_pending(filename);
+
+	index_append(filename, RECORD_FLAG_REMOVED, NULL, 0);
+}
+
+void storage_cleanup(void)
+{
+	unsigned int pending = stats.pending;
+
+	flush_pending(NULL);
+
+	if (stats.updates)
+		info("Storage: %lu updates, %lu coalesced, %u pending on exit, "
+				"%lu writes, %lu errors", stats.updates,
+				stats.coalesced, pending, stats.writes,
+				stats.errors);
+
+	if (flush_id) {
+		g_source_remove(flush_id);
+		flush_id = 0;
+	}
+
+	if (pending_writes) {
+		g_hash_table_destroy(pending_writes);
+		pending_writes = NULL;
+	}
+}
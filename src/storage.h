@@ -27,3 +27,13 @@ int read_on_mode(const char *src, char *mode, int length);
 int read_local_name(const bdaddr_t *bdaddr, char *name);
 sdp_record_t *record_from_string(const char *str);
 sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid);
+
+int storage_index_open(const char *address);
+void storage_index_release(const char *address);
+void storage_index_close(const char *address);
+gboolean storage_load_key_file(GKeyFile *key_file, const char *filename);
+gboolean storage_set_contents(const char *filename, const gchar *data,
+								gsize length);
+void storage_remove(const char *filename);
+
+void storage_cleanup(void);
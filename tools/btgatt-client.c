@@ -32,6 +32,7 @@
 #include <getopt.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -61,6 +62,7 @@
 #define COLOR_BOLDWHITE	"\x1B[1;37m"
 
 static bool verbose = false;
+static const char *cache_file = NULL;
 
 struct client {
 	int fd;
@@ -68,6 +70,9 @@ struct client {
 	struct gatt_db *db;
 	struct bt_gatt_client *gatt;
 
+	bool cache_used;
+	struct timespec start_time;
+
 	unsigned int reliable_session_id;
 };
 
@@ -175,6 +180,101 @@ static void service_removed_cb(struct gatt_db_attribute *attr, void *user_data)
 	log_service_event(attr, "Service Removed");
 }
 
+/*
+ * Attribute cache file, same as the Attributes group of the device cache
+ * files written by bluetoothd so those can be used directly.
+ */
+#define CACHE_GROUP "[Attributes]"
+
+static void store_attribute(const char *key, const char *value,
+							void *user_data)
+{
+	FILE *fp = user_data;
+
+	fprintf(fp, "%s=%s\n", key, value);
+}
+
+static void store_cache(struct gatt_db *db, const char *filename)
+{
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		perror("Failed to store attribute cache");
+		return;
+	}
+
+	fprintf(fp, "%s\n", CACHE_GROUP);
+
+	gatt_db_store(db, store_attribute, fp);
+
+	fclose(fp);
+}
+
+static bool load_cache(struct gatt_db *db, const char *filename)
+{
+	char **keys = NULL, **values = NULL;
+	unsigned int i, count = 0;
+	bool in_group = false;
+	char line[128];
+	bool ret;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (!fp)
+		return false;
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *sep;
+
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (line[0] == '[') {
+			in_group = !strcmp(line, CACHE_GROUP);
+			continue;
+		}
+
+		sep = strchr(line, '=');
+		if (!in_group || !sep)
+			continue;
+
+		*sep = '\0';
+
+		keys = realloc(keys, (count + 2) * sizeof(char *));
+		values = realloc(values, (count + 2) * sizeof(char *));
+		if (!keys || !values) {
+			fprintf(stderr, "Failed to allocate attribute cache\n");
+			exit(EXIT_FAILURE);
+		}
+
+		keys[count] = strdup(line);
+		values[count] = strdup(sep + 1);
+		count++;
+	}
+
+	fclose(fp);
+
+	if (!count)
+		return false;
+
+	keys[count] = NULL;
+	values[count] = NULL;
+
+	ret = gatt_db_load(db, keys, values);
+	if (!ret)
+		fprintf(stderr, "Invalid attribute cache: %s\n", filename);
+
+	for (i = 0; i < count; i++) {
+		free(keys[i]);
+		free(values[i]);
+	}
+
+	free(keys);
+	free(values);
+
+	return ret && !gatt_db_isempty(db);
+}
+
 static struct client *client_create(int fd, uint16_t mtu)
 {
 	struct client *cli;
@@ -217,7 +317,17 @@ static struct client *client_create(int fd, uint16_t mtu)
 		return NULL;
 	}
 
-	cli->gatt = bt_gatt_client_new(cli->db, cli->att, mtu);
+	if (cache_file)
+		cli->cache_used = load_cache(cli->db, cache_file);
+
+	clock_gettime(CLOCK_MONOTONIC, &cli->start_time);
+
+	if (cli->cache_used)
+		cli->gatt = bt_gatt_client_new_from_cache(cli->db, cli->att,
+									mtu);
+	else
+		cli->gatt = bt_gatt_client_new(cli->db, cli->att, mtu);
+
 	if (!cli->gatt) {
 		fprintf(stderr, "Failed to create GATT client\n");
 		gatt_db_unref(cli->db);
@@ -361,6 +471,8 @@ static void print_services_by_handle(struct client *cli, uint16_t handle)
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct client *cli = user_data;
+	struct timespec now;
+	long elapsed;
 
 	if (!success) {
 		PRLOG("GATT discovery procedures failed - error code: 0x%02x\n",
@@ -368,7 +480,15 @@ static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 		return;
 	}
 
-	PRLOG("GATT discovery procedures complete\n");
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - cli->start_time.tv_sec) * 1000 +
+			(now.tv_nsec - cli->start_time.tv_nsec) / 1000000;
+
+	PRLOG("GATT discovery procedures complete in %ld ms (cache %s)\n",
+				elapsed, cli->cache_used ? "used" : "not used");
+
+	if (cache_file)
+		store_cache(cli->db, cache_file);
 
 	print_services(cli);
 	print_prompt();
@@ -382,6 +502,9 @@ static void service_changed_cb(uint16_t start_handle, uint16_t end_handle,
 	printf("\nService Changed handled - start: 0x%04x end: 0x%04x\n",
 						start_handle, end_handle);
 
+	if (cache_file)
+		store_cache(cli->db, cache_file);
+
 	gatt_db_foreach_service_in_range(cli->db, NULL, print_service, cli,
 						start_handle, end_handle);
 	print_prompt();
@@ -1507,6 +1630,7 @@ static void usage(void)
 		"\t-m, --mtu <mtu> \t\tThe ATT MTU to use\n"
 		"\t-s, --security-level <sec> \tSet security level (low|"
 								"medium|high)\n"
+		"\t-c, --cache <file>\t\tLoad and store attribute cache\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
@@ -1517,6 +1641,7 @@ static struct option main_options[] = {
 	{ "type",		1, 0, 't' },
 	{ "mtu",		1, 0, 'm' },
 	{ "security-level",	1, 0, 's' },
+	{ "cache",		1, 0, 'c' },
 	{ "verbose",		0, 0, 'v' },
 	{ "help",		0, 0, 'h' },
 	{ }
@@ -1535,7 +1660,7 @@ int main(int argc, char *argv[])
 	sigset_t mask;
 	struct client *cli;
 
-	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:",
+	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:c:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1544,6 +1669,9 @@ int main(int argc, char *argv[])
 		case 'v':
 			verbose = true;
 			break;
+		case 'c':
+			cache_file = optarg;
+			break;
 		case 's':
 			if (strcmp(optarg, "low") == 0)
 				sec = BT_SECURITY_LOW;
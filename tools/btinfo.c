@@ -169,6 +169,100 @@ static bool cmd_local(int argc, char *argv[])
 	return true;
 }
 
+static const uint16_t latency_opcodes[] = {
+	BT_HCI_CMD_READ_LOCAL_VERSION,
+	BT_HCI_CMD_READ_LOCAL_COMMANDS,
+	BT_HCI_CMD_READ_LOCAL_FEATURES,
+	BT_HCI_CMD_READ_BUFFER_SIZE,
+	BT_HCI_CMD_READ_BD_ADDR,
+};
+
+static unsigned int latency_pending;
+
+static void print_latency(const char *label,
+				const struct bt_hci_latency *latency)
+{
+	int i;
+
+	if (!latency->count)
+		return;
+
+	printf("  %s: avg %llu usec, max %llu usec\n", label,
+			(unsigned long long) (latency->total / latency->count),
+			(unsigned long long) latency->max);
+
+	for (i = 0; i < BT_HCI_LATENCY_BUCKETS; i++) {
+		if (!latency->buckets[i])
+			continue;
+
+		if (i == BT_HCI_LATENCY_BUCKETS - 1)
+			printf("    >= %8u usec: %u\n", 1U << (i - 1),
+							latency->buckets[i]);
+		else
+			printf("    <  %8u usec: %u\n", 1U << i,
+							latency->buckets[i]);
+	}
+}
+
+static void print_cmd_stats(const struct bt_hci_cmd_stats *stats,
+							void *user_data)
+{
+	printf("Opcode 0x%4.4x (0x%2.2x|0x%4.4x): %u commands\n",
+				stats->opcode, stats->opcode >> 10,
+				stats->opcode & 0x3ff, stats->queue.count);
+
+	print_latency("Queue delay", &stats->queue);
+	print_latency("Controller latency", &stats->response);
+}
+
+static void latency_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_stats stats;
+
+	if (--latency_pending)
+		return;
+
+	bt_hci_foreach_cmd_stats(hci_dev, print_cmd_stats, NULL);
+
+	bt_hci_get_stats(hci_dev, &stats);
+
+	printf("Command credit stalls: %u (%llu usec)\n",
+				stats.credit_stalls,
+				(unsigned long long) stats.credit_stall_time);
+
+	shutdown_device();
+}
+
+static bool cmd_latency(int argc, char *argv[])
+{
+	unsigned int num = sizeof(latency_opcodes) / sizeof(uint16_t);
+	unsigned int count = 10;
+	unsigned int i, n;
+
+	if (argc > 0)
+		count = atoi(argv[0]);
+
+	if (count < 1)
+		return false;
+
+	if (reset_on_init)
+		bt_hci_send(hci_dev, BT_HCI_CMD_RESET, NULL, 0,
+						NULL, NULL, NULL);
+
+	for (i = 0; i < count; i++) {
+		for (n = 0; n < num; n++) {
+			if (!bt_hci_send(hci_dev, latency_opcodes[n], NULL, 0,
+					latency_callback, NULL, NULL))
+				return false;
+
+			latency_pending++;
+		}
+	}
+
+	return true;
+}
+
 typedef bool (*cmd_func_t)(int argc, char *argv[]);
 
 static const struct {
@@ -177,6 +271,7 @@ static const struct {
 	const char *help;
 } cmd_table[] = {
 	{ "local", cmd_local, "Print local controller details" },
+	{ "latency", cmd_latency, "Measure HCI command latency [count]" },
 	{ }
 };
 
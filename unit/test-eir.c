@@ -614,6 +614,31 @@ static void test_parsing(gconstpointer data)
 
 	eir_data_free(&eir);
 
+	/* The basic parsing must agree on the fields it handles */
+	memset(&eir, 0, sizeof(eir));
+
+	eir_parse_basic(&eir, test->eir_data, test->eir_size);
+
+	g_assert_cmpint(eir.flags, ==, test->flags);
+	g_assert(eir.tx_power == test->tx_power);
+	g_assert(eir.name == NULL);
+	g_assert(eir.msd_list == NULL);
+	g_assert(eir.sd_list == NULL);
+
+	if (test->uuid) {
+		int n = 0;
+
+		for (list = eir.services; list; list = list->next, n++) {
+			char *uuid_str = list->data;
+			g_assert(test->uuid[n]);
+			g_assert_cmpstr(test->uuid[n], ==, uuid_str);
+		}
+	} else {
+		g_assert(eir.services == NULL);
+	}
+
+	eir_data_free(&eir);
+
 	tester_test_passed();
 }
 
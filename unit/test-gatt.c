@@ -31,6 +31,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include <glib.h>
@@ -2318,6 +2319,70 @@ static const struct test_step test_indication_server_1 = {
 	.length = 0x03,
 };
 
+#define DB_LOOKUP_ROUNDS 100000
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void test_db_lookup(gconstpointer data)
+{
+	unsigned int num_services = PTR_TO_UINT(data);
+	struct gatt_db *db;
+	struct gatt_db_attribute *attr;
+	bt_uuid_t uuid;
+	uint64_t start, elapsed;
+	uint16_t handle, max_handle;
+	unsigned int i;
+
+	db = gatt_db_new();
+	g_assert(db);
+
+	bt_uuid16_create(&uuid, 0x1800);
+
+	/* Each service holds 3 characteristics: 7 handles */
+	for (i = 0; i < num_services; i++) {
+		attr = gatt_db_add_service(db, &uuid, true, 7);
+		g_assert(attr);
+
+		g_assert(gatt_db_service_add_characteristic(attr, &uuid, 0, 0,
+							NULL, NULL, NULL));
+		g_assert(gatt_db_service_add_characteristic(attr, &uuid, 0, 0,
+							NULL, NULL, NULL));
+		g_assert(gatt_db_service_add_characteristic(attr, &uuid, 0, 0,
+							NULL, NULL, NULL));
+	}
+
+	max_handle = num_services * 7;
+
+	start = get_time_ns();
+
+	for (i = 0; i < DB_LOOKUP_ROUNDS; i++) {
+		handle = (i * 7919) % max_handle + 1;
+
+		attr = gatt_db_get_attribute(db, handle);
+		g_assert(attr);
+		g_assert_cmpint(gatt_db_attribute_get_handle(attr), ==, handle);
+	}
+
+	elapsed = get_time_ns() - start;
+
+	tester_debug("%u services: %u lookups in %" PRIu64 " ns "
+				"(%" PRIu64 " lookups/s)", num_services,
+				DB_LOOKUP_ROUNDS, elapsed,
+				elapsed ? DB_LOOKUP_ROUNDS * 1000000000ULL /
+								elapsed : 0);
+
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
@@ -4425,5 +4490,18 @@ int main(int argc, char *argv[])
 				0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff),
 			raw_pdu(0x01, 0x16, 0x04, 0x00, 0x03));
 
+	/*
+	 * Database lookup benchmark
+	 *
+	 * Measures handle lookups per second with a growing number of
+	 * services, run with -d to print the results.
+	 */
+	tester_add("/benchmark/gatt-db/lookup/10", UINT_TO_PTR(10), NULL,
+						test_db_lookup, NULL);
+	tester_add("/benchmark/gatt-db/lookup/100", UINT_TO_PTR(100), NULL,
+						test_db_lookup, NULL);
+	tester_add("/benchmark/gatt-db/lookup/1000", UINT_TO_PTR(1000), NULL,
+						test_db_lookup, NULL);
+
 	return tester_run();
 }
@@ -429,6 +429,124 @@ static void test_destroy(gconstpointer data)
 	execute_context(context);
 }
 
+static const unsigned char read_info_index_0[] =
+				{ 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static const unsigned char read_info_index_1[] =
+				{ 0x04, 0x00, 0x01, 0x00, 0x00, 0x00 };
+static const unsigned char load_irks_index_0[] =
+				{ 0x30, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static const unsigned char load_conn_param_index_0[] =
+				{ 0x35, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static const unsigned char load_irks_index_0_param[] = { 0x00, 0x00 };
+
+static void test_pipeline_index(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	add_action(context, read_info_index_0, sizeof(read_info_index_0),
+				NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, read_info_index_1, sizeof(read_info_index_1),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_set_pipeline(context->mgmt_client, 2);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 0, 0, NULL,
+							NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 1, 0, NULL,
+							NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void test_pipeline_unordered(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	add_action(context, load_irks_index_0, sizeof(load_irks_index_0),
+				NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, load_conn_param_index_0,
+				sizeof(load_conn_param_index_0),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_set_pipeline(context->mgmt_client, 2);
+
+	mgmt_send_unordered(context->mgmt_client, MGMT_OP_LOAD_IRKS, 0, 0,
+						NULL, NULL, NULL, NULL);
+	mgmt_send_unordered(context->mgmt_client, MGMT_OP_LOAD_CONN_PARAM, 0,
+						0, NULL, NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+/*
+ * The ordering tests queue a request that must be held back followed by a
+ * request for another index. The held back request has no handler, so the
+ * test fails if it gets sent before the request for the other index.
+ */
+static void test_pipeline_order(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	add_action(context, read_info_index_0, sizeof(read_info_index_0),
+				NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, read_info_index_1, sizeof(read_info_index_1),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_set_pipeline(context->mgmt_client, 3);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 0, 0, NULL,
+							NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_LOAD_IRKS, 0, 0, NULL,
+							NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 1, 0, NULL,
+							NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void test_pipeline_unordered_behind_ordered(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	add_action(context, read_info_index_0, sizeof(read_info_index_0),
+				NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, read_info_index_1, sizeof(read_info_index_1),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_set_pipeline(context->mgmt_client, 3);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 0, 0, NULL,
+							NULL, NULL, NULL);
+	mgmt_send_unordered(context->mgmt_client, MGMT_OP_LOAD_IRKS, 0, 0,
+						NULL, NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 1, 0, NULL,
+							NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void test_pipeline_unordered_same_opcode(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	add_action(context, load_irks_index_0, sizeof(load_irks_index_0),
+				NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, read_info_index_1, sizeof(read_info_index_1),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_set_pipeline(context->mgmt_client, 3);
+
+	mgmt_send_unordered(context->mgmt_client, MGMT_OP_LOAD_IRKS, 0, 0,
+						NULL, NULL, NULL, NULL);
+	mgmt_send_unordered(context->mgmt_client, MGMT_OP_LOAD_IRKS, 0,
+				sizeof(load_irks_index_0_param),
+				load_irks_index_0_param, NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 1, 0, NULL,
+							NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -451,5 +569,14 @@ int main(int argc, char *argv[])
 
 	g_test_add_data_func("/mgmt/destroy/1", &event_test_1, test_destroy);
 
+	g_test_add_data_func("/mgmt/pipeline/1", NULL, test_pipeline_index);
+	g_test_add_data_func("/mgmt/pipeline/2", NULL,
+						test_pipeline_unordered);
+	g_test_add_data_func("/mgmt/pipeline/3", NULL, test_pipeline_order);
+	g_test_add_data_func("/mgmt/pipeline/4", NULL,
+				test_pipeline_unordered_behind_ordered);
+	g_test_add_data_func("/mgmt/pipeline/5", NULL,
+				test_pipeline_unordered_same_opcode);
+
 	return g_test_run();
 }
@@ -0,0 +1,247 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+#include "monitor/packet.h"
+
+#include <glib.h>
+
+/*
+ * Generated trace with many concurrent links on one controller. Every link
+ * connects several L2CAP channels and then sends an SDP request on each of
+ * them, split into two fragments. Start fragments of all links are sent
+ * before any continuation so that reassembly of all links is in progress
+ * at the same time.
+ */
+struct links_data {
+	uint16_t index;
+	uint16_t links;
+	uint16_t chans;
+};
+
+static const struct links_data links_256 = {
+	.index = 0,
+	.links = 256,
+	.chans = 2,
+};
+
+static const struct links_data links_max_index = {
+	.index = 0xffff,
+	.links = 4,
+	.chans = 2,
+};
+
+static struct timeval tv;
+
+static void send_packet(uint16_t index, uint16_t opcode, const void *data,
+								uint16_t size)
+{
+	tv.tv_usec++;
+
+	packet_monitor(&tv, index, opcode, data, size);
+}
+
+static void send_event(uint16_t index, uint8_t code, const void *data,
+								uint8_t size)
+{
+	uint8_t buf[2 + size];
+
+	buf[0] = code;
+	buf[1] = size;
+	memcpy(buf + 2, data, size);
+
+	send_packet(index, BTSNOOP_OPCODE_EVENT_PKT, buf, sizeof(buf));
+}
+
+static void send_acl(uint16_t index, bool rx, uint16_t handle, uint8_t flags,
+					const void *data, uint16_t size)
+{
+	uint8_t buf[4 + size];
+
+	put_le16(handle | flags << 12, buf);
+	put_le16(size, buf + 2);
+	memcpy(buf + 4, data, size);
+
+	send_packet(index, rx ? BTSNOOP_OPCODE_ACL_RX_PKT :
+				BTSNOOP_OPCODE_ACL_TX_PKT, buf, sizeof(buf));
+}
+
+static void send_l2cap(uint16_t index, bool rx, uint16_t handle,
+				uint16_t cid, const void *data, uint16_t size)
+{
+	uint8_t buf[4 + size];
+
+	put_le16(size, buf);
+	put_le16(cid, buf + 2);
+	memcpy(buf + 4, data, size);
+
+	send_acl(index, rx, handle, 0x02, buf, sizeof(buf));
+}
+
+static void generate_links(const struct links_data *data)
+{
+	struct btsnoop_opcode_new_index ni;
+	uint16_t handle, chan;
+
+	memset(&ni, 0, sizeof(ni));
+	ni.type = 0x00;
+	ni.bus = 0x00;
+	memcpy(ni.name, "hci0", 4);
+
+	send_packet(data->index, BTSNOOP_OPCODE_NEW_INDEX, &ni, sizeof(ni));
+
+	for (handle = 1; handle <= data->links; handle++) {
+		uint8_t evt[11];
+
+		/* Connection Complete, ACL */
+		memset(evt, 0, sizeof(evt));
+		put_le16(handle, evt + 1);
+		put_le16(handle, evt + 3);
+		evt[9] = 0x01;
+
+		send_event(data->index, 0x03, evt, sizeof(evt));
+	}
+
+	for (handle = 1; handle <= data->links; handle++) {
+		for (chan = 0; chan < data->chans; chan++) {
+			uint8_t req[8], rsp[12];
+
+			/* Connection Request for SDP */
+			req[0] = 0x02;
+			req[1] = chan + 1;
+			put_le16(4, req + 2);
+			put_le16(0x0001, req + 4);
+			put_le16(0x0040 + chan, req + 6);
+
+			send_l2cap(data->index, false, handle, 0x0001,
+							req, sizeof(req));
+
+			/* Connection Response, successful */
+			memset(rsp, 0, sizeof(rsp));
+			rsp[0] = 0x03;
+			rsp[1] = chan + 1;
+			put_le16(8, rsp + 2);
+			put_le16(0x0080 + chan, rsp + 4);
+			put_le16(0x0040 + chan, rsp + 6);
+
+			send_l2cap(data->index, true, handle, 0x0001,
+							rsp, sizeof(rsp));
+		}
+	}
+
+	for (chan = 0; chan < data->chans; chan++) {
+		/* Service Search Request for Audio Source */
+		uint8_t frame[17] = { 0x0d, 0x00, 0x80 + chan, 0x00,
+					0x02, 0x00, chan, 0x00, 0x08,
+					0x35, 0x03, 0x19, 0x11, 0x0a,
+					0x00, 0x10, 0x00 };
+
+		for (handle = 1; handle <= data->links; handle++)
+			send_acl(data->index, false, handle, 0x02, frame, 6);
+
+		for (handle = 1; handle <= data->links; handle++)
+			send_acl(data->index, false, handle, 0x01, frame + 6,
+							sizeof(frame) - 6);
+	}
+
+	for (handle = 1; handle <= data->links; handle++) {
+		uint8_t evt[4];
+
+		/* Disconnection Complete */
+		evt[0] = 0x00;
+		put_le16(handle, evt + 1);
+		evt[3] = 0x13;
+
+		send_event(data->index, 0x05, evt, sizeof(evt));
+	}
+}
+
+static unsigned int count_lines(FILE *f, const char *str)
+{
+	char line[256];
+	unsigned int count = 0;
+
+	rewind(f);
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strstr(line, str))
+			count++;
+	}
+
+	return count;
+}
+
+static void test_links(const void *test_data)
+{
+	const struct links_data *data = test_data;
+	unsigned int expected = data->links * data->chans;
+	FILE *f;
+	int fd;
+
+	f = tmpfile();
+	g_assert(f);
+
+	/* Decoded output goes to stdout, capture it */
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	g_assert(fd >= 0);
+	dup2(fileno(f), STDOUT_FILENO);
+
+	generate_links(data);
+
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	tester_debug("%u links, %u channels each", data->links, data->chans);
+
+	g_assert_cmpuint(count_lines(f, "SDP: Service Search Request"), ==,
+								expected);
+	g_assert_cmpuint(count_lines(f, "[PSM 1 mode 0]"), ==, expected);
+	g_assert_cmpuint(count_lines(f, "Disconnect Complete"), ==,
+								data->links);
+
+	fclose(f);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/monitor/links/256", &links_256, NULL, test_links, NULL);
+	tester_add("/monitor/links/max_index", &links_max_index, NULL,
+							test_links, NULL);
+
+	return tester_run();
+}
@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <time.h>
+
 #include <glib.h>
 
 #include "src/shared/util.h"
@@ -259,6 +261,96 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+#define BENCHMARK_ROUNDS 100000
+#define BENCHMARK_DEPTH 32
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct malloc_entry {
+	void *data;
+	struct malloc_entry *next;
+};
+
+/*
+ * Push/pop throughput of the queue compared against a plain linked list that
+ * allocates and frees a node for every element, which is what the queue did
+ * before entries were recycled.
+ */
+static void test_benchmark_push_pop(const void *data)
+{
+	struct queue *queue;
+	struct malloc_entry *head = NULL, *tail = NULL;
+	uint64_t start, queue_ns, malloc_ns;
+	unsigned int i, j;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	start = get_time_ns();
+
+	for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+		for (j = 1; j <= BENCHMARK_DEPTH; j++)
+			queue_push_tail(queue, UINT_TO_PTR(j));
+
+		for (j = 1; j <= BENCHMARK_DEPTH; j++)
+			g_assert(queue_pop_head(queue) == UINT_TO_PTR(j));
+	}
+
+	queue_ns = get_time_ns() - start;
+
+	queue_destroy(queue, NULL);
+
+	start = get_time_ns();
+
+	for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+		for (j = 1; j <= BENCHMARK_DEPTH; j++) {
+			struct malloc_entry *entry;
+
+			entry = new0(struct malloc_entry, 1);
+			g_assert(entry != NULL);
+
+			entry->data = UINT_TO_PTR(j);
+
+			if (tail)
+				tail->next = entry;
+			else
+				head = entry;
+
+			tail = entry;
+		}
+
+		for (j = 1; j <= BENCHMARK_DEPTH; j++) {
+			struct malloc_entry *entry = head;
+
+			g_assert(entry->data == UINT_TO_PTR(j));
+
+			head = entry->next;
+			if (!head)
+				tail = NULL;
+
+			free(entry);
+		}
+	}
+
+	malloc_ns = get_time_ns() - start;
+
+	tester_debug("%u push/pop pairs: queue %llu ns/op, malloc %llu ns/op",
+				BENCHMARK_ROUNDS * BENCHMARK_DEPTH,
+				(unsigned long long) queue_ns /
+					(BENCHMARK_ROUNDS * BENCHMARK_DEPTH),
+				(unsigned long long) malloc_ns /
+					(BENCHMARK_ROUNDS * BENCHMARK_DEPTH));
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -276,6 +368,8 @@ int main(int argc, char *argv[])
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/queue/benchmark/push_pop", NULL, NULL,
+					test_benchmark_push_pop, NULL);
 
 	return tester_run();
 }